@@ -20,9 +20,31 @@
  #include <time.h>
  #include <ctype.h>
  #include <stdbool.h>
+ #include <stdint.h>
+ #include <inttypes.h>
  
- #define MAX_CUSTOMERS 100
- #define MAX_PREMISES 200
+ #ifdef _WIN32
+     #include <io.h>
+     #include <direct.h>
+     #include <windows.h>
+ #else
+     #include <unistd.h>
+     #include <fcntl.h>
+     #include <pthread.h>
+     #include <sys/mman.h>
+     #include <sys/stat.h>
+     #include <sys/socket.h>
+     #include <sys/un.h>
+     #include <poll.h>
+     #include <signal.h>
+     #include <errno.h>
+ #endif
+ 
+ #define TABLE_CHUNK_SHIFT 12                  // Rows per table chunk as a power of two (4096)
+ #define TABLE_CHUNK_ROWS (1 << TABLE_CHUNK_SHIFT)
+ #define NUMBER_NONE UINT32_MAX                 // Packed key of a malformed customer/premises number
+ #define NUMBER_FIRST 1000000                  // Lowest customer/premises number handed out automatically
+ #define NUMBER_LIMIT 10000000                 // One past the highest 7-digit number
  #define MAX_NAME_LENGTH 50
  #define MAX_EMAIL_LENGTH 100
  #define MAX_PASSWORD_LENGTH 50
@@ -34,6 +56,101 @@
  #define FILE_USERS "users.txt"
  #define FILE_PAYMENT_CARDS "payment_cards.txt"
  #define FILE_LOGS "system_logs.txt"
+ #define FILE_BILL_INDEX "bills_index.txt"
+ #define FILE_JOURNAL "journal.txt"
+ #define FILE_TARIFFS "tariffs.txt"
+ #define FILE_LEDGER "ledger.txt"
+ #define FILE_BILLING_RUNS "billing_runs.txt"
+ #define FILE_PAID_VIEW "view_paid.txt"
+ #define FILE_OWING_VIEW "view_owing.txt"
+ #define FILE_ARCHIVED_VIEW "view_archived.txt"
+ #define FILE_ID_COUNTER "id_counter.txt"
+ #define FILE_LOCK "data.lock"
+ #define JOURNAL_MAGIC 0x4a43574eU             // "NWCJ" marks the start of every journal record
+ #define JOURNAL_CHECKPOINT_RECORDS 1024       // Checkpoint the journal once it holds this many records
+ #define MAX_WORKERS 16                        // Most worker threads used by a parallel job
+ #define BILLING_MIN_SLICE 256                 // Fewest premises worth giving a billing worker
+ #define REPORT_MIN_SLICE 65536                // Fewest bills worth giving a report worker
+ #define AUDIT_MAX_LISTED 10                   // Most mismatches an audit lists individually
+ #define EXPORT_BUFFER_SIZE (1 << 20)          // Bytes an export buffers between writes
+ #define DEBTOR_PAGE_SIZE 20                   // Customers listed per page of the debtors report
+ #define COMMAND_BUFFER_SIZE (1 << 16)         // Bytes of command input buffered (longest command line)
+ #define COMMAND_MAX_ARGS 16                   // Most words in one command line
+#define COMMAND_RETRIES 8                     // Times a command that lost a race over appended rows is run again
+ #define SERVER_MAX_CONNECTIONS 256            // Most clients connected to the server at once
+ #define ID_SEQUENCE_BITS 20                   // Low bits of an ID that count IDs within one second
+ #define ID_BLOCK_SIZE 256                     // IDs a thread claims from the shared counter at once
+ #define ID_RESERVE_SIZE (1 << 16)             // IDs reserved in id_counter.txt per counter write
+ #define TARIFF_TIERS 4                        // Consumption tiers of the water and sewerage tariffs
+ #define RATING_BLOCK 256                      // Consumptions rated per tariff kernel call
+ #define METER_SIZE_COUNT 3                    // Number of meter sizes (service charges per schedule)
+ #define CENTS_PER_DOLLAR 100                  // Money is held in whole cents
+ #define RATE_SCALE 1000000                    // Tariff rates (PAM, X-Factor, K-Factor) are parts per million
+ #define RATE_DECIMALS 6                       // Decimal places of a tariff rate
+ #define DAYS_PER_BILL 30                      // Days of meter usage generated for each bill
+ #define SIM_COMMIT_BATCH 4096                 // Registrations committed per journal group in a simulation
+ #define SIM_PAY_FULL_PERCENT 80               // Chance a simulated customer pays their latest bill in full
+ #define SIM_PAY_PART_PERCENT 10               // Chance a simulated customer pays half of it instead
+ #define SIM_OVERPAY_PERCENT 5                 // Chance a simulated full payment overpays
+ #define SIM_SURRENDER_PER_MILLE 5             // Monthly chance (per thousand) a premises owing nothing is surrendered
+ 
+ // Settings every tariff schedule must give (bit flags)
+ #define TARIFF_SET_TIERS 0x01
+ #define TARIFF_SET_WATER 0x02
+ #define TARIFF_SET_SEWERAGE 0x04
+ #define TARIFF_SET_SERVICE 0x08
+ #define TARIFF_SET_PAM 0x10
+ #define TARIFF_SET_X_FACTOR 0x20
+ #define TARIFF_SET_K_FACTOR 0x40
+ #define TARIFF_ALL_SETTINGS 0x7f
+ 
+ // Worker threads (thread handle, entry point result type and return value)
+ #ifdef _WIN32
+     typedef HANDLE WorkerThread;
+     #define WORKER_RESULT DWORD WINAPI
+     #define WORKER_RETURN 0
+     typedef DWORD (WINAPI *WorkerFunction)(void *arg);
+ #else
+     typedef pthread_t WorkerThread;
+     #define WORKER_RESULT void *
+     #define WORKER_RETURN NULL
+     typedef void *(*WorkerFunction)(void *arg);
+ #endif
+ 
+ // Thread-local storage, 64-bit atomics and statically initialized locks
+ #ifdef _WIN32
+     #define THREAD_LOCAL __declspec(thread)
+     #define atomicLoad64(target) ((uint64_t)InterlockedCompareExchange64((volatile LONG64 *)(target), 0, 0))
+     #define atomicStore64(target, value) InterlockedExchange64((volatile LONG64 *)(target), (LONG64)(value))
+     #define atomicCompareSwap64(target, expected, desired) \
+         ((uint64_t)InterlockedCompareExchange64((volatile LONG64 *)(target), (LONG64)(desired), (LONG64)(expected)) == (expected))
+     typedef SRWLOCK SharedLock;
+     #define SHARED_LOCK_INIT SRWLOCK_INIT
+     #define lockShared(lock) AcquireSRWLockExclusive(lock)
+     #define unlockShared(lock) ReleaseSRWLockExclusive(lock)
+     typedef SRWLOCK ReadWriteLock;
+     #define READ_WRITE_LOCK_INIT SRWLOCK_INIT
+     #define lockRead(lock) AcquireSRWLockShared(lock)
+     #define unlockRead(lock) ReleaseSRWLockShared(lock)
+     #define lockWrite(lock) AcquireSRWLockExclusive(lock)
+     #define unlockWrite(lock) ReleaseSRWLockExclusive(lock)
+ #else
+     #define THREAD_LOCAL __thread
+     #define atomicLoad64(target) __atomic_load_n((target), __ATOMIC_ACQUIRE)
+     #define atomicStore64(target, value) __atomic_store_n((target), (value), __ATOMIC_RELEASE)
+     #define atomicCompareSwap64(target, expected, desired) \
+         __atomic_compare_exchange_n((target), &(uint64_t){ (expected) }, (desired), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+     typedef pthread_mutex_t SharedLock;
+     #define SHARED_LOCK_INIT PTHREAD_MUTEX_INITIALIZER
+     #define lockShared(lock) pthread_mutex_lock(lock)
+     #define unlockShared(lock) pthread_mutex_unlock(lock)
+     typedef pthread_rwlock_t ReadWriteLock;
+     #define READ_WRITE_LOCK_INIT PTHREAD_RWLOCK_INITIALIZER
+     #define lockRead(lock) pthread_rwlock_rdlock(lock)
+     #define unlockRead(lock) pthread_rwlock_unlock(lock)
+     #define lockWrite(lock) pthread_rwlock_wrlock(lock)
+     #define unlockWrite(lock) pthread_rwlock_unlock(lock)
+ #endif
  
  // Enumeration for user types
  typedef enum {
@@ -142,60 +259,763 @@
      char log_date[11];                       // Log date
  } SystemLog;
  
+ // Enumeration for data files that journal records apply to
+ typedef enum {
+     JOURNAL_COMMIT = 0,        // Commit marker closing a group of records
+     JOURNAL_BILLS = 1,         // Bill record in bills.txt
+     JOURNAL_CUSTOMERS = 2,     // Customer record in customers.txt
+     JOURNAL_PREMISES = 3,      // Premises record in premises.txt
+     JOURNAL_LEDGER = 4,        // Premises ledger record in ledger.txt
+     JOURNAL_RUNS = 5,          // Billing run record in billing_runs.txt
+     JOURNAL_PAID_VIEW = 6,     // Paid bills view row in view_paid.txt
+     JOURNAL_OWING_VIEW = 7,    // Owing bills view row in view_owing.txt
+     JOURNAL_ARCHIVED_VIEW = 8, // Archived customers view row in view_archived.txt
+     JOURNAL_USERS = 9,         // User record in users.txt
+     JOURNAL_PAYMENTS = 10,     // Payment record in payments.txt
+     JOURNAL_TARGET_COUNT
+ } JournalTarget;
+ 
+ // Enumeration for the bytes of data.lock that processes sharing a data directory lock
+ typedef enum {
+     LOCK_JOURNAL = 0,          // Held while reading new groups from, appending to or checkpointing journal.txt
+     LOCK_IDS = 1,              // Held while reserving IDs in id_counter.txt
+     LOCK_PRESENCE = 2          // Held shared by every process using the directory (exclusive to checkpoint)
+ } DataFileLock;
+ 
+ // Structure for the header written before each record image in the journal
+ typedef struct {
+     uint32_t magic;                          // JOURNAL_MAGIC
+     uint32_t target;                         // JournalTarget the image applies to
+     int32_t record;                          // Record number in the target file (record count for commits)
+     uint32_t size;                           // Size of the record image that follows
+     uint32_t checksum;                       // Checksum of the record image
+ } JournalRecordHeader;
+ 
+ // Structure for records staged in memory until the next commit
+ typedef struct {
+     unsigned char *data;                     // Headers and images in journal layout
+     size_t size;                             // Bytes staged
+     size_t capacity;                         // Bytes allocated
+     int records;                             // Number of records staged
+     int staged_bills;                        // Number of staged records that append bills
+     int staged_users;                        // Number of staged records that append users
+     int pending_records;                     // Records committed since the last checkpoint
+     long applied;                            // Bytes of journal.txt applied to the in-memory tables
+     bool conflict;                           // True if the last commit lost to another process's changes
+     bool appended;                           // True if that conflict was only over rows both processes appended
+     int retries;                             // Times a command losing such a conflict may still be run again
+     bool loaded;                             // True once the tables are loaded and follow journal.txt
+ } JournalBuffer;
+ 
+ // Structure for bill index entries (one per bills.txt record, in record order)
+ typedef struct {
+     char customer_number[8];                 // Customer number of the indexed bill
+     char premises_number[8];                 // Premises number of the indexed bill
+     int32_t record;                          // Record number of the bill in bills.txt
+ } BillIndexEntry;
+ 
+ // Structure for an open-addressing hash index (64-bit key -> table position)
+ typedef struct {
+     uint64_t *keys;                          // Key stored in each slot
+     int32_t *values;                         // Value stored in each slot (-1 marks an empty slot)
+     int capacity;                            // Number of slots (always a power of two)
+     int count;                               // Number of occupied slots
+ } HashIndex;
+ 
+ // Structure for a number allocator (one bit per 7-digit number, set while the number is in use)
+ typedef struct {
+     uint64_t *words;                         // NUMBER_LIMIT bits, 64 numbers per word
+     int32_t cursor;                          // Word below which no number from NUMBER_FIRST up is free
+ } NumberAllocator;
+ 
+ // Structure for the bill records of one customer/premises pair
+ typedef struct {
+     uint32_t customer_key;                   // Packed customer number of the pair
+     uint32_t premises_key;                   // Packed premises number of the pair
+     int32_t *records;                        // Bill record numbers in ascending order
+     int count;                               // Number of records in use
+     int capacity;                            // Number of records allocated
+ } BillIndexBucket;
+ 
+ // Structure for the in-memory bill index (customer -> premises -> bill records)
+ typedef struct {
+     HashIndex by_customer;                   // Packed customer number -> bucket position
+     BillIndexBucket *buckets;                // One bucket per customer/premises pair
+     int bucket_count;                        // Number of buckets in use
+     int bucket_capacity;                     // Number of buckets allocated
+     int record_count;                        // Number of bills.txt records indexed
+ } BillIndex;
+ 
+ // Structure for a fixed-size record file loaded into memory
+ typedef struct {
+     void *data;                              // Records in on-disk layout (NULL if the file is empty)
+     size_t size;                             // Bytes of data loaded
+     long count;                              // Number of whole records
+     bool mapped;                             // True if data is an mmap view, false if a heap copy
+ } MappedFile;
+ 
+ // Structure for a growable table of fixed-size rows
+ // Rows live in fixed-size chunks that are never moved, so row pointers stay
+ // valid as the table grows and each chunk is one contiguous array of rows.
+ typedef struct {
+     size_t row_size;                         // Size of each row in bytes
+     unsigned char **chunks;                  // Chunk directory (TABLE_CHUNK_ROWS rows per chunk)
+     int chunk_count;                         // Number of chunks allocated
+     int chunk_capacity;                      // Number of chunk directory entries allocated
+     int count;                               // Number of rows in use
+     int borrowed_chunks;                     // Leading chunks that point into source rather than the heap
+     MappedFile source;                       // Record file the borrowed chunks were loaded from
+ } RecordTable;
+ 
+ // Structure for the lookup key of a customer row (parallel to customer_table)
+ typedef struct {
+     uint32_t number_key;                     // Packed customer number
+     int32_t first_premises;                  // First premises row of the customer (-1 if none)
+     int32_t last_premises;                   // Last premises row of the customer (-1 if none)
+ } CustomerKey;
+ 
+ // Structure for the lookup key of a premises row (parallel to premises_table)
+ typedef struct {
+     uint32_t number_key;                     // Packed premises number
+     int32_t customer_row;                    // Customer row the premises belongs to (-1 if unknown)
+     int32_t next_premises;                   // Next premises row of the same customer (-1 if last)
+ } PremisesKey;
+ 
+ // Money amount in whole cents
+ // Bill, Payment and SystemLog keep their on-disk double fields, which hold
+ // whole-cent values; convert with moneyFromDouble and moneyToDouble.
+ typedef int64_t Money;
+ 
+ // Structure for the running account of a premises (parallel to premises_table)
+ // Kept in step with bills.txt by journaling each change in the same group as
+ // the bill it comes from, so billing checks never have to rescan bills.
+ typedef struct {
+     char premises_number[8];                 // Premises number the ledger row belongs to
+     int32_t unpaid_count;                    // Number of unpaid bills
+     int32_t last_month;                      // Month of the latest bill (0 if never billed)
+     int32_t last_year;                       // Year of the latest bill (0 if never billed)
+     Money outstanding;                       // Sum of the balances of the unpaid bills
+     Money credit;                            // Overpayment to credit against the next bill
+ } PremisesLedger;
+ 
+ // Structure for the rating table of a tiered tariff
+ typedef struct {
+     int lower[TARIFF_TIERS];                 // First litre of each tier
+     Money rate[TARIFF_TIERS];                // Rate of each tier in cents per cubic metre (thousandths of a cent per litre)
+     int64_t base[TARIFF_TIERS];              // Charge for all consumption below each tier in thousandths of a cent
+ } TariffTiers;
+ 
+ // Structure for a tariff schedule compiled into rating tables
+ typedef struct {
+     char effective_date[11];                 // First bill date the schedule applies to (YYYY-MM-DD)
+     TariffTiers water;                       // Water rating table
+     TariffTiers sewerage;                    // Sewerage rating table
+     Money service_charge[METER_SIZE_COUNT];  // Monthly service charge per meter size (15mm, 30mm, 150mm)
+     int64_t pam_rate;                        // PAM share of water, sewerage and service (RATE_SCALE)
+     int64_t x_factor_rate;                   // X-Factor share of water, sewerage and service (RATE_SCALE)
+     int64_t k_factor_rate;                   // K-Factor share of water, sewerage, service and PAM (RATE_SCALE)
+ } TariffSchedule;
+ 
+ // Structure for a xoshiro256** random number stream
+ typedef struct {
+     uint64_t state[4];                       // Generator state (never all zero)
+ } RandomStream;
+ 
+ // Structure for the billing runs log (one record per bill generation or billing cycle)
+ // Every bill of a run draws its usage from a stream derived from the run seed
+ // and its premises number, so prepareBill given the same seed regenerates it.
+ typedef struct {
+     uint64_t seed;                           // Seed the run's bills were generated from
+     int32_t first_record;                    // Record number of the run's first bill in bills.txt
+     int32_t bill_count;                      // Number of bills the run added
+     char run_date[11];                       // Date of the run
+ } BillingRunRecord;
+ 
+ // Enumeration for the result of preparing a bill
+ typedef enum {
+     BILL_READY = 0,           // Bill prepared and ready to stage
+     BILL_TOO_MANY_UNPAID = 1  // Premises already has two or more unpaid bills
+ } BillOutcome;
+ 
+ // Structure for the work of one billing cycle
+ typedef struct {
+     int32_t *premises_rows;                  // Premises rows to bill
+     int count;                               // Number of premises rows
+     const TariffSchedule *tariff;            // Tariff schedule in force for the cycle
+     uint64_t seed;                           // Seed of the cycle's random streams
+     Bill *new_bills;                         // Prepared bill for each premises row
+     Premises *new_premises;                  // Premises with advanced readings for each row
+     BillOutcome *outcomes;                   // Outcome for each premises row
+ } BillingRun;
+ 
+ // Structure for the results of a billing cycle
+ typedef struct {
+     int billed;                              // Premises billed
+     int skipped;                             // Premises skipped for two or more unpaid bills
+     int workers;                             // Worker threads used
+     int32_t first_record;                    // Record number of the first new bill (-1 if none)
+     Money total_billed;                      // Total current charges of the new bills
+ } BillingTotals;
+ 
+ // Structure for the report totals of one customer
+ typedef struct {
+     uint32_t customer_key;                   // Packed customer number
+     int32_t customer_row;                    // Customer row (-1 if the customer is unknown)
+     int paid_bills;                          // Number of paid bills
+     int owing_bills;                         // Number of unpaid bills
+     Money paid_total;                        // Amount paid on the paid bills
+     Money owing_balance;                     // Balance of the unpaid bills
+ } CustomerTotals;
+ 
+ // Structure for a bill listed by a report
+ typedef struct {
+     int32_t record;                          // Record number of the bill in bills.txt
+     int32_t totals;                          // Row of the customer's CustomerTotals
+ } ReportLine;
+ 
+ // Structure for the result of one pass over bills.txt
+ typedef struct {
+     MappedFile bills;                        // bills.txt (mapped until the pass is released)
+     HashIndex by_customer;                   // Packed customer number -> CustomerTotals row
+     RecordTable customers;                   // CustomerTotals of every customer with bills
+     RecordTable paid;                        // ReportLine of every paid bill, in record order
+     RecordTable owing;                       // ReportLine of every unpaid bill, in record order
+     int workers;                             // Worker threads that scanned the bills
+ } ReportPass;
+ 
+ // Structure for the slice of a report pass scanned by one worker
+ typedef struct {
+     const Bill *bills;                       // Mapped bills of the pass
+     long start;                              // First bill record of the slice
+     long end;                                // One past the last bill record
+     ReportPass local;                        // Thread-local totals and report lines of the slice
+ } ReportSlice;
+ 
+ // Structure for the debt of one customer
+ typedef struct {
+     int32_t customer_row;                    // Customer row
+     int32_t unpaid_bills;                    // Number of unpaid bills across the customer's premises
+     Money balance;                           // Balance of the unpaid bills
+ } DebtorEntry;
+ 
+ // Structure for the customers with unpaid bills sorted by balance
+ // Built on first use and rebuilt only after a committed ledger change, so
+ // any page of debtors is found by position.
+ typedef struct {
+     DebtorEntry *entries;                    // Customers owing money, largest balance first
+     int count;                               // Number of entries in use
+     int capacity;                            // Number of entries allocated
+     bool current;                            // False until built and after a ledger change
+ } DebtorIndex;
+ 
+ // Structure for a bill paid by a remittance file
+ typedef struct {
+     int32_t record;                          // Record number of the bill in bills.txt
+     int32_t premises_row;                    // Premises row the bill belongs to
+     Bill original;                           // Bill as it was before the remittance
+     Bill updated;                            // Bill with the remittance's payments applied
+ } RemittanceBill;
+ 
+ // Structure for the premises ledger row of a premises paid by a remittance file
+ typedef struct {
+     int32_t premises_row;                    // Premises row of the ledger row
+     PremisesLedger ledger;                   // Ledger row with the remittance's bills accounted for
+ } RemittanceLedger;
+ 
+ // Structure for the payments of one customer in a remittance file
+ typedef struct {
+     char customer_number[8];                 // Customer number
+     int payments;                            // Payments accepted for the customer
+     Money last_payment;                      // Amount of the customer's last accepted payment
+     SystemLog log;                           // Customer's latest log record before the remittance
+ } RemittanceCustomer;
+ 
+ // Structure for a remittance file applied in memory before it is committed
+ typedef struct {
+     MappedFile bills;                        // bills.txt as it was when the remittance started
+     RecordTable paid_bills;                  // RemittanceBill of every bill paid
+     HashIndex bills_by_record;               // Bill record -> RemittanceBill row
+     RecordTable customers;                   // RemittanceCustomer of every customer that paid
+     HashIndex customers_by_number;           // Packed customer number -> RemittanceCustomer row
+     RecordTable payments;                    // Payment of every accepted row, in file order
+     int rejected;                            // Rows rejected
+     Money total_paid;                        // Total of the accepted payments
+ } Remittance;
+ 
+ // Structure for the shared ID counter
+ // IDs are (seconds << ID_SEQUENCE_BITS) + sequence, so they sort by the
+ // second they were issued in. Threads claim blocks of ID_BLOCK_SIZE IDs
+ // from next with a compare-and-swap; the lock is only taken to raise
+ // reserved, the persisted ceiling below which IDs may have been issued.
+ // Processes sharing a data directory each reserve their own range
+ // [floor, reserved) of id_counter.txt, so their IDs never collide.
+ typedef struct {
+     volatile uint64_t next;                  // First ID not yet claimed by any thread
+     volatile uint64_t floor;                 // First ID of the range this process reserved
+     volatile uint64_t reserved;              // Ceiling recorded in id_counter.txt
+     SharedLock lock;                         // Serializes writes of id_counter.txt
+ } IdService;
+ 
+ // Structure for the block of IDs claimed by one thread
+ typedef struct {
+     uint64_t next;                           // Next ID to hand out
+     uint64_t end;                            // One past the last ID of the block
+ } IdBlock;
+ 
+ // Enumeration for export file formats
+ typedef enum {
+     EXPORT_CSV = 0,    // Comma-separated values with a header row
+     EXPORT_JSON = 1    // JSON array of objects
+ } ExportFormat;
+ 
+ // Enumeration for the data sets that can be exported
+ typedef enum {
+     EXPORT_PAID = 1,      // Paid bills (Paid Customers report)
+     EXPORT_OWING = 2,     // Unpaid bills with their balances (Owing Customers report)
+     EXPORT_ARCHIVED = 3,  // Archived customers with their balances
+     EXPORT_CUSTOMER = 4,  // Billing history of one customer (customer details)
+     EXPORT_BILLS = 5      // Billing history of every customer
+ } ExportDataset;
+ 
+ // Structure for an output file written through a large buffer
+ typedef struct {
+     FILE *file;                              // Output file (stdout for "-")
+     char *data;                              // Buffered bytes (EXPORT_BUFFER_SIZE allocated)
+     size_t size;                             // Bytes buffered
+     bool failed;                             // True once a write has failed
+     bool borrowed;                           // True if the file belongs to the caller (flushed, not closed)
+ } BufferedWriter;
+ 
+ // Structure for command lines read from a file descriptor (standard input or a connection)
+ typedef struct {
+     int fd;                                  // Descriptor read from
+     char *data;                              // Bytes read (COMMAND_BUFFER_SIZE allocated)
+     size_t start;                            // First byte not yet returned as a line
+     size_t end;                              // One past the last byte read
+     bool eof;                                // True once the descriptor has no more input
+     bool discarding;                         // True while skipping a line that did not fit the buffer
+     bool too_long;                           // True if the last line did not fit the buffer
+ } LineReader;
+ 
+ // Structure for a signed-in session (the console, a batch or a server connection)
+ typedef struct {
+     bool signed_in;                          // True once a user has signed in
+     bool quit;                               // True once the client has asked to end the session
+     User user;                               // Signed-in user (type AGENT for batches and --command)
+     Customer customer;                       // Customer record of a signed-in customer
+ } Session;
+ 
+ // Enumeration for who may run a headless command
+ typedef enum {
+     COMMAND_ANYONE = 0,       // No sign-in needed
+     COMMAND_CUSTOMER = 1,     // Agents, or customers acting on their own records
+     COMMAND_AGENT = 2         // Agents only
+ } CommandAccess;
+ 
+ // Structure for a headless command (name, arguments, access and handler)
+ typedef struct {
+     const char *name;                        // Command name (first word of the line)
+     int min_args;                            // Arguments required after the name
+     int max_args;                            // Arguments allowed after the name
+     CommandAccess access;                    // Who may run the command
+     bool writes;                             // True if the command changes the data set (runs alone)
+     bool (*run)(Session *session, int argc, char *argv[], FILE *out); // Handler (writes exactly one response)
+     const char *usage;                       // Arguments shown when the command is misused
+ } CommandSpec;
+ 
+ #ifndef _WIN32
+ // Structure for one client connection of the server
+ typedef struct {
+     int fd;                                  // Connection socket (-1 for a free slot)
+     FILE *out;                               // Buffered response stream on the socket
+     LineReader input;                        // Command lines received and not yet run
+     Session session;                         // Signed-in user of the connection
+     char *running;                           // Line a worker is running (NULL when idle)
+     bool too_long;                           // True if the running line did not fit the buffer
+ } Connection;
+ 
+ // Structure for the server (connections, lines waiting for a worker and the completion pipe)
+ typedef struct {
+     Connection connections[SERVER_MAX_CONNECTIONS];
+     int queue[SERVER_MAX_CONNECTIONS];       // Connection slots with a line waiting for a worker
+     int queue_head;                          // Position of the next queued slot
+     int queue_count;                         // Slots queued
+     pthread_mutex_t lock;                    // Guards the queue and stopping
+     pthread_cond_t ready;                    // Signalled when a slot is queued or the server stops
+     int done[2];                             // Pipe workers write the slots of finished lines to
+     bool stopping;                           // True once the workers should exit
+ } Server;
+ #endif
+ 
+ // Structure for an export in progress (one row of named columns at a time)
+ typedef struct {
+     BufferedWriter writer;                   // Output file
+     ExportFormat format;                     // Format of the output
+     const char *const *columns;              // Column names of the data set
+     int column_count;                        // Number of columns
+     int field;                               // Next column of the current row
+     long rows;                               // Rows written
+ } Exporter;
+ 
+ // Structure for a row of the paid or owing bills view
+ typedef struct {
+     int32_t record;                          // Record number of the bill in bills.txt (-1 marks a free owing row)
+     int32_t month_number;                    // Billing month of the bill
+     char customer_number[8];                 // Customer number of the bill
+     char premises_number[8];                 // Premises number of the bill
+     Money amount;                            // Amount paid (paid view) or balance owing (owing view)
+ } BillViewRow;
+ 
+ // Structure for a row of the archived customers view
+ typedef struct {
+     char customer_number[8];                 // Customer number of the archived customer
+     char archive_date[11];                   // Date the customer was archived (empty if not known)
+     Money balance;                           // Balance of the customer's unpaid bills
+ } ArchivedViewRow;
+ 
+ // Structure for the materialized report views
+ // Each view is kept in step with bills.txt and customers.txt by journaling
+ // its changed rows in the same group as the change they come from, so the
+ // reports never have to rescan bills.
+ typedef struct {
+     RecordTable paid;                        // BillViewRow of every paid bill, in the order bills were settled
+     RecordTable owing;                       // BillViewRow of every unpaid bill (rows are reused once settled)
+     RecordTable archived;                    // ArchivedViewRow of every archived customer
+     HashIndex owing_by_record;               // Bill record -> owing row (entries for reused rows go stale)
+     HashIndex archived_by_customer;          // Packed customer number -> archived row
+     int32_t *free_owing;                     // Free owing rows available for reuse
+     int free_count;                          // Number of free owing rows
+     int free_capacity;                       // Number of free owing rows allocated
+     int staged_archived;                     // Archived rows appended by staged journal records
+ } ReportViews;
+ 
+ // Structure for the slice of a billing cycle handled by one worker
+ typedef struct {
+     BillingRun *run;                         // Billing cycle being prepared
+     int start;                               // First premises position of the slice
+     int end;                                 // One past the last premises position
+ } BillingSlice;
+ 
  // Global variables
- Customer customers[MAX_CUSTOMERS];
- Premises premises[MAX_PREMISES];
- User current_user;
- Customer current_customer;
- int customer_count = 0;
- int premises_count = 0;
+ RecordTable customer_table;
+ RecordTable premises_table;
+ RecordTable user_table;
+ HashIndex users_by_email;
+ HashIndex customers_by_user_id;
+ RecordTable customer_keys;
+ RecordTable premises_keys;
+ RecordTable ledger_table;
+ HashIndex customers_by_number;
+ HashIndex premises_by_number;
+ NumberAllocator customer_numbers;            // Customer numbers in use (active or not)
+ NumberAllocator premises_numbers;            // Premises numbers in use (active or not)
+ int next_user_id = 1;                        // One past the highest user ID in users.txt
+ Session console;                             // Session of the interactive console
+ ReadWriteLock data_lock = READ_WRITE_LOCK_INIT; // Held shared to read and exclusive to change the data set
+ #ifndef _WIN32
+     Server server;
+     volatile sig_atomic_t server_interrupted;  // Set by SIGINT/SIGTERM to stop the server
+ #endif
+ BillIndex bill_index;
+ TariffSchedule *tariff_schedules;
+ int tariff_schedule_count;
+ JournalBuffer journal;
+ #ifdef _WIN32
+     HANDLE lock_file = INVALID_HANDLE_VALUE; // data.lock (its byte ranges are locked, never its contents)
+ #else
+     int lock_file = -1;                      // data.lock (its byte ranges are locked, never its contents)
+ #endif
+ ReportViews report_views;
+ DebtorIndex debtor_index;
+ IdService id_service = { 0, 0, 0, SHARED_LOCK_INIT };
+ THREAD_LOCAL IdBlock id_block;               // IDs claimed by the current thread
+ int billing_run_count;
+ int32_t payment_count;                       // Records in payments.txt, counting committed ones not yet written
+ char simulation_date[11];                    // Date shown by the simulation clock (empty for the real date)
  
  // Function prototypes
  void initializeSystem();                                     // Initialize the system by loading data
  void mainMenu();                                             // Display the main menu
  void registerAccount();                                      // Register a new customer account
  bool signIn();                                               // Authenticate user and determine type
+ bool authenticate(Session *session, const char *email, const char *password); // Sign a user into a session
  void agentInterface();                                       // Display agent interface
  void customerInterface();                                    // Display customer interface
  void addCustomer();                                          // Add a new customer (Agent)
  void editCustomer();                                         // Edit existing customer data (Agent)
  void viewCustomer();                                         // View customer details (Agent)
+ bool saveNewCustomer(const Customer *customer, const Premises *premises); // Save a customer with its first premises
  void deleteCustomer();                                       // Archive customer (Agent)
  void generateBill();                                         // Generate bill for a customer (Agent)
+ bool saveNewBill(int premises_row, uint64_t seed, const Bill *bill, const Premises *updated_premises); // Save a generated bill
+ void runBillingCycle();                                      // Run a billing cycle (Agent)
+ bool billActivePremises(uint64_t seed, BillingTotals *totals); // Bill every active premises
+ BillOutcome prepareBill(int customer_row, int premises_row, const TariffSchedule *tariff, uint64_t seed, Bill *new_bill, Premises *updated_premises); // Build a bill for a premises
+ void priceBills(Bill *bills, int count, const TariffSchedule *tariff);                     // Rate and total prepared bills
+ void stampBill(Bill *bill);                                  // Assign a bill its ID and dates
+ WORKER_RESULT billingWorker(void *arg);                      // Prepare one slice of a billing cycle
  void viewReports();                                          // View different reports (Agent)
+ void showBillReport(bool paid);                              // List the paid or owing bills from the report views
+ void showArchivedReport();                                   // List the archived customers from the report views
+ int compareBillViewRows(const void *a, const void *b);       // Order bill view rows by record
+ void showTopDebtors();                                       // List the customers owing the most
+ void showDebtorPages();                                      // Page through the customers by balance owed
+ void showDebtors(const DebtorEntry *entries, int count, int first_rank); // List ranked debtors
+ void customerDebt(int customer_row, DebtorEntry *entry);     // Total the unpaid bills of a customer
+ int compareDebtors(const void *a, const void *b);            // Order debtors by balance, largest first
+ int topDebtors(int limit, DebtorEntry *top);                 // Find the customers owing the most
+ void siftDebtorHeap(DebtorEntry *heap, int count, int position); // Restore a debtor min-heap below a position
+ void buildDebtorIndex();                                     // Sort every customer owing money by balance
+ void auditBills();                                           // Check the ledger and report views against bills.txt
+ bool runReportPass(ReportPass *pass);                        // Aggregate bills.txt in one pass
+ WORKER_RESULT reportWorker(void *arg);                       // Scan one slice of a report pass
+ void tallyReportBills(ReportPass *pass, const Bill *bills, long start, long end); // Add a range of bills to a report pass
+ void mergeReportSlice(ReportPass *pass, ReportPass *local);  // Merge a slice's totals and lines into a report pass
+ int32_t reportCustomerTotals(ReportPass *pass, const char *customer_number); // Find or add a customer's report totals
+ void releaseReportPass(ReportPass *pass);                    // Release a report pass
+ void exportReports();                                        // Export a report or billing history (Agent)
+ int exportCommand(int argc, char *argv[]);                   // Run the headless export command
+ bool parseExportDataset(const char *name, ExportDataset *dataset); // Look up a data set by name
+ bool exportDataset(ExportDataset dataset, ExportFormat format, const char *filename, const char *customer_number, long *rows); // Write a data set to a file
+ bool exportRows(Exporter *exporter, ExportDataset dataset, const char *customer_number); // Write the rows of a data set
+ void exportBillReport(Exporter *exporter, bool paid);       // Export the paid or owing bills
+ void exportArchivedReport(Exporter *exporter);               // Export the archived customers
+ bool exportBillingHistory(Exporter *exporter, const char *customer_number); // Export the bills of one or every customer
+ void exportBillRow(Exporter *exporter, const Bill *bill);    // Export one bill of a billing history
+ bool exportOpen(Exporter *exporter, const char *filename, ExportFormat format); // Start an export
+ void exportColumns(Exporter *exporter, const char *const *columns, int count); // Set the columns and write the header
+ void exportBeginRow(Exporter *exporter);                     // Start a row
+ void exportKey(Exporter *exporter);                          // Write the separator and name of the next field
+ void exportText(Exporter *exporter, const char *text);       // Write a text field
+ void exportInt(Exporter *exporter, int64_t value);           // Write an integer field
+ void exportMoney(Exporter *exporter, Money amount);          // Write a money field
+ void exportEndRow(Exporter *exporter);                       // Finish a row
+ bool exportClose(Exporter *exporter);                        // Finish an export
  void registerPaymentCard();                                  // Register payment card (Customer)
  void viewBill();                                             // View latest bill (Customer)
  void payBill();                                              // Pay bill (Customer)
+ int32_t findLatestUnpaidBill(const char *customer_number, Bill *bill); // Find the newest unpaid bill of a customer
+ const char *savePayment(const char *customer_number, int32_t record, const Bill *unpaid_bill, Money amount, Payment *payment, Bill *paid_bill); // Save a payment against a bill
  void surrenderMeter();                                       // Surrender meter (Customer)
+ bool saveSurrender(const char *customer_number, int premises_row); // Deactivate a surrendered premises
+ int remitCommand(int argc, char *argv[]);                    // Run the headless remittance command
+ bool loadRemittance(const char *filename, Remittance *remit); // Apply a remittance file in memory
+ const char *remitPayment(Remittance *remit, const char *customer_number, const char *premises_number, const char *amount_text); // Apply one remittance row
+ bool commitRemittance(Remittance *remit);                    // Save the payments, bills and logs of a remittance
+ void releaseRemittance(Remittance *remit);                   // Release a remittance
+ int headlessCommand(int argc, char *argv[]);                 // Run one command or a batch of commands from stdin
+ bool runCommandLine(Session *session, char *line, bool too_long, FILE *out); // Split and run one command line
+ bool runCommand(Session *session, int argc, char *argv[], FILE *out); // Run one command and write its response
+ int splitCommandLine(char *line, char *argv[], int max_args); // Split a command line into words
+ void readerInit(LineReader *reader, int fd);                 // Start reading command lines from a descriptor
+ char *readerLine(LineReader *reader, FILE *out);             // Read the next command line, waiting for input
+ char *readerNext(LineReader *reader);                        // Take the next complete buffered line
+ bool readerFill(LineReader *reader);                         // Read whatever input is available
+ void readerFree(LineReader *reader);                         // Release a line reader
+ bool parseCount(const char *text, int min, int max, int *value); // Parse a whole number within a range
+ bool commandSaveFailed(FILE *out, const char *message);      // Answer a command whose changes were not saved
+ bool ownsCustomer(const Session *session, const char *customer_number); // Check a session may act for a customer
+ bool commandLogin(Session *session, int argc, char *argv[], FILE *out); // login command
+ bool commandLogout(Session *session, int argc, char *argv[], FILE *out); // logout command
+ bool commandQuit(Session *session, int argc, char *argv[], FILE *out); // quit command
+ bool commandAddCustomer(Session *session, int argc, char *argv[], FILE *out); // add-customer command
+ bool commandEditCustomer(Session *session, int argc, char *argv[], FILE *out); // edit-customer command
+ bool commandGenerateBill(Session *session, int argc, char *argv[], FILE *out); // generate-bill command
+ bool commandPay(Session *session, int argc, char *argv[], FILE *out); // pay command
+ bool commandSurrender(Session *session, int argc, char *argv[], FILE *out); // surrender command
+ bool commandReport(Session *session, int argc, char *argv[], FILE *out); // report command
+ int serverCommand(int argc, char *argv[]);                   // Run the multi-session server
+ #ifndef _WIN32
+     int openServerSocket(const char *path);                  // Listen on a Unix domain socket
+     void runServer(int listener);                            // Run the server event loop until stopped
+     void acceptConnection(int listener);                     // Accept a client into a free connection slot
+     void dispatchConnection(int slot);                       // Queue the next line of an idle connection
+     void closeConnection(int slot);                          // Close a connection and free its slot
+     WORKER_RESULT serverWorker(void *arg);                   // Run queued command lines
+     void interruptServer(int signal_number);                 // Stop the server on SIGINT/SIGTERM
+ #endif
+ int simulationCommand(int argc, char *argv[]);               // Run the headless simulation command
+ int runSimulation(int customers, int months, uint64_t seed); // Simulate customers over months of billing
+ int simulateRegistrations(RandomStream *stream, int count);  // Register simulated customers
+ int simulatePayments(RandomStream *stream);                  // Simulate a month of payments
+ int simulateSurrenders(RandomStream *stream);                // Simulate a month of meter surrenders
+ void setSimulationDate(int year, int month, int day);        // Set the simulation clock
+ double monotonicSeconds();                                   // Seconds on a monotonic clock
  void loadData();                                             // Load data from files
+ void createAgentAccounts();                                  // Create the designated agent accounts if missing
  void saveData();                                             // Save data to files
  void generateID(char *id, const char *prefix);               // Generate unique ID with prefix
+ uint64_t nextId();                                           // Issue the next time-ordered unique ID
+ void loadIdCounter();                                        // Load the persisted ID ceiling
+ bool reserveIds(uint64_t start, uint64_t end, bool *owned); // Reserve a claimed block of IDs in id_counter.txt
  void getCurrentDate(char *date);                             // Get current date in YYYY-MM-DD format
- int generateRandomNumber(int min, int max);                  // Generate random number in range
- float calculateWaterCharge(int consumption);                 // Calculate water charge based on consumption
- float calculateSewerageCharge(int consumption);              // Calculate sewerage charge based on consumption
- float calculateServiceCharge(MeterSize meter_size);          // Calculate service charge based on meter size
+ void addDays(const char *date, int days, char *result);      // Add days to a YYYY-MM-DD date
+ uint64_t splitMix64(uint64_t *state);                        // Advance a SplitMix64 generator
+ void randomSeed(RandomStream *stream, uint64_t seed, uint64_t stream_id); // Seed an independent random stream
+ uint64_t randomNext(RandomStream *stream);                   // Next 64 random bits of a stream
+ uint32_t randomBelow(RandomStream *stream, uint32_t bound);  // Unbiased random number below a bound
+ void generateDailyUsage(RandomStream *stream, int daily_limit, int *usage, int days); // Generate daily meter usage
+ uint64_t newRunSeed();                                       // Pick the seed of a billing run
+ void stageBillingRun(uint64_t seed, int32_t first_record, int bill_count); // Stage a billing runs log record
+ Money calculateWaterCharge(int consumption);                 // Calculate water charge based on consumption
+ Money calculateSewerageCharge(int consumption);              // Calculate sewerage charge based on consumption
+ Money calculateServiceCharge(MeterSize meter_size);          // Calculate service charge based on meter size
+ Money moneyFromDouble(double amount);                        // Round a stored amount to whole cents
+ double moneyToDouble(Money amount);                          // Convert cents to a stored amount
+ Money applyRate(Money amount, int64_t rate);                 // Apply a RATE_SCALE rate to an amount
+ Money billBalance(const Bill *bill);                         // Amount still owed on a bill
+ bool parseFixed(const char *text, int decimals, int64_t *value, const char **end); // Parse a fixed-point decimal
+ bool parseMoney(const char *text, Money *amount);            // Parse a dollar amount into cents
+ void buildTariffTiers(TariffTiers *tariff, const int *lower, const Money *rate); // Build a tiered tariff rating table
+ void buildDefaultTariff(TariffSchedule *schedule);           // Build the built-in tariff schedule
+ int compareTariffSchedules(const void *a, const void *b);    // Order tariff schedules by effective date
+ int parseTariffValues(const char *text, int64_t *values, int max, int decimals); // Read the numbers of a schedule line
+ void loadTariffSchedules();                                  // Load and compile tariffs.txt
+ const TariffSchedule *tariffInForce(const char *date);       // Find the tariff schedule in force on a date
+ const TariffSchedule *currentTariff();                       // Get the tariff schedule in force today
+ Money tariffServiceCharge(const TariffSchedule *tariff, MeterSize meter_size); // Service charge of a meter size
+ void rateConsumption(const TariffTiers *tariff, const int *consumption, Money *charges, int count); // Rate consumptions (tariff kernel)
  bool isCustomerNumberExists(const char *customer_number);    // Check if customer number exists
  bool isPremisesNumberExists(const char *premises_number);    // Check if premises number exists
  bool isEmailExists(const char *email);                       // Check if email exists
  void maskPassword(char *password);                           // Mask password input with asterisks
  int getDailyUsageLimit(IncomeClass income_class);            // Get daily usage limit based on income class
- void logActivity(const char *customer_number, double payment_amount, bool surrender_meter); // Log system activity
+ void logActivity(const char *customer_number, Money payment_amount, bool surrender_meter); // Log system activity
  void displayCustomerDetails(const char *customer_number);    // Display detailed customer information
  void clearScreen();                                          // Clear console screen
  void pauseScreen();                                          // Pause and wait for user input
+ bool mapRecordFile(const char *filename, size_t record_size, MappedFile *mapped); // Map a record file into memory
+ void unmapRecordFile(MappedFile *mapped);                    // Release a mapped record file
+ void tableInit(RecordTable *table, size_t row_size);         // Initialize an empty record table
+ void tableLoad(RecordTable *table, size_t row_size, const char *filename); // Load a table from a record file
+ void *tableRow(const RecordTable *table, int row);           // Get a pointer to a table row
+ void *tableAppend(RecordTable *table);                       // Add a zeroed row to a table
+ bool tableStore(RecordTable *table, int row, const void *data); // Overwrite or append a table row
+ Customer *customerAt(int index);                             // Get a customer row
+ Premises *premisesAt(int index);                             // Get a premises row
+ User *userAt(int index);                                     // Get a user row
+ void buildLookupIndexes();                                   // Build the email, user ID and number indexes
+ void indexCustomerRow(int row);                              // Add a customer row to the lookup indexes
+ void indexPremisesRow(int row);                              // Add a premises row to the lookup indexes
+ uint32_t packNumber(const char *number);                     // Pack a 7-digit number into an integer key
+ void numbersInit(NumberAllocator *numbers);                  // Clear a number allocator
+ bool numberInUse(const NumberAllocator *numbers, uint32_t key); // Check if a packed number is in use
+ void markNumber(NumberAllocator *numbers, uint32_t key);     // Mark a packed number as in use
+ bool allocateNumber(NumberAllocator *numbers, char *number); // Take the lowest free 7-digit number
+ void releaseNumber(NumberAllocator *numbers, const char *number); // Give back a number that was never committed
+ int allocateUserId();                                        // Take the next sequential user ID
+ int findCustomerRow(const char *customer_number, bool active_only); // Look up a customer row by number
+ int findPremisesRow(const char *premises_number, bool active_only); // Look up a premises row by number
+ int findCustomerPremisesRow(int customer_row, const char *premises_number, bool active_only); // Look up a premises of a customer
+ int firstCustomerPremises(int customer_row);                 // Get the first premises row of a customer
+ int nextCustomerPremises(int premises_row);                  // Get the next premises row of the same customer
+ int premisesCustomerRow(int premises_row);                   // Get the customer row a premises belongs to
+ PremisesLedger *ledgerAt(int premises_row);                  // Get the ledger row of a premises
+ void loadLedger();                                           // Load the premises ledger, rebuilding if stale
+ void rebuildLedger();                                        // Rebuild the premises ledger from bills.txt
+ void ledgerRecordBill(PremisesLedger *ledger, const Bill *before, const Bill *after); // Account for a new or updated bill
+ void loadReportViews();                                      // Load the report views
+ void checkReportViews();                                     // Rebuild the report views if out of step
+ void rebuildReportViews();                                   // Rebuild the report views from bills.txt
+ void indexReportViews();                                     // Build the lookups of the report views
+ void fillBillViewRow(BillViewRow *row, int32_t record, const Bill *bill); // Build the view row of a bill
+ int32_t findOwingViewRow(int32_t record);                    // Look up the owing row of a bill
+ void releaseOwingViewRow(int32_t row);                       // Make an owing row available for reuse
+ void claimOwingViewRow(int32_t row);                         // Take an owing row in use again off the free list
+ void placeStagedRows();                                      // Give staged view rows and payments their row numbers
+ void stageReportViews(int32_t record, const Bill *before, const Bill *after); // Stage view rows for a new or updated bill
+ void stageArchivedView(int customer_row);                    // Stage the archived view row of a customer
+ bool writeTableFile(const char *filename, const RecordTable *table); // Write a table out as a record file
+ bool writeTableRows(FILE *file, const RecordTable *table);   // Write every row of a table to an open file
+ bool writerOpen(BufferedWriter *writer, const char *filename); // Open a buffered output file
+ bool writerAttach(BufferedWriter *writer, FILE *file);       // Buffer writes to an open stream
+ void writerFlush(BufferedWriter *writer);                    // Write out the buffered bytes
+ bool writerClose(BufferedWriter *writer);                    // Flush and close a buffered output file
+ void writerBytes(BufferedWriter *writer, const char *bytes, size_t length); // Buffer bytes
+ void writerChar(BufferedWriter *writer, char c);             // Buffer one character
+ void writerInt(BufferedWriter *writer, int64_t value);       // Buffer a decimal integer
+ void writerMoney(BufferedWriter *writer, Money amount);      // Buffer a cents amount as dollars
+ void writerQuoted(BufferedWriter *writer, const char *text, ExportFormat format); // Buffer a CSV or JSON string
+ void stageUsers(const User *users, int count);               // Stage new users for the next commit
+ User *findUserByEmail(const char *email);                    // Look up a user by email
+ Customer *findCustomerByUserId(int user_id);                 // Look up the active customer of a user account
+ uint64_t hashString(const char *text);                       // Hash a string (FNV-1a)
+ void hashIndexInit(HashIndex *index, int expected_count);    // Initialize a hash index
+ void hashIndexFree(HashIndex *index);                        // Release a hash index
+ void hashIndexInsert(HashIndex *index, uint64_t key, int32_t value); // Add a key/value pair
+ int32_t hashIndexFind(const HashIndex *index, uint64_t key, int *cursor); // Find next value for key
+ uint64_t mixHashKey(uint64_t key);                           // Scramble a key for slot selection
+ long fileSize(const char *filename);                         // Size of a file in bytes
+ long countRecords(const char *filename, size_t record_size); // Count fixed-size records in a file
+ void resetBillIndex();                                       // Start an empty in-memory bill index
+ void loadBillIndex();                                        // Load the bill index, rebuilding if stale
+ void rebuildBillIndex();                                     // Rebuild the bill index from bills.txt
+ void indexBillRecord(const char *customer_number, const char *premises_number, int32_t record); // Add a record to the in-memory index
+ BillIndexBucket *findBillBucket(const char *customer_number, const char *premises_number); // Find bills of a customer/premises pair
+ int compareRecords(const void *a, const void *b);            // Order record numbers ascending
+ int collectCustomerBillRecords(const char *customer_number, int32_t **records); // Collect bill records of a customer
+ bool readBillRecord(FILE *file, int32_t record, Bill *bill); // Read a bill by record number
+ int32_t stageBillAppend(const Bill *bill);                   // Stage a new bill for the next commit
+ void indexAppendedBills(const unsigned char *data, size_t size, bool write_index); // Index bills written by a commit
+ bool syncFile(FILE *file);                                   // Flush a file through to disk
+ int workerCount();                                           // Number of worker threads to use
+ bool startWorker(WorkerThread *thread, WorkerFunction function, void *arg); // Start a worker thread
+ void joinWorker(WorkerThread thread);                        // Wait for a worker thread to finish
+ uint32_t journalChecksum(const void *data, size_t size);     // Checksum a journal record image
+ const char *journalTargetFile(JournalTarget target, size_t *record_size); // Data file for a journal target
+ void journalStage(JournalTarget target, int32_t record, const void *image, size_t size); // Stage a record image
+ bool journalCommit();                                        // Group-commit staged records
+ void applyJournalToMemory(const unsigned char *data, size_t size); // Apply records to in-memory tables
+ bool applyJournal(const unsigned char *data, size_t size, JournalTarget only_target); // Write record images into data files
+ int checkpointJournal();                                     // Write committed records into base files
+ size_t journalValidLength(const unsigned char *data, size_t size, int *records); // End of the complete groups in journal data
+ bool catchUpJournal();                                       // Apply groups other processes committed
+ bool journalOverlaps(const unsigned char *data, size_t size); // Check committed records against the staged ones
+ int32_t journalTargetCount(JournalTarget target);            // Number of records of a journal target in memory
+ bool journalBehind();                                        // Check whether other processes have committed
+ void journalRefresh();                                       // Pick up changes other processes committed
+ bool openLockFile();                                         // Open data.lock and join the directory's processes
+ void lockDataFile(DataFileLock range);                       // Lock a byte of data.lock
+ void unlockDataFile(DataFileLock range);                     // Unlock a byte of data.lock
+ bool holdDataDirectory(bool alone);                          // Hold data.lock's presence byte shared or exclusive
+ FILE *openAppend(const char *filename);                      // Open a record file for whole-record appends
  
  /**
   * Main function - Entry point for the program
-  *
+  * 
   * Initializes the random number generator, loads data, displays the main menu
-  * and saves data before exiting.
-  *
+  * and saves data before exiting. "--simulate" runs a headless simulation,
+  * "--export" writes a data set to a file, "--remit" applies a remittance
+  * file, "--command" or "--batch" runs commands with one-line responses and
+  * "--serve" answers the same commands for many clients on a Unix domain
+  * socket instead (see simulationCommand, exportCommand, remitCommand,
+  * headlessCommand and serverCommand).
+  * 
+  * @param argc - Argument count
+  * @param argv - Arguments
   * @return int - Exit code (0 for normal termination)
   */
- int main() {
+ int main(int argc, char *argv[]) {
      srand(time(NULL)); // Seed random number generator
+     
+     if (argc > 1 && strcmp(argv[1], "--simulate") == 0) {
+         return simulationCommand(argc, argv);
+     }
+     if (argc > 1 && strcmp(argv[1], "--export") == 0) {
+         return exportCommand(argc, argv);
+     }
+     if (argc > 1 && strcmp(argv[1], "--remit") == 0) {
+         return remitCommand(argc, argv);
+     }
+     if (argc > 1 && (strcmp(argv[1], "--command") == 0 || strcmp(argv[1], "--batch") == 0)) {
+         return headlessCommand(argc, argv);
+     }
+     if (argc > 1 && strcmp(argv[1], "--serve") == 0) {
+         return serverCommand(argc, argv);
+     }
+     
      initializeSystem();
+     printf("\nWelcome to the National Water Commission (NWC) Utility Platform\n");
      mainMenu();
      saveData();
      return 0;
@@ -204,11 +1024,33 @@
  /**
   * Initialize the system by loading data
   * 
-  * Loads all necessary data from files and displays a welcome message
+  * Replays any committed journal records left by an interrupted session,
+  * loads all necessary data from files and opens the bill index, premises
+  * ledger and report views. Other processes may be using the same data
+  * directory: their committed changes are then replayed from the journal,
+  * and only after that are the report views checked against bills.txt.
   */
  void initializeSystem() {
+     openLockFile();
+     loadTariffSchedules();
+     loadIdCounter();
+     int recovered = checkpointJournal();
+     if (recovered > 0) {
+         printf("Recovered %d journaled record update(s) from an interrupted session.\n", recovered);
+     }
      loadData();
-     printf("\nWelcome to the National Water Commission (NWC) Utility Platform\n");
+     loadBillIndex();
+     loadLedger();
+     loadReportViews();
+     
+     // The tables now follow journal.txt from its start; the views can be checked once it is replayed
+     journal.loaded = true;
+     journal.applied = 0;
+     lockDataFile(LOCK_JOURNAL);
+     catchUpJournal();
+     checkReportViews();
+     unlockDataFile(LOCK_JOURNAL);
+     createAgentAccounts();
  }
  
  // Main menu
@@ -225,6 +1067,7 @@
          printf("Please enter your choice: ");
          scanf("%d", &choice);
          getchar(); // Consume newline
+         journalRefresh(); // Pick up changes other processes made while the menu waited
          
          switch (choice) {
              case 1:
@@ -232,7 +1075,7 @@
                  break;
              case 2:
                  if (signIn()) {
-                     if (current_user.type == AGENT) {
+                     if (console.user.type == AGENT) {
                          agentInterface();
                      } else {
                          customerInterface();
@@ -285,42 +1128,39 @@
      last_name[strcspn(last_name, "\n")] = '\0';
      
      // Create new user
-     new_user.id = rand() % 10000 + 1000;
+     memset(&new_user, 0, sizeof(User));
+     memset(&new_customer, 0, sizeof(Customer));
+     if (!allocateNumber(&customer_numbers, new_customer.customer_number)) {
+         printf("Error: No unused customer numbers left.\n");
+         pauseScreen();
+         return;
+     }
+     new_user.id = allocateUserId();
      strcpy(new_user.email, email);
      strcpy(new_user.password, password);
      new_user.type = CUSTOMER;
      new_user.is_active = true;
      
-     // Save user to file
-     FILE *file = fopen(FILE_USERS, "ab");
-     if (file != NULL) {
-         fwrite(&new_user, sizeof(User), 1, file);
-         fclose(file);
-         
-         // Create new customer with random 7-digit customer number
-         sprintf(new_customer.customer_number, "%07d", 1000000 + rand() % 9000000);
-         strcpy(new_customer.first_name, first_name);
-         strcpy(new_customer.last_name, last_name);
-         new_customer.user_id = new_user.id;
-         new_customer.income_class = (IncomeClass)(rand() % 5 + 1); // Random income class
-         new_customer.is_active = true;
-         new_customer.has_payment_card = false;
-         
-         // Save customer to array and file
-         customers[customer_count] = new_customer;
-         customer_count++;
-         
-         file = fopen(FILE_CUSTOMERS, "ab");
-         if (file != NULL) {
-             fwrite(&new_customer, sizeof(Customer), 1, file);
-             fclose(file);
-             printf("\nAccount successfully registered!\n");
-             printf("Your customer number is: %s\n", new_customer.customer_number);
-         } else {
-             printf("Error: Could not save customer data.\n");
-         }
+     // Create new customer with the allocated customer number
+     strcpy(new_customer.first_name, first_name);
+     strcpy(new_customer.last_name, last_name);
+     new_customer.user_id = new_user.id;
+     new_customer.income_class = (IncomeClass)(rand() % 5 + 1); // Random income class
+     new_customer.is_active = true;
+     new_customer.has_payment_card = false;
+     
+     // Save user and customer together (through the journal)
+     stageUsers(&new_user, 1);
+     journalStage(JOURNAL_CUSTOMERS, customer_table.count, &new_customer, sizeof(Customer));
+     
+     if (journalCommit()) {
+         printf("\nAccount successfully registered!\n");
+         printf("Your customer number is: %s\n", new_customer.customer_number);
      } else {
-         printf("Error: Could not save user data.\n");
+         if (findCustomerRow(new_customer.customer_number, false) < 0) {
+             releaseNumber(&customer_numbers, new_customer.customer_number);
+         }
+         printf("Error: Could not save account data.\n");
      }
      
      pauseScreen();
@@ -331,7 +1171,6 @@
      clearScreen();
      char email_input[MAX_EMAIL_LENGTH];
      char password_input[MAX_PASSWORD_LENGTH];
-     bool authenticated = false;
      
      printf("\n=== Sign In ===\n");
      printf("Enter email: ");
@@ -341,42 +1180,12 @@
      printf("Enter password: ");
      maskPassword(password_input);
      
-     // Check credentials
-     FILE *file = fopen(FILE_USERS, "rb");
-     if (file != NULL) {
-         User user;
-         while (fread(&user, sizeof(User), 1, file) == 1) {
-             if (strcmp(user.email, email_input) == 0 && strcmp(user.password, password_input) == 0 && user.is_active) {
-                 authenticated = true;
-                 current_user = user;
-                 
-                 // If user is a customer, find the customer record
-                 if (user.type == CUSTOMER) {
-                     FILE *customer_file = fopen(FILE_CUSTOMERS, "rb");
-                     if (customer_file != NULL) {
-                         Customer customer;
-                         while (fread(&customer, sizeof(Customer), 1, customer_file) == 1) {
-                             if (customer.user_id == user.id && customer.is_active) {
-                                 current_customer = customer;
-                                 break;
-                             }
-                         }
-                         fclose(customer_file);
-                     }
-                 }
-                 
-                 break;
-             }
-         }
-         fclose(file);
-     }
-     
-     if (authenticated) {
+     if (authenticate(&console, email_input, password_input)) {
          printf("\nSign in successful!\n");
-         if (current_user.type == AGENT) {
+         if (console.user.type == AGENT) {
              printf("Welcome, Agent!\n");
          } else {
-             printf("Welcome, %s %s!\n", current_customer.first_name, current_customer.last_name);
+             printf("Welcome, %s %s!\n", console.customer.first_name, console.customer.last_name);
          }
          pauseScreen();
          return true;
@@ -387,6 +1196,27 @@
      }
  }
  
+ // Check credentials and sign the user (and, for a customer, their customer record) into a session
+ bool authenticate(Session *session, const char *email, const char *password) {
+     User *user = findUserByEmail(email);
+     if (user == NULL || strcmp(user->password, password) != 0 || !user->is_active) {
+         return false;
+     }
+     
+     memset(session, 0, sizeof(Session));
+     session->signed_in = true;
+     session->user = *user;
+     
+     // If user is a customer, find the customer record
+     if (user->type == CUSTOMER) {
+         Customer *customer = findCustomerByUserId(user->id);
+         if (customer != NULL) {
+             session->customer = *customer;
+         }
+     }
+     return true;
+ }
+ 
  // Agent interface
  void agentInterface() {
      int choice;
@@ -400,11 +1230,13 @@
          printf("3. View Customer\n");
          printf("4. Delete/Archive Customer\n");
          printf("5. Generate Bill\n");
-         printf("6. View Reports\n");
-         printf("7. Logout\n");
+         printf("6. Run Billing Cycle\n");
+         printf("7. View Reports\n");
+         printf("8. Logout\n");
          printf("Please enter your choice: ");
          scanf("%d", &choice);
          getchar(); // Consume newline
+         journalRefresh(); // Pick up changes other processes made while the menu waited
          
          switch (choice) {
              case 1:
@@ -423,9 +1255,12 @@
                  generateBill();
                  break;
              case 6:
-                 viewReports();
+                 runBillingCycle();
                  break;
              case 7:
+                 viewReports();
+                 break;
+             case 8:
                  running = false;
                  printf("Logged out successfully.\n");
                  pauseScreen();
@@ -453,6 +1288,7 @@
          printf("Please enter your choice: ");
          scanf("%d", &choice);
          getchar(); // Consume newline
+         journalRefresh(); // Pick up changes other processes made while the menu waited
          
          switch (choice) {
              case 1:
@@ -495,63 +1331,72 @@
      printf("\n=== Add Customer ===\n");
      
      // Customer Number
-     printf("Enter Customer Number (7 digits): ");
+     printf("Enter Customer Number (7 digits, blank for the next free number): ");
      char customer_input[100];
      fgets(customer_input, sizeof(customer_input), stdin);
      customer_input[strcspn(customer_input, "\n")] = '\0';
      
-     // Validate customer number
-     if (strlen(customer_input) != 7) {
-         printf("Error: Customer number must be 7 digits.\n");
-         pauseScreen();
-         return;
-     }
-     
-     // Copy validated input to customer_number
-     strcpy(customer_number, customer_input);
-     
-     for (int i = 0; i < 7; i++) {
-         if (!isdigit(customer_number[i])) {
-             printf("Error: Customer number must contain only digits.\n");
+     // A blank number is allocated once everything else has been validated
+     bool customer_allocated = customer_input[0] == '\0';
+     customer_number[0] = '\0';
+     if (!customer_allocated) {
+         // Validate customer number
+         if (strlen(customer_input) != 7) {
+             printf("Error: Customer number must be 7 digits.\n");
+             pauseScreen();
+             return;
+         }
+         
+         // Copy validated input to customer_number
+         strcpy(customer_number, customer_input);
+         
+         for (int i = 0; i < 7; i++) {
+             if (!isdigit(customer_number[i])) {
+                 printf("Error: Customer number must contain only digits.\n");
+                 pauseScreen();
+                 return;
+             }
+         }
+         
+         if (isCustomerNumberExists(customer_number)) {
+             printf("Error: Customer number already exists.\n");
              pauseScreen();
              return;
          }
-     }
-     
-     if (isCustomerNumberExists(customer_number)) {
-         printf("Error: Customer number already exists.\n");
-         pauseScreen();
-         return;
      }
      
      // Premises Number
-     printf("Enter Premises Number (7 digits): ");
+     printf("Enter Premises Number (7 digits, blank for the next free number): ");
      char premises_input[100];
      fgets(premises_input, sizeof(premises_input), stdin);
      premises_input[strcspn(premises_input, "\n")] = '\0';
      
-     if (strlen(premises_input) != 7) {
-         printf("Error: Premises number must be 7 digits.\n");
-         pauseScreen();
-         return;
-     }
-     
-     // Copy validated input to premises_number
-     strcpy(premises_number, premises_input);
-     
-     // Validate premises number
-     for (int i = 0; i < 7; i++) {
-         if (!isdigit(premises_number[i])) {
-             printf("Error: Premises number must contain only digits.\n");
+     bool premises_allocated = premises_input[0] == '\0';
+     premises_number[0] = '\0';
+     if (!premises_allocated) {
+         if (strlen(premises_input) != 7) {
+             printf("Error: Premises number must be 7 digits.\n");
+             pauseScreen();
+             return;
+         }
+         
+         // Copy validated input to premises_number
+         strcpy(premises_number, premises_input);
+         
+         // Validate premises number
+         for (int i = 0; i < 7; i++) {
+             if (!isdigit(premises_number[i])) {
+                 printf("Error: Premises number must contain only digits.\n");
+                 pauseScreen();
+                 return;
+             }
+         }
+         
+         if (isPremisesNumberExists(premises_number)) {
+             printf("Error: Premises number already exists.\n");
              pauseScreen();
              return;
          }
-     }
-     
-     if (isPremisesNumberExists(premises_number)) {
-         printf("Error: Premises number already exists.\n");
-         pauseScreen();
-         return;
      }
      
      // Service Name
@@ -600,6 +1445,21 @@
          return;
      }
      
+     // Allocate the numbers left blank
+     if (customer_allocated && !allocateNumber(&customer_numbers, customer_number)) {
+         printf("Error: No unused customer numbers left.\n");
+         pauseScreen();
+         return;
+     }
+     if (premises_allocated && !allocateNumber(&premises_numbers, premises_number)) {
+         if (customer_allocated) {
+             releaseNumber(&customer_numbers, customer_number);
+         }
+         printf("Error: No unused premises numbers left.\n");
+         pauseScreen();
+         return;
+     }
+     
      // Create new customer
      strcpy(new_customer.customer_number, customer_number);
      strcpy(new_customer.first_name, first_name);
@@ -618,36 +1478,49 @@
      new_premises.current_reading = first_reading;
      new_premises.is_active = true;
      
-     // Save customer to array and file
-     customers[customer_count] = new_customer;
-     customer_count++;
-     
-     FILE *file = fopen(FILE_CUSTOMERS, "ab");
-     if (file != NULL) {
-         fwrite(&new_customer, sizeof(Customer), 1, file);
-         fclose(file);
-     } else {
-         printf("Error: Could not save customer data.\n");
-         pauseScreen();
-         return;
-     }
-     
-     // Save premises to array and file
-     premises[premises_count] = new_premises;
-     premises_count++;
-     
-     file = fopen(FILE_PREMISES, "ab");
-     if (file != NULL) {
-         fwrite(&new_premises, sizeof(Premises), 1, file);
-         fclose(file);
+     if (saveNewCustomer(&new_customer, &new_premises)) {
          printf("\nCustomer and premises added successfully!\n");
+         printf("Customer Number: %s\n", customer_number);
+         printf("Premises Number: %s\n", premises_number);
      } else {
-         printf("Error: Could not save premises data.\n");
+         printf("Error: Could not save customer and premises data.\n");
      }
      
      pauseScreen();
  }
  
+ /**
+  * Save a new customer, its premises and an empty premises ledger as one journal group
+  * 
+  * If the group is not committed, the customer and premises numbers are
+  * given back to the allocators, since nothing else has seen them (unless
+  * another process has committed a record with the same number since).
+  * 
+  * @param customer - New customer
+  * @param premises - New premises of the customer
+  * @return bool - True if the records were committed
+  */
+ bool saveNewCustomer(const Customer *customer, const Premises *premises) {
+     PremisesLedger new_ledger;
+     memset(&new_ledger, 0, sizeof(PremisesLedger));
+     strcpy(new_ledger.premises_number, premises->premises_number);
+     
+     journalStage(JOURNAL_CUSTOMERS, customer_table.count, customer, sizeof(Customer));
+     journalStage(JOURNAL_PREMISES, premises_table.count, premises, sizeof(Premises));
+     journalStage(JOURNAL_LEDGER, premises_table.count, &new_ledger, sizeof(PremisesLedger));
+     
+     if (journalCommit()) {
+         return true;
+     }
+     if (findCustomerRow(customer->customer_number, false) < 0) {
+         releaseNumber(&customer_numbers, customer->customer_number);
+     }
+     if (findPremisesRow(premises->premises_number, false) < 0) {
+         releaseNumber(&premises_numbers, premises->premises_number);
+     }
+     return false;
+ }
+ 
  // Edit an existing customer (Agent function)
  void editCustomer() {
      clearScreen();
@@ -679,19 +1552,11 @@
      }
      
      int choice;
-     bool found = false;
-     int index = -1;
      
-     // Find customer in array
-     for (int i = 0; i < customer_count; i++) {
-         if (strcmp(customers[i].customer_number, customer_number) == 0 && customers[i].is_active) {
-             found = true;
-             index = i;
-             break;
-         }
-     }
+     // Find customer by number
+     int index = findCustomerRow(customer_number, true);
      
-     if (!found) {
+     if (index < 0) {
          printf("Customer not found or is archived.\n");
          pauseScreen();
          return;
@@ -699,9 +1564,10 @@
      
      // Display customer details
      printf("\nCustomer Details:\n");
-     printf("Customer Number: %s\n", customers[index].customer_number);
-     printf("Name: %s %s\n", customers[index].first_name, customers[index].last_name);
-     printf("Income Class: %d\n", customers[index].income_class);
+     Customer *customer = customerAt(index);
+     printf("Customer Number: %s\n", customer->customer_number);
+     printf("Name: %s %s\n", customer->first_name, customer->last_name);
+     printf("Income Class: %d\n", customer->income_class);
      
      printf("\nWhat would you like to edit?\n");
      printf("1. First Name\n");
@@ -713,13 +1579,16 @@
      scanf("%d", &choice);
      getchar(); // Consume newline
      
+     // Edits are made to a copy and applied when the journal commits
+     Customer updated = *customer;
+     
      switch (choice) {
          case 1: {
              char new_first_name[MAX_NAME_LENGTH];
              printf("Enter new First Name: ");
              fgets(new_first_name, MAX_NAME_LENGTH, stdin);
              new_first_name[strcspn(new_first_name, "\n")] = '\0';
-             strcpy(customers[index].first_name, new_first_name);
+             strcpy(updated.first_name, new_first_name);
              break;
          }
          case 2: {
@@ -727,7 +1596,7 @@
              printf("Enter new Last Name: ");
              fgets(new_last_name, MAX_NAME_LENGTH, stdin);
              new_last_name[strcspn(new_last_name, "\n")] = '\0';
-             strcpy(customers[index].last_name, new_last_name);
+             strcpy(updated.last_name, new_last_name);
              break;
          }
          case 3: {
@@ -745,7 +1614,7 @@
              if (new_income_class < 1 || new_income_class > 5) {
                  printf("Invalid income class selection. No changes made.\n");
              } else {
-                 customers[index].income_class = (IncomeClass)new_income_class;
+                 updated.income_class = (IncomeClass)new_income_class;
              }
              break;
          }
@@ -775,9 +1644,9 @@
              if (new_income_class < 1 || new_income_class > 5) {
                  printf("Invalid income class selection. No changes made to income class.\n");
              } else {
-                 strcpy(customers[index].first_name, new_first_name);
-                 strcpy(customers[index].last_name, new_last_name);
-                 customers[index].income_class = (IncomeClass)new_income_class;
+                 strcpy(updated.first_name, new_first_name);
+                 strcpy(updated.last_name, new_last_name);
+                 updated.income_class = (IncomeClass)new_income_class;
              }
              break;
          }
@@ -791,13 +1660,10 @@
              return;
      }
      
-     // Update customer in file
-     FILE *file = fopen(FILE_CUSTOMERS, "wb");
-     if (file != NULL) {
-         for (int i = 0; i < customer_count; i++) {
-             fwrite(&customers[i], sizeof(Customer), 1, file);
-         }
-         fclose(file);
+     // Update customer record
+     journalStage(JOURNAL_CUSTOMERS, index, &updated, sizeof(Customer));
+     
+     if (journalCommit()) {
          printf("Customer updated successfully!\n");
      } else {
          printf("Error: Could not update customer data.\n");
@@ -844,7 +1710,6 @@
  void deleteCustomer() {
      clearScreen();
      char customer_number[8];
-     bool found = false;
      int index = -1;
      
      printf("\n=== Delete/Archive Customer ===\n");
@@ -852,50 +1717,32 @@
      fgets(customer_number, 8, stdin);
      customer_number[strcspn(customer_number, "\n")] = '\0';
      
-     // Find customer in array
-     for (int i = 0; i < customer_count; i++) {
-         if (strcmp(customers[i].customer_number, customer_number) == 0 && customers[i].is_active) {
-             found = true;
-             index = i;
-             break;
-         }
-     }
+     // Find customer by number
+     index = findCustomerRow(customer_number, true);
      
-     if (!found) {
+     if (index < 0) {
          printf("Customer not found or already archived.\n");
          pauseScreen();
          return;
      }
      
      // Archive customer (set is_active to false)
-     customers[index].is_active = false;
-     
-     // Update customer in file
-     FILE *file = fopen(FILE_CUSTOMERS, "wb");
-     if (file != NULL) {
-         for (int i = 0; i < customer_count; i++) {
-             fwrite(&customers[i], sizeof(Customer), 1, file);
-         }
-         fclose(file);
-         
-         // Archive associated premises
-         for (int i = 0; i < premises_count; i++) {
-             if (strcmp(premises[i].customer_number, customer_number) == 0 && premises[i].is_active) {
-                 premises[i].is_active = false;
-             }
-         }
-         
-         // Update premises in file
-         file = fopen(FILE_PREMISES, "wb");
-         if (file != NULL) {
-             for (int i = 0; i < premises_count; i++) {
-                 fwrite(&premises[i], sizeof(Premises), 1, file);
-             }
-             fclose(file);
-             printf("Customer archived successfully!\n");
-         } else {
-             printf("Error: Could not update premises data.\n");
+     Customer archived = *customerAt(index);
+     archived.is_active = false;
+     journalStage(JOURNAL_CUSTOMERS, index, &archived, sizeof(Customer));
+     
+     // Archive associated premises in the same journal group
+     for (int i = firstCustomerPremises(index); i >= 0; i = nextCustomerPremises(i)) {
+         if (premisesAt(i)->is_active) {
+             Premises archived_premises = *premisesAt(i);
+             archived_premises.is_active = false;
+             journalStage(JOURNAL_PREMISES, i, &archived_premises, sizeof(Premises));
          }
+     }
+     stageArchivedView(index);
+     
+     if (journalCommit()) {
+         printf("Customer archived successfully!\n");
      } else {
          printf("Error: Could not update customer data.\n");
      }
@@ -921,11 +1768,8 @@
     clearScreen();
     char customer_input[100];
     char premises_input[100];
-    bool customer_found = false;
-    bool premises_found = false;
     int customer_index = -1;
     int premises_index = -1;
-    int unpaid_bills_count = 0;
     
     printf("\n=== Generate Bill ===\n");
     printf("Enter Customer Number: ");
@@ -948,16 +1792,10 @@
         }
     }
     
-    // Find customer in array
-    for (int i = 0; i < customer_count; i++) {
-        if (strcmp(customers[i].customer_number, customer_input) == 0 && customers[i].is_active) {
-            customer_found = true;
-            customer_index = i;
-            break;
-        }
-    }
+    // Find customer by number
+    customer_index = findCustomerRow(customer_input, true);
     
-    if (!customer_found) {
+    if (customer_index < 0) {
         printf("Customer not found or is archived.\n");
         pauseScreen();
         return;
@@ -983,176 +1821,40 @@
         }
     }
     
-    // Find premises in array
-    for (int i = 0; i < premises_count; i++) {
-        if (strcmp(premises[i].premises_number, premises_input) == 0 && 
-            strcmp(premises[i].customer_number, customer_input) == 0 && 
-            premises[i].is_active) {
-            premises_found = true;
-            premises_index = i;
-            break;
-        }
-    }
+    // Find premises among the customer's premises
+    premises_index = findCustomerPremisesRow(customer_index, premises_input, true);
     
-    if (!premises_found) {
+    if (premises_index < 0) {
         printf("Premises not found, not associated with this customer, or is inactive.\n");
         pauseScreen();
         return;
     }
     
-    // Check for two consecutive unpaid bills
-    FILE *file = fopen(FILE_BILLS, "rb");
-    if (file != NULL) {
-        Bill bill;
-        while (fread(&bill, sizeof(Bill), 1, file) == 1) {
-            if (strcmp(bill.customer_number, customer_input) == 0 && 
-                strcmp(bill.premises_number, premises_input) == 0 && 
-                !bill.is_paid) {
-                unpaid_bills_count++;
-            }
-        }
-        fclose(file);
-    }
+    // Build the bill against the premises ledger and today's tariff
+    Bill new_bill;
+    Premises updated_premises;
+    const TariffSchedule *tariff = currentTariff();
+    uint64_t seed = newRunSeed();
+    BillOutcome outcome = prepareBill(customer_index, premises_index, tariff, seed, &new_bill, &updated_premises);
     
-    if (unpaid_bills_count >= 2) {
+    if (outcome == BILL_TOO_MANY_UNPAID) {
         printf("Cannot generate bill: Customer has two or more unpaid bills.\n");
         pauseScreen();
         return;
     }
     
-    // Generate bill
-    Bill new_bill;
-    int total_consumption = 0;
-    int daily_usage_limit = getDailyUsageLimit(customers[customer_index].income_class);
-    
-    // Generate 30 days of consumption
-    for (int i = 0; i < 30; i++) {
-        total_consumption += generateRandomNumber(0, daily_usage_limit);
-    }
-    
-    // Update premises readings
-    premises[premises_index].previous_reading = premises[premises_index].current_reading;
-    premises[premises_index].current_reading = premises[premises_index].previous_reading + total_consumption;
-    
-    // Generate bill ID
-    generateID(new_bill.bill_id, "BILL");
-    
-    // Set bill details
-    strcpy(new_bill.customer_number, customer_input);
-    strcpy(new_bill.premises_number, premises_input);
-    
-    // Get current date for bill date
-    getCurrentDate(new_bill.bill_date);
-    
-    // Calculate due date (30 days from bill date)
-    // For simplicity, we'll just add "30 days" to the bill date
-    strcpy(new_bill.due_date, new_bill.bill_date);
-    new_bill.due_date[0] = new_bill.due_date[0] + 1; // Simple increment to represent 30 days later
-    
-    // Set month number (1-12)
-    FILE *bill_file = fopen(FILE_BILLS, "rb");
-    if (bill_file != NULL) {
-        Bill last_bill;
-        int last_month = 0;
-        
-        while (fread(&last_bill, sizeof(Bill), 1, bill_file) == 1) {
-            if (strcmp(last_bill.customer_number, customer_input) == 0 && 
-                strcmp(last_bill.premises_number, premises_input) == 0) {
-                if (last_bill.month_number > last_month) {
-                    last_month = last_bill.month_number;
-                }
-            }
-        }
-        fclose(bill_file);
-        
-        if (last_month == 12) {
-            new_bill.month_number = 1;
-        } else {
-            new_bill.month_number = last_month + 1;
-        }
-    } else {
-        new_bill.month_number = 1; // First bill
-    }
-    
-    new_bill.year = 2025; // Current year
-    new_bill.previous_reading = premises[premises_index].previous_reading;
-    new_bill.current_reading = premises[premises_index].current_reading;
-    new_bill.consumption = total_consumption;
-    
-    // Calculate charges
-    new_bill.water_charge = calculateWaterCharge(total_consumption);
-    new_bill.sewerage_charge = calculateSewerageCharge(total_consumption);
-    new_bill.service_charge = calculateServiceCharge(premises[premises_index].meter_size);
-    
-    // PAM (Price Adjustment Mechanism): 1.21% of (Water + Sewerage + Service)
-    new_bill.pam = 0.0121 * (new_bill.water_charge + new_bill.sewerage_charge + new_bill.service_charge);
-    
-    // X-Factor: -5% of (Water + Sewerage + Service)
-    new_bill.x_factor = -0.05 * (new_bill.water_charge + new_bill.sewerage_charge + new_bill.service_charge);
-    
-    // K-Factor: 20% of (Water + Sewerage + Service + PAM) - X-Factor
-    new_bill.k_factor = 0.2 * (new_bill.water_charge + new_bill.sewerage_charge + new_bill.service_charge + new_bill.pam) - new_bill.x_factor;
-    
-    // Total Current Charges
-    new_bill.total_current_charges = new_bill.water_charge + new_bill.sewerage_charge + new_bill.service_charge - new_bill.x_factor + new_bill.k_factor;
-    
-    // Determine early payment eligibility (random)
-    new_bill.is_early_payment_eligible = (generateRandomNumber(0, 1) == 1);
-    
-    if (new_bill.is_early_payment_eligible) {
-        // Early payment discount (random between $50 and $250)
-        new_bill.early_payment_amount = generateRandomNumber(50, 250);
-    } else {
-        new_bill.early_payment_amount = 0.0;
-    }
-    
-    // Check for overdue amount
-    new_bill.overdue_amount = 0.0;
-    bill_file = fopen(FILE_BILLS, "rb");
-    if (bill_file != NULL) {
-        Bill last_bill;
-        
-        while (fread(&last_bill, sizeof(Bill), 1, bill_file) == 1) {
-            if (strcmp(last_bill.customer_number, customer_input) == 0 && 
-                strcmp(last_bill.premises_number, premises_input) == 0 && 
-                !last_bill.is_paid) {
-                new_bill.overdue_amount += (last_bill.total_amount_due - last_bill.amount_paid);
-            }
-        }
-        fclose(bill_file);
-    }
-    
-    // Total Amount Due
-    new_bill.total_amount_due = new_bill.total_current_charges - new_bill.early_payment_amount + new_bill.overdue_amount;
+    priceBills(&new_bill, 1, tariff);
+    stampBill(&new_bill);
     
-    new_bill.amount_paid = 0.0;
-    new_bill.is_paid = false;
-    
-    // Save bill to file
-    file = fopen(FILE_BILLS, "ab");
-    if (file != NULL) {
-        fwrite(&new_bill, sizeof(Bill), 1, file);
-        fclose(file);
+    if (saveNewBill(premises_index, seed, &new_bill, &updated_premises)) {
+        printf("\nBill generated successfully!\n");
+        printf("Bill ID: %s\n", new_bill.bill_id);
+        printf("Customer: %s %s\n", customerAt(customer_index)->first_name, customerAt(customer_index)->last_name);
+        printf("Consumption: %d litres\n", new_bill.consumption);
+        printf("Total Amount Due: $%.2f\n", new_bill.total_amount_due);
         
-        // Update premises in file
-        file = fopen(FILE_PREMISES, "wb");
-        if (file != NULL) {
-            for (int i = 0; i < premises_count; i++) {
-                fwrite(&premises[i], sizeof(Premises), 1, file);
-            }
-            fclose(file);
-            
-            printf("\nBill generated successfully!\n");
-            printf("Bill ID: %s\n", new_bill.bill_id);
-            printf("Customer: %s %s\n", customers[customer_index].first_name, customers[customer_index].last_name);
-            printf("Consumption: %d litres\n", total_consumption);
-            printf("Total Amount Due: $%.2f\n", new_bill.total_amount_due);
-            
-            if (new_bill.is_early_payment_eligible) {
-                printf("Early Payment Discount: $%.2f (if paid before due date)\n", new_bill.early_payment_amount);
-            }
-        } else {
-            printf("Error: Could not update premises data.\n");
+        if (new_bill.is_early_payment_eligible) {
+            printf("Early Payment Discount: $%.2f (if paid before due date)\n", new_bill.early_payment_amount);
         }
     } else {
         printf("Error: Could not save bill data.\n");
@@ -1161,6 +1863,364 @@
     pauseScreen();
 }
  
+ // Save a priced and stamped bill with its premises readings, ledger, report views and run seed as one journal group
+ bool saveNewBill(int premises_row, uint64_t seed, const Bill *bill, const Premises *updated_premises) {
+     PremisesLedger updated_ledger = *ledgerAt(premises_row);
+     ledgerRecordBill(&updated_ledger, NULL, bill);
+     
+     int32_t record = stageBillAppend(bill);
+     journalStage(JOURNAL_PREMISES, premises_row, updated_premises, sizeof(Premises));
+     journalStage(JOURNAL_LEDGER, premises_row, &updated_ledger, sizeof(PremisesLedger));
+     stageReportViews(record, NULL, bill);
+     stageBillingRun(seed, record, 1);
+     
+     return journalCommit();
+ }
+ 
+ /**
+  * Prepare a bill for a premises
+  * 
+  * Applies the billing rules to one premises: refuses the bill if it already
+  * has two or more unpaid bills, otherwise generates 30 days of usage,
+  * carries forward the overdue balance less any overpayment credit and
+  * advances the billing month (12 rolls over to 1 of the next year). All of
+  * these come from the premises ledger, so no bills are read. The usage and
+  * early payment terms are drawn from a random stream of the premises
+  * derived from the run seed, so the same seed always gives the same bill.
+  * The consumption charges are left for priceBills and the bill ID and dates
+  * for stampBill, so this only reads shared state and may run on a worker
+  * thread.
+  * 
+  * @param customer_row - Customer row being billed
+  * @param premises_row - Premises row being billed
+  * @param tariff - Tariff schedule in force for the bill
+  * @param seed - Seed of the billing run
+  * @param new_bill - Receives the bill
+  * @param updated_premises - Receives the premises with its readings advanced
+  * @return BillOutcome - BILL_READY, or why the premises cannot be billed
+  */
+ BillOutcome prepareBill(int customer_row, int premises_row, const TariffSchedule *tariff, uint64_t seed, Bill *new_bill, Premises *updated_premises) {
+     const Customer *customer = customerAt(customer_row);
+     const Premises *premises = premisesAt(premises_row);
+     const PremisesLedger *ledger = ledgerAt(premises_row);
+     
+     memset(new_bill, 0, sizeof(Bill));
+     
+     if (ledger->unpaid_count >= 2) {
+         return BILL_TOO_MANY_UNPAID;
+     }
+     
+     RandomStream stream;
+     randomSeed(&stream, seed, packNumber(premises->premises_number));
+     
+     // Generate 30 days of consumption
+     int usage[DAYS_PER_BILL];
+     int total_consumption = 0;
+     generateDailyUsage(&stream, getDailyUsageLimit(customer->income_class), usage, DAYS_PER_BILL);
+     for (int i = 0; i < DAYS_PER_BILL; i++) {
+         total_consumption += usage[i];
+     }
+     
+     // Update premises readings (applied when the journal commits)
+     *updated_premises = *premises;
+     updated_premises->previous_reading = updated_premises->current_reading;
+     updated_premises->current_reading = updated_premises->previous_reading + total_consumption;
+     
+     strcpy(new_bill->customer_number, customer->customer_number);
+     strcpy(new_bill->premises_number, premises->premises_number);
+     
+     // Set month number (1-12), rolling December over into January of the next
+     // year; a premises' first bill is left for stampBill to date
+     if (ledger->last_month == 12) {
+         new_bill->month_number = 1;
+         new_bill->year = ledger->last_year + 1;
+     } else if (ledger->last_month > 0) {
+         new_bill->month_number = ledger->last_month + 1;
+         new_bill->year = ledger->last_year;
+     }
+     
+     new_bill->previous_reading = updated_premises->previous_reading;
+     new_bill->current_reading = updated_premises->current_reading;
+     new_bill->consumption = total_consumption;
+     
+     new_bill->service_charge = moneyToDouble(tariffServiceCharge(tariff, premises->meter_size));
+     
+     // Determine early payment eligibility (random)
+     new_bill->is_early_payment_eligible = (randomBelow(&stream, 2) == 1);
+     
+     if (new_bill->is_early_payment_eligible) {
+         // Early payment discount (random between $50 and $250)
+         new_bill->early_payment_amount = moneyToDouble((Money)(50 + randomBelow(&stream, 201)) * CENTS_PER_DOLLAR);
+     } else {
+         new_bill->early_payment_amount = 0.0;
+     }
+     
+     // Carry forward overdue amount from unpaid bills, less any overpayment credit
+     new_bill->overdue_amount = moneyToDouble(ledger->outstanding - ledger->credit);
+     
+     new_bill->amount_paid = 0.0;
+     new_bill->is_paid = false;
+     
+     return BILL_READY;
+ }
+ 
+ /**
+  * Price prepared bills
+  * 
+  * Rates the consumption of a run of bills through the tariff kernel a block
+  * at a time, then fills in the PAM, X-Factor and K-Factor adjustments and
+  * the totals, marking any bill its credit covers as paid. Bills must
+  * already carry their consumption, service charge, early payment discount
+  * and overdue amount (see prepareBill). All of the arithmetic is in whole
+  * cents, so a bill prices the same whichever thread or batch it is priced
+  * in.
+  * 
+  * @param bills - Bills to price
+  * @param count - Number of bills
+  * @param tariff - Tariff schedule in force for the bills
+  */
+ void priceBills(Bill *bills, int count, const TariffSchedule *tariff) {
+     int consumption[RATING_BLOCK];
+     Money water[RATING_BLOCK];
+     Money sewerage[RATING_BLOCK];
+     
+     for (int start = 0; start < count; start += RATING_BLOCK) {
+         int block = count - start < RATING_BLOCK ? count - start : RATING_BLOCK;
+         
+         for (int i = 0; i < block; i++) {
+             consumption[i] = bills[start + i].consumption;
+         }
+         rateConsumption(&tariff->water, consumption, water, block);
+         rateConsumption(&tariff->sewerage, consumption, sewerage, block);
+         
+         for (int i = 0; i < block; i++) {
+             Bill *bill = &bills[start + i];
+             Money service = moneyFromDouble(bill->service_charge);
+             Money charges = water[i] + sewerage[i] + service;
+             
+             // PAM (Price Adjustment Mechanism): share of (Water + Sewerage + Service)
+             Money pam = applyRate(charges, tariff->pam_rate);
+             
+             // X-Factor: share of (Water + Sewerage + Service)
+             Money x_factor = applyRate(charges, tariff->x_factor_rate);
+             
+             // K-Factor: share of (Water + Sewerage + Service + PAM) - X-Factor
+             Money k_factor = applyRate(charges + pam, tariff->k_factor_rate) - x_factor;
+             
+             // Total Current Charges
+             Money total_current_charges = charges - x_factor + k_factor;
+             
+             // Total Amount Due
+             Money total_amount_due = total_current_charges - moneyFromDouble(bill->early_payment_amount) + moneyFromDouble(bill->overdue_amount);
+             
+             bill->water_charge = moneyToDouble(water[i]);
+             bill->sewerage_charge = moneyToDouble(sewerage[i]);
+             bill->pam = moneyToDouble(pam);
+             bill->x_factor = moneyToDouble(x_factor);
+             bill->k_factor = moneyToDouble(k_factor);
+             bill->total_current_charges = moneyToDouble(total_current_charges);
+             bill->total_amount_due = moneyToDouble(total_amount_due);
+             
+             // A bill covered in full by overpayment credit is settled as issued
+             bill->is_paid = total_amount_due <= 0;
+         }
+     }
+ }
+ 
+ // Give a prepared bill its ID, bill date and due date (main thread only)
+ void stampBill(Bill *bill) {
+     generateID(bill->bill_id, "BILL");
+     
+     // Get current date for bill date
+     getCurrentDate(bill->bill_date);
+     
+     // A premises' first bill is for the month of its bill date
+     if (bill->month_number == 0) {
+         sscanf(bill->bill_date, "%d-%d", &bill->year, &bill->month_number);
+     }
+     
+     // Calculate due date (30 days from bill date)
+     addDays(bill->bill_date, 30, bill->due_date);
+ }
+ 
+ // Prepare the bills of one worker's slice of a billing run
+ WORKER_RESULT billingWorker(void *arg) {
+     BillingSlice *slice = arg;
+     BillingRun *run = slice->run;
+     
+     for (int i = slice->start; i < slice->end; i++) {
+         int premises_row = run->premises_rows[i];
+         run->outcomes[i] = prepareBill(premisesCustomerRow(premises_row), premises_row, run->tariff, run->seed,
+                                        &run->new_bills[i], &run->new_premises[i]);
+     }
+     
+     // Skipped bills are left zeroed by prepareBill, so the slice is priced as one run
+     priceBills(run->new_bills + slice->start, slice->end - slice->start, run->tariff);
+     
+     return WORKER_RETURN;
+ }
+ 
+ /**
+  * Run a billing cycle (Agent function)
+  * 
+  * Asks for confirmation, bills every active premises with
+  * billActivePremises and reports the totals.
+  */
+ void runBillingCycle() {
+     clearScreen();
+     char confirm;
+     
+     printf("\n=== Run Billing Cycle ===\n");
+     printf("This will bill every active premises. Continue? (y/n): ");
+     scanf(" %c", &confirm);
+     getchar(); // Consume newline
+     
+     if (tolower(confirm) != 'y') {
+         printf("Billing cycle cancelled.\n");
+         pauseScreen();
+         return;
+     }
+     
+     BillingTotals totals;
+     uint64_t seed = newRunSeed();
+     time_t started = time(NULL);
+     
+     if (!billActivePremises(seed, &totals)) {
+         printf("Error: Could not save bill data. No premises were billed.\n");
+     } else if (totals.billed + totals.skipped == 0) {
+         printf("No active premises to bill.\n");
+     } else {
+         printf("\nBilling cycle complete.\n");
+         printf("Premises billed: %d\n", totals.billed);
+         printf("Premises skipped (two or more unpaid bills): %d\n", totals.skipped);
+         printf("Total current charges: $%.2f\n", moneyToDouble(totals.total_billed));
+         printf("Run seed: %016" PRIx64 "\n", seed);
+         printf("Workers: %d, elapsed: %ld second(s)\n", totals.workers, (long)(time(NULL) - started));
+     }
+     
+     pauseScreen();
+ }
+ 
+ /**
+  * Bill every active premises
+  * 
+  * Bills every active premises of every active customer in one go. The
+  * premises are split into contiguous slices that worker threads prepare in
+  * parallel from the premises ledger; the bills, premises readings and
+  * ledger rows are then staged in premises order and written as one
+  * journal group, so the whole cycle is saved with a single write and sync
+  * and a crash part-way through leaves no premises billed twice.
+  * 
+  * @param seed - Seed of the cycle's random streams (recorded in the billing runs log)
+  * @param totals - Receives the counts and charges of the cycle
+  * @return bool - False if the cycle could not be prepared or saved
+  */
+ bool billActivePremises(uint64_t seed, BillingTotals *totals) {
+     BillingRun run;
+     memset(&run, 0, sizeof(BillingRun));
+     memset(totals, 0, sizeof(BillingTotals));
+     totals->first_record = -1;
+     
+     // Collect the premises to bill
+     run.premises_rows = malloc(sizeof(int32_t) * (premises_table.count > 0 ? premises_table.count : 1));
+     if (run.premises_rows == NULL) {
+         printf("Error: Out of memory while preparing the billing cycle.\n");
+         return false;
+     }
+     
+     for (int i = 0; i < premises_table.count; i++) {
+         int customer_row = premisesCustomerRow(i);
+         if (premisesAt(i)->is_active && customer_row >= 0 && customerAt(customer_row)->is_active) {
+             run.premises_rows[run.count++] = i;
+         }
+     }
+     
+     if (run.count == 0) {
+         free(run.premises_rows);
+         return true;
+     }
+     
+     run.new_bills = malloc(sizeof(Bill) * run.count);
+     run.new_premises = malloc(sizeof(Premises) * run.count);
+     run.outcomes = malloc(sizeof(BillOutcome) * run.count);
+     if (run.new_bills == NULL || run.new_premises == NULL || run.outcomes == NULL) {
+         printf("Error: Out of memory while preparing the billing cycle.\n");
+         free(run.premises_rows);
+         free(run.new_bills);
+         free(run.new_premises);
+         free(run.outcomes);
+         return false;
+     }
+     
+     // Prepare the bills in parallel
+     run.tariff = currentTariff();
+     run.seed = seed;
+     
+     int workers = workerCount();
+     if (workers > run.count / BILLING_MIN_SLICE) {
+         workers = run.count / BILLING_MIN_SLICE > 0 ? run.count / BILLING_MIN_SLICE : 1;
+     }
+     
+     BillingSlice slices[MAX_WORKERS];
+     WorkerThread threads[MAX_WORKERS];
+     bool started_thread[MAX_WORKERS];
+     
+     for (int w = 0; w < workers; w++) {
+         slices[w].run = &run;
+         slices[w].start = (int)((long)run.count * w / workers);
+         slices[w].end = (int)((long)run.count * (w + 1) / workers);
+         started_thread[w] = w > 0 && startWorker(&threads[w], billingWorker, &slices[w]);
+     }
+     
+     // The calling thread takes the first slice, and any slice whose thread could not start
+     for (int w = 0; w < workers; w++) {
+         if (!started_thread[w]) {
+             billingWorker(&slices[w]);
+         }
+     }
+     
+     for (int w = 0; w < workers; w++) {
+         if (started_thread[w]) {
+             joinWorker(threads[w]);
+         }
+     }
+     totals->workers = workers;
+     
+     // Stage every bill, reading, ledger and view row in premises order and commit them together
+     for (int i = 0; i < run.count; i++) {
+         if (run.outcomes[i] != BILL_READY) {
+             totals->skipped++;
+             continue;
+         }
+         stampBill(&run.new_bills[i]);
+         PremisesLedger updated_ledger = *ledgerAt(run.premises_rows[i]);
+         ledgerRecordBill(&updated_ledger, NULL, &run.new_bills[i]);
+         
+         int32_t record = stageBillAppend(&run.new_bills[i]);
+         if (totals->first_record < 0) {
+             totals->first_record = record;
+         }
+         journalStage(JOURNAL_PREMISES, run.premises_rows[i], &run.new_premises[i], sizeof(Premises));
+         journalStage(JOURNAL_LEDGER, run.premises_rows[i], &updated_ledger, sizeof(PremisesLedger));
+         stageReportViews(record, NULL, &run.new_bills[i]);
+         totals->total_billed += moneyFromDouble(run.new_bills[i].total_current_charges);
+         totals->billed++;
+     }
+     
+     if (totals->billed > 0) {
+         stageBillingRun(seed, totals->first_record, totals->billed);
+     }
+     
+     bool committed = journalCommit();
+     
+     free(run.premises_rows);
+     free(run.new_bills);
+     free(run.new_premises);
+     free(run.outcomes);
+     
+     return committed;
+ }
+ 
  // View reports (Agent function)
  void viewReports() {
      clearScreen();
@@ -1170,124 +2230,42 @@
      printf("1. Paid Customers\n");
      printf("2. Owing Customers\n");
      printf("3. Deleted/Archived Customers\n");
-     printf("4. Back\n");
+     printf("4. Audit Bills\n");
+     printf("5. Export Data\n");
+     printf("6. Top Debtors\n");
+     printf("7. Debtors by Balance\n");
+     printf("8. Back\n");
      printf("Please enter your choice: ");
      scanf("%d", &choice);
      getchar(); // Consume newline
      
      switch (choice) {
-         case 1: {
+         case 1:
+         case 2:
              clearScreen();
-             printf("\n=== Paid Customers Report ===\n");
-             printf("%-10s %-10s %-20s %-10s %-10s\n", "Customer", "Premises", "Name", "Month", "Amount");
-             printf("--------------------------------------------------------------\n");
-             
-             FILE *file = fopen(FILE_BILLS, "rb");
-             if (file != NULL) {
-                 Bill bill;
-                 while (fread(&bill, sizeof(Bill), 1, file) == 1) {
-                     if (bill.is_paid) {
-                         // Find customer name
-                         char full_name[MAX_NAME_LENGTH * 2 + 1] = "";
-                         for (int i = 0; i < customer_count; i++) {
-                             if (strcmp(customers[i].customer_number, bill.customer_number) == 0) {
-                                 sprintf(full_name, "%s %s", customers[i].first_name, customers[i].last_name);
-                                 break;
-                             }
-                         }
-                         
-                         printf("%-10s %-10s %-20s %-10d $%-9.2f\n", 
-                                bill.customer_number, 
-                                bill.premises_number, 
-                                full_name, 
-                                bill.month_number, 
-                                bill.amount_paid);
-                     }
-                 }
-                 fclose(file);
-             } else {
-                 printf("No paid bills found.\n");
-             }
+             showBillReport(choice == 1);
              break;
-         }
-         case 2: {
+         case 3:
              clearScreen();
-             printf("\n=== Owing Customers Report ===\n");
-             printf("%-10s %-10s %-20s %-10s %-10s\n", "Customer", "Premises", "Name", "Month", "Amount");
-             printf("--------------------------------------------------------------\n");
-             
-             FILE *file = fopen(FILE_BILLS, "rb");
-             if (file != NULL) {
-                 Bill bill;
-                 while (fread(&bill, sizeof(Bill), 1, file) == 1) {
-                     if (!bill.is_paid) {
-                         // Find customer name
-                         char full_name[MAX_NAME_LENGTH * 2 + 1] = "";
-                         for (int i = 0; i < customer_count; i++) {
-                             if (strcmp(customers[i].customer_number, bill.customer_number) == 0) {
-                                 sprintf(full_name, "%s %s", customers[i].first_name, customers[i].last_name);
-                                 break;
-                             }
-                         }
-                         
-                         double amount_owing = bill.total_amount_due - bill.amount_paid;
-                         
-                         printf("%-10s %-10s %-20s %-10d $%-9.2f\n", 
-                                bill.customer_number, 
-                                bill.premises_number, 
-                                full_name, 
-                                bill.month_number, 
-                                amount_owing);
-                     }
-                 }
-                 fclose(file);
-             } else {
-                 printf("No owing bills found.\n");
-             }
+             showArchivedReport();
              break;
-         }
-         case 3: {
+         case 4:
              clearScreen();
-             printf("\n=== Deleted/Archived Customers Report ===\n");
-             printf("%-10s %-10s %-20s %-15s %-15s\n", "Customer", "Premises", "Name", "Balance", "Archive Date");
-             printf("-----------------------------------------------------------------------\n");
-             
-             for (int i = 0; i < customer_count; i++) {
-                 if (!customers[i].is_active) {
-                     char premises_list[100] = "";
-                     double outstanding_balance = 0.0;
-                     
-                     // Find associated premises
-                     for (int j = 0; j < premises_count; j++) {
-                         if (strcmp(premises[j].customer_number, customers[i].customer_number) == 0) {
-                             strcat(premises_list, premises[j].premises_number);
-                             strcat(premises_list, " ");
-                         }
-                     }
-                     
-                     // Calculate outstanding balance
-                     FILE *file = fopen(FILE_BILLS, "rb");
-                     if (file != NULL) {
-                         Bill bill;
-                         while (fread(&bill, sizeof(Bill), 1, file) == 1) {
-                             if (strcmp(bill.customer_number, customers[i].customer_number) == 0 && !bill.is_paid) {
-                                 outstanding_balance += (bill.total_amount_due - bill.amount_paid);
-                             }
-                         }
-                         fclose(file);
-                     }
-                     
-                     printf("%-10s %-10s %-20s $%-14.2f %s\n", 
-                            customers[i].customer_number, 
-                            premises_list, 
-                            customers[i].first_name, 
-                            outstanding_balance, 
-                            "N/A"); // Archive date not tracked in this implementation
-                 }
-             }
+             auditBills();
              break;
-         }
-         case 4:
+         case 5:
+             clearScreen();
+             exportReports();
+             break;
+         case 6:
+             clearScreen();
+             showTopDebtors();
+             break;
+         case 7:
+             clearScreen();
+             showDebtorPages();
+             break;
+         case 8:
              return;
          default:
              printf("Invalid choice. Please try again.\n");
@@ -1297,842 +2275,6376 @@
  }
  
  /**
-  * Register a payment card (Customer function)
+  * Show a bill report
   * 
-  * Allows customers to register a payment card for bill payments.
-  * A customer must register a card before making any bill payments.
+  * Lists the paid bills (amount paid) or the unpaid bills (balance owing)
+  * from the materialized paid or owing view in bill record order, followed
+  * by the totals of the report. Only the rows of the chosen view are read,
+  * so bills.txt is never scanned; view rows are kept in settlement order
+  * (owing rows are reused), so they are copied and sorted into bill order
+  * each time, which costs O(R log R) in the R rows listed.
   * 
-  * Stores basic card identifier (not full card details for security).
-  * Updates customer record to indicate card registration.
+  * @param paid - True for the paid customers report, false for owing customers
   */
- void registerPaymentCard() {
-     clearScreen();
-     PaymentCard card;
-     char card_identifier[20];
-     
-     printf("\n=== Register Payment Card ===\n");
-     
-     // Check if customer already has a registered card
-     if (current_customer.has_payment_card) {
-         printf("You already have a registered payment card.\n");
-         pauseScreen();
+ void showBillReport(bool paid) {
+     const RecordTable *view = paid ? &report_views.paid : &report_views.owing;
+     BillViewRow *rows = malloc(sizeof(BillViewRow) * (view->count > 0 ? view->count : 1));
+     if (rows == NULL) {
+         printf("Error: Out of memory while building the report.\n");
          return;
      }
      
-     printf("Enter Card Identifier (e.g., last 4 digits): ");
-     fgets(card_identifier, 20, stdin);
-     card_identifier[strcspn(card_identifier, "\n")] = '\0';
+     // Collect the rows in use and list them in bill order
+     int count = 0;
+     for (int i = 0; i < view->count; i++) {
+         const BillViewRow *row = tableRow(view, i);
+         if (row->record >= 0) {
+             rows[count++] = *row;
+         }
+     }
+     qsort(rows, count, sizeof(BillViewRow), compareBillViewRows);
+     
+     HashIndex customers_seen;
+     hashIndexInit(&customers_seen, count);
+     Money report_total = 0;
+     
+     printf("\n=== %s Customers Report ===\n", paid ? "Paid" : "Owing");
+     printf("%-10s %-10s %-20s %-10s %-10s\n", "Customer", "Premises", "Name", "Month", "Amount");
+     printf("--------------------------------------------------------------\n");
+     
+     for (int i = 0; i < count; i++) {
+         const BillViewRow *row = &rows[i];
+         uint32_t key = packNumber(row->customer_number);
+         int cursor = -1;
+         if (hashIndexFind(&customers_seen, key, &cursor) < 0) {
+             hashIndexInsert(&customers_seen, key, 0);
+         }
+         report_total += row->amount;
+         
+         char full_name[MAX_NAME_LENGTH * 2 + 1] = "";
+         int customer_row = findCustomerRow(row->customer_number, false);
+         if (customer_row >= 0) {
+             sprintf(full_name, "%s %s", customerAt(customer_row)->first_name, customerAt(customer_row)->last_name);
+         }
+         
+         printf("%-10s %-10s %-20s %-10d $%-9.2f\n", 
+                row->customer_number, 
+                row->premises_number, 
+                full_name, 
+                row->month_number, 
+                moneyToDouble(row->amount));
+     }
      
-     // Create payment card
-     strcpy(card.customer_number, current_customer.customer_number);
-     strcpy(card.card_identifier, card_identifier);
-     card.is_active = true;
+     printf("--------------------------------------------------------------\n");
+     printf("%d bill(s) from %d customer(s), total %s $%.2f\n", count, customers_seen.count,
+            paid ? "paid" : "owing", moneyToDouble(report_total));
      
-     // Save payment card to file
-     FILE *file = fopen(FILE_PAYMENT_CARDS, "ab");
-     if (file != NULL) {
-         fwrite(&card, sizeof(PaymentCard), 1, file);
-         fclose(file);
-         
-         // Update customer's has_payment_card flag
-         for (int i = 0; i < customer_count; i++) {
-             if (strcmp(customers[i].customer_number, current_customer.customer_number) == 0) {
-                 customers[i].has_payment_card = true;
-                 current_customer.has_payment_card = true;
-                 break;
-             }
+     hashIndexFree(&customers_seen);
+     free(rows);
+ }
+ 
+ // List the archived customers with their balances from the archived view
+ void showArchivedReport() {
+     printf("\n=== Deleted/Archived Customers Report ===\n");
+     printf("%-10s %-10s %-20s %-15s %-15s\n", "Customer", "Premises", "Name", "Balance", "Archive Date");
+     printf("-----------------------------------------------------------------------\n");
+     
+     for (int i = 0; i < report_views.archived.count; i++) {
+         const ArchivedViewRow *row = tableRow(&report_views.archived, i);
+         int customer_row = findCustomerRow(row->customer_number, false);
+         if (customer_row < 0) {
+             continue;
          }
          
-         // Update customer file
-         file = fopen(FILE_CUSTOMERS, "wb");
-         if (file != NULL) {
-             for (int i = 0; i < customer_count; i++) {
-                 fwrite(&customers[i], sizeof(Customer), 1, file);
+         char premises_list[100] = "";
+         for (int j = firstCustomerPremises(customer_row); j >= 0; j = nextCustomerPremises(j)) {
+             if (strlen(premises_list) + 9 <= sizeof(premises_list)) {
+                 strcat(premises_list, premisesAt(j)->premises_number);
+                 strcat(premises_list, " ");
              }
-             fclose(file);
-             printf("Payment card registered successfully!\n");
-         } else {
-             printf("Error: Could not update customer data.\n");
          }
-     } else {
-         printf("Error: Could not save payment card data.\n");
+         
+         printf("%-10s %-10s %-20s $%-14.2f %s\n", 
+                row->customer_number, 
+                premises_list, 
+                customerAt(customer_row)->first_name, 
+                moneyToDouble(row->balance), 
+                row->archive_date[0] != '\0' ? row->archive_date : "N/A");
      }
-     
-     pauseScreen();
  }
  
- // View bill (Customer function)
- void viewBill() {
-     clearScreen();
-     bool bill_found = false;
-     Bill latest_bill;
+ // Order bill view rows by bill record (qsort callback)
+ int compareBillViewRows(const void *a, const void *b) {
+     int32_t left = ((const BillViewRow *)a)->record;
+     int32_t right = ((const BillViewRow *)b)->record;
+     return (left > right) - (left < right);
+ }
+ 
+ // List the N customers owing the most (Agent function)
+ void showTopDebtors() {
+     char input[32];
+     printf("\n=== Top Debtors ===\n");
+     printf("How many customers: ");
+     fgets(input, sizeof(input), stdin);
+     int limit = atoi(input);
+     
+     if (limit <= 0) {
+         printf("Invalid number of customers.\n");
+         return;
+     }
+     if (limit > customer_table.count) {
+         limit = customer_table.count > 0 ? customer_table.count : 1;
+     }
      
-     printf("\n=== View Bill ===\n");
+     DebtorEntry *top = malloc(sizeof(DebtorEntry) * limit);
+     if (top == NULL) {
+         printf("Error: Out of memory while ranking debtors.\n");
+         return;
+     }
      
-     // Find the most recent bill for the customer
-     FILE *file = fopen(FILE_BILLS, "rb");
-     if (file != NULL) {
-         Bill bill;
-         time_t latest_time = 0;
-         
-         while (fread(&bill, sizeof(Bill), 1, file) == 1) {
-             if (strcmp(bill.customer_number, current_customer.customer_number) == 0) {
-                 bill_found = true;
-                 
-                 // Simple logic to find the most recent bill (based on month number)
-                 if (bill.month_number > latest_bill.month_number || latest_time == 0) {
-                     latest_bill = bill;
-                     latest_time = 1; // Just to mark that we found a bill
-                 }
-             }
-         }
-         fclose(file);
+     int count = topDebtors(limit, top);
+     showDebtors(top, count, 1);
+     free(top);
+ }
+ 
+ // Page through the customers owing money, largest balance first (Agent function)
+ void showDebtorPages() {
+     buildDebtorIndex();
+     int pages = (debtor_index.count + DEBTOR_PAGE_SIZE - 1) / DEBTOR_PAGE_SIZE;
+     
+     printf("\n=== Debtors by Balance ===\n");
+     if (pages == 0) {
+         printf("No customers owe money.\n");
+         return;
      }
      
-     if (!bill_found) {
-         printf("No bills found for your account.\n");
-         pauseScreen();
+     char input[32];
+     printf("%d customer(s) owe money over %d page(s). Enter page number: ", debtor_index.count, pages);
+     fgets(input, sizeof(input), stdin);
+     int page = atoi(input);
+     
+     if (page < 1 || page > pages) {
+         printf("Invalid page number.\n");
          return;
      }
      
-     // Find premises details
-     char meter_size_str[10] = "";
-     for (int i = 0; i < premises_count; i++) {
-         if (strcmp(premises[i].premises_number, latest_bill.premises_number) == 0) {
-             switch (premises[i].meter_size) {
-                 case METER_15MM:
-                     strcpy(meter_size_str, "15mm");
-                     break;
-                 case METER_30MM:
-                     strcpy(meter_size_str, "30mm");
-                     break;
-                 case METER_150MM:
-                     strcpy(meter_size_str, "150mm");
-                     break;
-             }
-             break;
-         }
+     int first = (page - 1) * DEBTOR_PAGE_SIZE;
+     int count = debtor_index.count - first < DEBTOR_PAGE_SIZE ? debtor_index.count - first : DEBTOR_PAGE_SIZE;
+     printf("\nPage %d of %d\n", page, pages);
+     showDebtors(debtor_index.entries + first, count, first + 1);
+ }
+ 
+ // List ranked debtors with their names, unpaid bills and balances
+ void showDebtors(const DebtorEntry *entries, int count, int first_rank) {
+     printf("%-6s %-10s %-25s %-10s %-8s %-15s\n", "Rank", "Customer", "Name", "Status", "Unpaid", "Balance");
+     printf("------------------------------------------------------------------------------\n");
+     
+     for (int i = 0; i < count; i++) {
+         const Customer *customer = customerAt(entries[i].customer_row);
+         char full_name[MAX_NAME_LENGTH * 2 + 1];
+         sprintf(full_name, "%s %s", customer->first_name, customer->last_name);
+         
+         printf("%-6d %-10s %-25s %-10s %-8d $%.2f\n", 
+                first_rank + i, 
+                customer->customer_number, 
+                full_name, 
+                customer->is_active ? "Active" : "Archived", 
+                entries[i].unpaid_bills, 
+                moneyToDouble(entries[i].balance));
      }
      
-     // Display bill details
-     printf("\n======= NATIONAL WATER COMMISSION =======\n");
-     printf("Bill ID: %s\n", latest_bill.bill_id);
-     printf("Customer: %s %s\n", current_customer.first_name, current_customer.last_name);
-     printf("Customer Number: %s\n", latest_bill.customer_number);
-     printf("Premises Number: %s\n", latest_bill.premises_number);
-     printf("Meter Size: %s\n", meter_size_str);
-     printf("Bill Date: %s\n", latest_bill.bill_date);
-     printf("Due Date: %s\n", latest_bill.due_date);
-     printf("\n--- Meter Readings ---\n");
-     printf("Previous Reading: %d\n", latest_bill.previous_reading);
-     printf("Current Reading: %d\n", latest_bill.current_reading);
-     printf("Consumption: %d litres\n", latest_bill.consumption);
-     printf("\n--- Charges ---\n");
-     printf("Water Charge: $%.2f\n", latest_bill.water_charge);
-     printf("Sewerage Charge: $%.2f\n", latest_bill.sewerage_charge);
-     printf("Service Charge: $%.2f\n", latest_bill.service_charge);
-     printf("PAM: $%.2f\n", latest_bill.pam);
-     printf("X-Factor: $%.2f\n", latest_bill.x_factor);
-     printf("K-Factor: $%.2f\n", latest_bill.k_factor);
-     printf("Total Current Charges: $%.2f\n", latest_bill.total_current_charges);
-     
-     if (latest_bill.is_early_payment_eligible) {
-         printf("Early Payment Discount: $%.2f\n", latest_bill.early_payment_amount);
+     if (count == 0) {
+         printf("No customers owe money.\n");
+     }
+ }
+ 
+ // Total the unpaid bills of a customer from their premises ledger rows
+ void customerDebt(int customer_row, DebtorEntry *entry) {
+     entry->customer_row = customer_row;
+     entry->unpaid_bills = 0;
+     entry->balance = 0;
+     
+     for (int i = firstCustomerPremises(customer_row); i >= 0; i = nextCustomerPremises(i)) {
+         entry->unpaid_bills += ledgerAt(i)->unpaid_count;
+         entry->balance += ledgerAt(i)->outstanding;
      }
+ }
+ 
+ // Order debtors by balance, largest first, then by customer row (qsort callback)
+ int compareDebtors(const void *a, const void *b) {
+     const DebtorEntry *left = a;
+     const DebtorEntry *right = b;
      
-     if (latest_bill.overdue_amount > 0) {
-         printf("Overdue Amount: $%.2f\n", latest_bill.overdue_amount);
+     if (left->balance != right->balance) {
+         return left->balance > right->balance ? -1 : 1;
+     }
+     return (left->customer_row > right->customer_row) - (left->customer_row < right->customer_row);
+ }
+ 
+ /**
+  * Find the customers owing the most
+  * 
+  * Keeps the best limit debtors seen so far in a min-heap whose root is the
+  * smallest of them, so each customer costs one comparison against the
+  * root and at most O(log limit) to replace it: O(customers * log limit)
+  * overall, without sorting every debtor.
+  * 
+  * @param limit - Most customers to return
+  * @param top - Receives up to limit debtors, largest balance first
+  * @return int - Number of debtors returned
+  */
+ int topDebtors(int limit, DebtorEntry *top) {
+     int count = 0;
+     
+     for (int i = 0; i < customer_table.count; i++) {
+         DebtorEntry entry;
+         customerDebt(i, &entry);
+         if (entry.balance <= 0) {
+             continue;
+         }
+         
+         if (count < limit) {
+             // Sift the new entry up towards the root
+             int position = count++;
+             while (position > 0 && compareDebtors(&entry, &top[(position - 1) / 2]) > 0) {
+                 top[position] = top[(position - 1) / 2];
+                 position = (position - 1) / 2;
+             }
+             top[position] = entry;
+         } else if (compareDebtors(&entry, &top[0]) < 0) {
+             top[0] = entry;
+             siftDebtorHeap(top, count, 0);
+         }
      }
      
-     printf("\nTotal Amount Due: $%.2f\n", latest_bill.total_amount_due);
+     qsort(top, count, sizeof(DebtorEntry), compareDebtors);
+     return count;
+ }
+ 
+ // Move a heap entry down until no child ranks below it (the root is the lowest-ranked debtor)
+ void siftDebtorHeap(DebtorEntry *heap, int count, int position) {
+     DebtorEntry entry = heap[position];
+     
+     while (position * 2 + 1 < count) {
+         int child = position * 2 + 1;
+         if (child + 1 < count && compareDebtors(&heap[child + 1], &heap[child]) > 0) {
+             child++;
+         }
+         if (compareDebtors(&heap[child], &entry) <= 0) {
+             break;
+         }
+         heap[position] = heap[child];
+         position = child;
+     }
+     heap[position] = entry;
+ }
+ 
+ // Sort every customer owing money by balance (kept until the next committed ledger change)
+ void buildDebtorIndex() {
+     if (debtor_index.current) {
+         return;
+     }
      
-     if (latest_bill.amount_paid > 0) {
-         printf("Amount Paid: $%.2f\n", latest_bill.amount_paid);
-         printf("Balance: $%.2f\n", latest_bill.total_amount_due - latest_bill.amount_paid);
+     if (debtor_index.capacity < customer_table.count) {
+         DebtorEntry *grown = realloc(debtor_index.entries, sizeof(DebtorEntry) * customer_table.count);
+         if (grown == NULL) {
+             printf("Error: Out of memory while ranking debtors.\n");
+             exit(1);
+         }
+         debtor_index.entries = grown;
+         debtor_index.capacity = customer_table.count;
      }
      
-     printf("\nPayment Status: %s\n", latest_bill.is_paid ? "PAID" : "UNPAID");
-     printf("========================================\n");
+     debtor_index.count = 0;
+     for (int i = 0; i < customer_table.count; i++) {
+         DebtorEntry *entry = &debtor_index.entries[debtor_index.count];
+         customerDebt(i, entry);
+         if (entry->balance > 0) {
+             debtor_index.count++;
+         }
+     }
      
-     pauseScreen();
+     qsort(debtor_index.entries, debtor_index.count, sizeof(DebtorEntry), compareDebtors);
+     debtor_index.current = true;
  }
  
  /**
-  * Pay bill (Customer function)
-  * 
-  * Allows customers to make payments toward their bills.
-  * Supports both partial and full payments.
-  * Handles overpayments as credits toward future bills.
+  * Audit the bills
   * 
-  * Requires a registered payment card.
-  * Generates a receipt with payment details.
-  * Updates bill status and logs payment activity.
+  * Runs a report pass over bills.txt and checks the data kept in step with
+  * it: the paid and owing views must list the same bills and amounts, and
+  * each customer's unpaid bills and balance must match their premises
+  * ledger rows (and their archived view row once archived). Mismatches are
+  * counted, and the first few listed.
   */
- void payBill() {
-     clearScreen();
-     bool bill_found = false;
-     Bill latest_bill;
-     double payment_amount;
-     
-     printf("\n=== Pay Bill ===\n");
-     
-     // Check if customer has registered a payment card
-     if (!current_customer.has_payment_card) {
-         printf("You must register a payment card before making payments.\n");
-         printf("Please select 'Register Payment Card' from the menu first.\n");
-         pauseScreen();
+ void auditBills() {
+     printf("\n=== Bill Audit ===\n");
+     
+     double started = monotonicSeconds();
+     ReportPass pass;
+     if (!runReportPass(&pass)) {
+         printf("No bills found.\n");
+         releaseReportPass(&pass);
          return;
      }
+     double seconds = monotonicSeconds() - started;
+     printf("Scanned %ld bill(s) with %d worker(s) in %.3f second(s) (%.0f bills/sec)\n", pass.bills.count, pass.workers,
+            seconds, seconds > 0 ? pass.bills.count / seconds : 0.0);
+     
+     // Totals of the report views
+     int view_paid = 0, view_owing = 0;
+     Money view_paid_total = 0, view_owing_total = 0;
+     for (int i = 0; i < report_views.paid.count; i++) {
+         view_paid++;
+         view_paid_total += ((BillViewRow *)tableRow(&report_views.paid, i))->amount;
+     }
+     for (int i = 0; i < report_views.owing.count; i++) {
+         const BillViewRow *row = tableRow(&report_views.owing, i);
+         if (row->record >= 0) {
+             view_owing++;
+             view_owing_total += row->amount;
+         }
+     }
      
-     // Find the most recent unpaid bill for the customer
-     FILE *file = fopen(FILE_BILLS, "rb");
-     if (file != NULL) {
-         Bill bill;
-         time_t latest_time = 0;
-         
-         while (fread(&bill, sizeof(Bill), 1, file) == 1) {
-             if (strcmp(bill.customer_number, current_customer.customer_number) == 0 && !bill.is_paid) {
-                 bill_found = true;
-                 
-                 // Simple logic to find the most recent bill (based on month number)
-                 if (bill.month_number > latest_bill.month_number || latest_time == 0) {
-                     latest_bill = bill;
-                     latest_time = 1; // Just to mark that we found a bill
-                 }
+     int paid_bills = 0, owing_bills = 0;
+     Money paid_total = 0, owing_total = 0;
+     for (int i = 0; i < pass.customers.count; i++) {
+         const CustomerTotals *totals = tableRow(&pass.customers, i);
+         paid_bills += totals->paid_bills;
+         owing_bills += totals->owing_bills;
+         paid_total += totals->paid_total;
+         owing_total += totals->owing_balance;
+     }
+     
+     printf("\n%-22s %12s %16s %12s %16s\n", "", "Bills", "Amount", "View Rows", "View Amount");
+     printf("%-22s %12d %16.2f %12d %16.2f%s\n", "Paid", paid_bills, moneyToDouble(paid_total), view_paid,
+            moneyToDouble(view_paid_total), paid_bills == view_paid && paid_total == view_paid_total ? "" : "  MISMATCH");
+     printf("%-22s %12d %16.2f %12d %16.2f%s\n", "Owing", owing_bills, moneyToDouble(owing_total), view_owing,
+            moneyToDouble(view_owing_total), owing_bills == view_owing && owing_total == view_owing_total ? "" : "  MISMATCH");
+     
+     // Each customer's ledger rows and archived row against their bills
+     int mismatches = 0;
+     for (int i = 0; i < customer_table.count; i++) {
+         const Customer *customer = customerAt(i);
+         int unpaid = 0;
+         Money outstanding = 0;
+         for (int j = firstCustomerPremises(i); j >= 0; j = nextCustomerPremises(j)) {
+             unpaid += ledgerAt(j)->unpaid_count;
+             outstanding += ledgerAt(j)->outstanding;
+         }
+         
+         int cursor = -1;
+         int32_t position = hashIndexFind(&pass.by_customer, packNumber(customer->customer_number), &cursor);
+         const CustomerTotals *totals = position >= 0 ? tableRow(&pass.customers, position) : NULL;
+         int owing = totals != NULL ? totals->owing_bills : 0;
+         Money balance = totals != NULL ? totals->owing_balance : 0;
+         
+         bool matched = unpaid == owing && outstanding == balance;
+         Money archived_balance = balance;
+         if (!customer->is_active) {
+             cursor = -1;
+             int32_t archived_row = hashIndexFind(&report_views.archived_by_customer, packNumber(customer->customer_number), &cursor);
+             archived_balance = archived_row >= 0 ? ((ArchivedViewRow *)tableRow(&report_views.archived, archived_row))->balance : -1;
+             matched = matched && archived_balance == balance;
+         }
+         
+         if (!matched) {
+             if (mismatches < AUDIT_MAX_LISTED) {
+                 printf("Customer %s: %d unpaid bill(s) owing $%.2f, ledger %d owing $%.2f%s\n",
+                        customer->customer_number, owing, moneyToDouble(balance), unpaid, moneyToDouble(outstanding),
+                        archived_balance == balance ? "" : ", archived view differs");
              }
+             mismatches++;
          }
-         fclose(file);
      }
      
-     if (!bill_found) {
-         printf("No unpaid bills found for your account.\n");
-         pauseScreen();
-         return;
+     printf("\n%d customer(s) checked, %d mismatch(es)\n", customer_table.count, mismatches);
+     releaseReportPass(&pass);
+ }
+ 
+ /**
+  * Run a report pass over bills.txt
+  * 
+  * Splits the mapped bills into record-aligned slices scanned by a pool of
+  * worker threads. Each worker adds its bills to thread-local customer
+  * totals and paid/owing lists (see tallyReportBills), and the slices are
+  * merged in record order once every worker has finished, so the result is
+  * the same as one scan of the whole file. Customer names are joined
+  * through the customer number index once per customer and slice, so a
+  * pass is O(bills + customers). The report views are rebuilt from a pass.
+  * 
+  * @param pass - Receives the bills, totals and report lines (release with releaseReportPass)
+  * @return bool - True if bills.txt could be read
+  */
+ bool runReportPass(ReportPass *pass) {
+     memset(pass, 0, sizeof(ReportPass));
+     hashIndexInit(&pass->by_customer, customer_table.count);
+     tableInit(&pass->customers, sizeof(CustomerTotals));
+     tableInit(&pass->paid, sizeof(ReportLine));
+     tableInit(&pass->owing, sizeof(ReportLine));
+     pass->workers = 1;
+     
+     if (!mapRecordFile(FILE_BILLS, sizeof(Bill), &pass->bills)) {
+         return false;
      }
      
-     // Display bill summary
-     printf("Latest Unpaid Bill Summary:\n");
-     printf("Bill ID: %s\n", latest_bill.bill_id);
-     printf("Total Amount Due: $%.2f\n", latest_bill.total_amount_due);
-     printf("Amount Already Paid: $%.2f\n", latest_bill.amount_paid);
-     printf("Remaining Balance: $%.2f\n", latest_bill.total_amount_due - latest_bill.amount_paid);
+     int workers = workerCount();
+     if (workers > pass->bills.count / REPORT_MIN_SLICE) {
+         workers = pass->bills.count / REPORT_MIN_SLICE > 0 ? (int)(pass->bills.count / REPORT_MIN_SLICE) : 1;
+     }
+     pass->workers = workers;
      
-     // Get payment amount
-     printf("\nEnter payment amount: $");
-     scanf("%lf", &payment_amount);
-     getchar(); // Consume newline
+     if (workers == 1) {
+         tallyReportBills(pass, pass->bills.data, 0, pass->bills.count);
+         return true;
+     }
      
-     if (payment_amount <= 0) {
-         printf("Invalid payment amount. Must be greater than zero.\n");
-         pauseScreen();
-         return;
+     ReportSlice slices[MAX_WORKERS];
+     WorkerThread threads[MAX_WORKERS];
+     bool started_thread[MAX_WORKERS];
+     
+     for (int w = 0; w < workers; w++) {
+         ReportSlice *slice = &slices[w];
+         memset(slice, 0, sizeof(ReportSlice));
+         slice->bills = pass->bills.data;
+         slice->start = pass->bills.count * w / workers;
+         slice->end = pass->bills.count * (w + 1) / workers;
+         hashIndexInit(&slice->local.by_customer, customer_table.count / workers);
+         tableInit(&slice->local.customers, sizeof(CustomerTotals));
+         tableInit(&slice->local.paid, sizeof(ReportLine));
+         tableInit(&slice->local.owing, sizeof(ReportLine));
+         started_thread[w] = w > 0 && startWorker(&threads[w], reportWorker, slice);
      }
      
-     // Create payment
-     Payment payment;
-     generateID(payment.payment_id, "PMT");
-     strcpy(payment.bill_id, latest_bill.bill_id);
-     strcpy(payment.customer_number, current_customer.customer_number);
-     strcpy(payment.premises_number, latest_bill.premises_number);
-     payment.amount = payment_amount;
-     getCurrentDate(payment.payment_date);
+     // The calling thread takes the first slice, and any slice whose thread could not start
+     for (int w = 0; w < workers; w++) {
+         if (!started_thread[w]) {
+             reportWorker(&slices[w]);
+         }
+     }
      
-     // Update bill
-     latest_bill.amount_paid += payment_amount;
+     for (int w = 0; w < workers; w++) {
+         if (started_thread[w]) {
+             joinWorker(threads[w]);
+         }
+         mergeReportSlice(pass, &slices[w].local);
+         releaseReportPass(&slices[w].local);
+     }
      
-     // Check if bill is fully paid
-     if (latest_bill.amount_paid >= latest_bill.total_amount_due) {
-         latest_bill.is_paid = true;
+     return true;
+ }
+ 
+ // Scan one slice of a report pass into the slice's own totals and lines
+ WORKER_RESULT reportWorker(void *arg) {
+     ReportSlice *slice = arg;
+     tallyReportBills(&slice->local, slice->bills, slice->start, slice->end);
+     return WORKER_RETURN;
+ }
+ 
+ /**
+  * Add a range of bills to a report pass
+  * 
+  * Adds each bill to its customer's totals (found through a hash index keyed
+  * by the packed customer number, and reused while consecutive bills belong
+  * to the same customer) and to the list of paid or owing bills. Only the
+  * given pass is written, so slices can be tallied on separate threads.
+  * 
+  * @param pass - Pass (or slice-local pass) to add the bills to
+  * @param bills - Mapped bills.txt records
+  * @param start - First bill record to add
+  * @param end - One past the last bill record to add
+  */
+ void tallyReportBills(ReportPass *pass, const Bill *bills, long start, long end) {
+     uint32_t last_key = NUMBER_NONE;
+     int32_t position = -1;
+     
+     for (long k = start; k < end; k++) {
+         const Bill *bill = &bills[k];
+         uint32_t key = packNumber(bill->customer_number);
+         if (position < 0 || key != last_key) {
+             position = reportCustomerTotals(pass, bill->customer_number);
+             last_key = key;
+         }
          
-         // Handle overpayment (credit for next bill)
-         double overpayment = latest_bill.amount_paid - latest_bill.total_amount_due;
-         if (overpayment > 0) {
-             printf("Overpayment of $%.2f will be credited to your next bill.\n", overpayment);
-             // The overpayment will be handled when generating the next bill
+         CustomerTotals *totals = tableRow(&pass->customers, position);
+         ReportLine *line;
+         if (bill->is_paid) {
+             totals->paid_bills++;
+             totals->paid_total += moneyFromDouble(bill->amount_paid);
+             line = tableAppend(&pass->paid);
+         } else {
+             totals->owing_bills++;
+             totals->owing_balance += billBalance(bill);
+             line = tableAppend(&pass->owing);
          }
+         line->record = (int32_t)k;
+         line->totals = position;
+     }
+ }
+ 
+ /**
+  * Merge a slice into a report pass
+  * 
+  * Adds the slice's customer totals to the pass's (adding customers the pass
+  * has not seen) and appends the slice's paid and owing lines with their
+  * totals rows translated. Merging the slices in order keeps the lines in
+  * record order.
+  * 
+  * @param pass - Report pass to merge into
+  * @param local - Tallied slice-local pass
+  */
+ void mergeReportSlice(ReportPass *pass, ReportPass *local) {
+     int32_t *merged_row = malloc(sizeof(int32_t) * (local->customers.count > 0 ? local->customers.count : 1));
+     if (merged_row == NULL) {
+         printf("Error: Out of memory while merging report totals.\n");
+         exit(1);
      }
      
-     // Save payment to file
-     file = fopen(FILE_PAYMENTS, "ab");
-     if (file != NULL) {
-         fwrite(&payment, sizeof(Payment), 1, file);
-         fclose(file);
-         
-         // Update bill in file
-         FILE *bill_file = fopen(FILE_BILLS, "rb");
-         FILE *temp_file = fopen("temp_bills.txt", "wb");
+     for (int i = 0; i < local->customers.count; i++) {
+         const CustomerTotals *source = tableRow(&local->customers, i);
+         int cursor = -1;
+         int32_t position = hashIndexFind(&pass->by_customer, source->customer_key, &cursor);
          
-         if (bill_file != NULL && temp_file != NULL) {
-             Bill bill;
-             while (fread(&bill, sizeof(Bill), 1, bill_file) == 1) {
-                 if (strcmp(bill.bill_id, latest_bill.bill_id) == 0) {
-                     fwrite(&latest_bill, sizeof(Bill), 1, temp_file);
-                 } else {
-                     fwrite(&bill, sizeof(Bill), 1, temp_file);
-                 }
-             }
-             fclose(bill_file);
-             fclose(temp_file);
-             
-             remove(FILE_BILLS);
-             rename("temp_bills.txt", FILE_BILLS);
-             
-             // Log the payment
-             logActivity(current_customer.customer_number, payment_amount, false);
-             
-             // Display receipt
-             clearScreen();
-             printf("\n========= PAYMENT RECEIPT =========\n");
-             printf("Receipt ID: %s\n", payment.payment_id);
-             printf("Date: %s\n", payment.payment_date);
-             printf("Customer: %s %s\n", current_customer.first_name, current_customer.last_name);
-             printf("Customer Number: %s\n", payment.customer_number);
-             printf("Premises Number: %s\n", payment.premises_number);
-             printf("Bill ID: %s\n", payment.bill_id);
-             printf("Payment Amount: $%.2f\n", payment.amount);
-             printf("Remaining Balance: $%.2f\n", latest_bill.total_amount_due - latest_bill.amount_paid);
-             printf("Status: %s\n", latest_bill.is_paid ? "PAID IN FULL" : "PARTIALLY PAID");
-             printf("==================================\n");
-             
-             printf("\nPayment processed successfully!\n");
+         if (position < 0) {
+             position = pass->customers.count;
+             memcpy(tableAppend(&pass->customers), source, sizeof(CustomerTotals));
+             hashIndexInsert(&pass->by_customer, source->customer_key, position);
          } else {
-             printf("Error: Could not update bill data.\n");
+             CustomerTotals *totals = tableRow(&pass->customers, position);
+             totals->paid_bills += source->paid_bills;
+             totals->owing_bills += source->owing_bills;
+             totals->paid_total += source->paid_total;
+             totals->owing_balance += source->owing_balance;
          }
-     } else {
-         printf("Error: Could not save payment data.\n");
+         merged_row[i] = position;
      }
      
-     pauseScreen();
+     for (int i = 0; i < local->paid.count; i++) {
+         const ReportLine *line = tableRow(&local->paid, i);
+         ReportLine *merged = tableAppend(&pass->paid);
+         merged->record = line->record;
+         merged->totals = merged_row[line->totals];
+     }
+     for (int i = 0; i < local->owing.count; i++) {
+         const ReportLine *line = tableRow(&local->owing, i);
+         ReportLine *merged = tableAppend(&pass->owing);
+         merged->record = line->record;
+         merged->totals = merged_row[line->totals];
+     }
+     
+     free(merged_row);
  }
  
- // Surrender meter (Customer function)
- void surrenderMeter() {
-     clearScreen();
-     char premises_number[8];
-     bool premises_found = false;
-     int premises_index = -1;
+ // Find the report totals of a customer, adding them (with the customer's row) on first use
+ int32_t reportCustomerTotals(ReportPass *pass, const char *customer_number) {
+     uint32_t key = packNumber(customer_number);
+     int cursor = -1;
+     int32_t position = hashIndexFind(&pass->by_customer, key, &cursor);
+     
+     if (position < 0) {
+         position = pass->customers.count;
+         CustomerTotals *totals = tableAppend(&pass->customers);
+         totals->customer_key = key;
+         totals->customer_row = findCustomerRow(customer_number, false);
+         hashIndexInsert(&pass->by_customer, key, position);
+     }
      
-     printf("\n=== Surrender Meter ===\n");
-     printf("Enter Premises Number to surrender: ");
-     fgets(premises_number, 8, stdin);
-     premises_number[strcspn(premises_number, "\n")] = '\0';
+     return position;
+ }
+ 
+ // Release the bills, index and tables of a report pass
+ void releaseReportPass(ReportPass *pass) {
+     unmapRecordFile(&pass->bills);
+     hashIndexFree(&pass->by_customer);
+     tableInit(&pass->customers, sizeof(CustomerTotals));
+     tableInit(&pass->paid, sizeof(ReportLine));
+     tableInit(&pass->owing, sizeof(ReportLine));
+ }
+ 
+ // Export a report or billing history to a file (Agent function)
+ void exportReports() {
+     char input[260];
+     char customer_number[8] = "";
      
-     // Find premises in array
-     for (int i = 0; i < premises_count; i++) {
-         if (strcmp(premises[i].premises_number, premises_number) == 0 && 
-             strcmp(premises[i].customer_number, current_customer.customer_number) == 0 && 
-             premises[i].is_active) {
-             premises_found = true;
-             premises_index = i;
-             break;
-         }
-     }
+     printf("\n=== Export Data ===\n");
+     printf("1. Paid Customers\n");
+     printf("2. Owing Customers\n");
+     printf("3. Deleted/Archived Customers\n");
+     printf("4. Customer Billing History\n");
+     printf("5. All Billing History\n");
+     printf("Please enter your choice: ");
+     fgets(input, sizeof(input), stdin);
+     int dataset = atoi(input);
      
-     if (!premises_found) {
-         printf("Premises not found, not associated with your account, or already inactive.\n");
-         pauseScreen();
+     if (dataset < EXPORT_PAID || dataset > EXPORT_BILLS) {
+         printf("Invalid choice.\n");
          return;
      }
      
-     // Check for unpaid bills
-     bool has_unpaid_bills = false;
-     FILE *file = fopen(FILE_BILLS, "rb");
-     if (file != NULL) {
-         Bill bill;
-         while (fread(&bill, sizeof(Bill), 1, file) == 1) {
-             if (strcmp(bill.customer_number, current_customer.customer_number) == 0 && 
-                 strcmp(bill.premises_number, premises_number) == 0 && 
-                 !bill.is_paid) {
-                 has_unpaid_bills = true;
-                 break;
-             }
+     if (dataset == EXPORT_CUSTOMER) {
+         printf("Enter Customer Number: ");
+         fgets(input, sizeof(input), stdin);
+         input[strcspn(input, "\n")] = '\0';
+         if (findCustomerRow(input, false) < 0) {
+             printf("Customer not found.\n");
+             return;
          }
-         fclose(file);
+         strcpy(customer_number, input);
      }
      
-     if (has_unpaid_bills) {
-         printf("Cannot surrender meter: You have unpaid bills for this premises.\n");
-         printf("Please pay all outstanding bills before surrendering the meter.\n");
-         pauseScreen();
+     printf("Format (1. CSV, 2. JSON): ");
+     fgets(input, sizeof(input), stdin);
+     int format = atoi(input);
+     if (format != 1 && format != 2) {
+         printf("Invalid format.\n");
          return;
      }
      
-     // Deactivate premises
-     premises[premises_index].is_active = false;
-     
-     // Update premises in file
-     file = fopen(FILE_PREMISES, "wb");
-     if (file != NULL) {
-         for (int i = 0; i < premises_count; i++) {
-             fwrite(&premises[i], sizeof(Premises), 1, file);
-         }
-         fclose(file);
-         
-         // Log the surrender
-         logActivity(current_customer.customer_number, 0.0, true);
-         
-         printf("Meter surrendered successfully!\n");
-     } else {
-         printf("Error: Could not update premises data.\n");
+     printf("Export to file: ");
+     fgets(input, sizeof(input), stdin);
+     input[strcspn(input, "\n")] = '\0';
+     if (input[0] == '\0') {
+         printf("Error: A file name is required.\n");
+         return;
      }
      
-     pauseScreen();
+     long rows = 0;
+     if (exportDataset((ExportDataset)dataset, format == 2 ? EXPORT_JSON : EXPORT_CSV, input, customer_number, &rows)) {
+         printf("Exported %ld row(s) to %s.\n", rows, input);
+     }
  }
  
- // Load data from files
- void loadData() {
-     // Load customers
-     FILE *file = fopen(FILE_CUSTOMERS, "rb");
-     if (file != NULL) {
-         customer_count = 0;
-         while (fread(&customers[customer_count], sizeof(Customer), 1, file) == 1) {
-             customer_count++;
-             if (customer_count >= MAX_CUSTOMERS) {
-                 break;
-             }
+ /**
+  * Run the headless export command
+  * 
+  * Usage: --export DATASET csv|json FILE [--customer NUMBER] [--data DIR]
+  * where DATASET is paid, owing, archived, customer or bills. FILE may be
+  * "-" for standard output, so an export can be piped into another program
+  * (messages go to standard error).
+  * 
+  * @param argc - Argument count
+  * @param argv - Arguments
+  * @return int - Exit code (0 if the data set was exported)
+  */
+ int exportCommand(int argc, char *argv[]) {
+     ExportDataset dataset = EXPORT_PAID;
+     const char *customer_number = "";
+     const char *data_directory = NULL;
+     bool valid = argc >= 5 && parseExportDataset(argv[2], &dataset) &&
+                  (strcmp(argv[3], "csv") == 0 || strcmp(argv[3], "json") == 0);
+     
+     for (int i = 5; i < argc && valid; i += 2) {
+         if (i + 1 >= argc) {
+             valid = false;
+         } else if (strcmp(argv[i], "--customer") == 0) {
+             customer_number = argv[i + 1];
+         } else if (strcmp(argv[i], "--data") == 0) {
+             data_directory = argv[i + 1];
+         } else {
+             valid = false;
          }
-         fclose(file);
      }
+     valid = valid && (dataset == EXPORT_CUSTOMER) == (customer_number[0] != '\0');
      
-     // Load premises
-     file = fopen(FILE_PREMISES, "rb");
-     if (file != NULL) {
-         premises_count = 0;
-         while (fread(&premises[premises_count], sizeof(Premises), 1, file) == 1) {
-             premises_count++;
-             if (premises_count >= MAX_PREMISES) {
-                 break;
-             }
-         }
-         fclose(file);
+     if (!valid) {
+         fprintf(stderr, "Usage: %s --export paid|owing|archived|customer|bills csv|json FILE [--customer NUMBER] [--data DIR]\n", argv[0]);
+         return 1;
      }
      
-     // Create designated agent accounts if they don't exist
-     bool admin_exists = false;
-     bool agent_exists = false;
-     file = fopen(FILE_USERS, "rb");
-     if (file != NULL) {
-         User user;
-         while (fread(&user, sizeof(User), 1, file) == 1) {
-             if (user.type == AGENT && strcmp(user.email, "admin@nwc.com") == 0) {
-                 admin_exists = true;
-             }
-             if (user.type == AGENT && strcmp(user.email, "agent@nwc.com") == 0) {
-                 agent_exists = true;
-             }
-         }
-         fclose(file);
+     #ifdef _WIN32
+         if (data_directory != NULL && _chdir(data_directory) != 0) {
+     #else
+         if (data_directory != NULL && chdir(data_directory) != 0) {
+     #endif
+         fprintf(stderr, "Error: Could not open data directory %s.\n", data_directory);
+         return 1;
      }
      
-     file = fopen(FILE_USERS, "ab");
-     if (file != NULL) {
-         // Create admin account
-         if (!admin_exists) {
-             User admin;
-             admin.id = 1;
-             strcpy(admin.email, "admin@nwc.com");
-             strcpy(admin.password, "admin123");
-             admin.type = AGENT;
-             admin.is_active = true;
-             fwrite(&admin, sizeof(User), 1, file);
-         }
-         
-         // Create agent account
-         if (!agent_exists) {
-             User agent;
-             agent.id = 2;
-             strcpy(agent.email, "agent@nwc.com");
-             strcpy(agent.password, "agent123");
-             agent.type = AGENT;
-             agent.is_active = true;
-             fwrite(&agent, sizeof(User), 1, file);
-         }
-         
-         fclose(file);
+     // Keep standard output for the export itself while the data loads
+     bool to_stdout = strcmp(argv[4], "-") == 0;
+     int console = -1;
+     if (to_stdout) {
+         fflush(stdout);
+         #ifdef _WIN32
+             console = _dup(_fileno(stdout));
+             _dup2(_fileno(stderr), _fileno(stdout));
+         #else
+             console = dup(STDOUT_FILENO);
+             dup2(STDERR_FILENO, STDOUT_FILENO);
+         #endif
+     }
+     initializeSystem();
+     if (console >= 0) {
+         fflush(stdout);
+         #ifdef _WIN32
+             _dup2(console, _fileno(stdout));
+             _close(console);
+         #else
+             dup2(console, STDOUT_FILENO);
+             close(console);
+         #endif
      }
      
-     printf("Agent Login Credentials:\n");
-     printf("Email: admin@nwc.com\nPassword: admin123\n\n");
-     printf("Email: agent@nwc.com\nPassword: agent123\n\n");
- }
- 
- // Save data to files
- void saveData() {
-     // Save customers
-     FILE *file = fopen(FILE_CUSTOMERS, "wb");
-     if (file != NULL) {
-         for (int i = 0; i < customer_count; i++) {
-             fwrite(&customers[i], sizeof(Customer), 1, file);
-         }
-         fclose(file);
+     if (dataset == EXPORT_CUSTOMER && findCustomerRow(customer_number, false) < 0) {
+         fprintf(stderr, "Error: Customer %s not found.\n", customer_number);
+         return 1;
      }
      
-     // Save premises
-     file = fopen(FILE_PREMISES, "wb");
-     if (file != NULL) {
-         for (int i = 0; i < premises_count; i++) {
-             fwrite(&premises[i], sizeof(Premises), 1, file);
-         }
-         fclose(file);
+     long rows = 0;
+     bool exported = exportDataset(dataset, strcmp(argv[3], "json") == 0 ? EXPORT_JSON : EXPORT_CSV, argv[4], customer_number, &rows);
+     if (exported) {
+         fprintf(to_stdout ? stderr : stdout, "Exported %ld row(s).\n", rows);
      }
+     return exported ? 0 : 1;
  }
  
- // Generate a unique ID with prefix (e.g., BILL-1234)
- void generateID(char *id, const char *prefix) {
-     int random_num = rand() % 10000;
-     char timestamp[10];
-     time_t t = time(NULL);
-     struct tm *tm_info = localtime(&t);
+ // Look up an export data set by its command line name
+ bool parseExportDataset(const char *name, ExportDataset *dataset) {
+     const char *names[] = { "paid", "owing", "archived", "customer", "bills" };
      
-     strftime(timestamp, 10, "%H%M%S", tm_info);
-     sprintf(id, "%s-%d-%s", prefix, random_num, timestamp);
+     for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+         if (strcmp(name, names[i]) == 0) {
+             *dataset = (ExportDataset)(EXPORT_PAID + i);
+             return true;
+         }
+     }
+     return false;
+ }
+ 
+ /**
+  * Export a data set
+  * 
+  * Streams the rows of a report or billing history to a CSV or JSON file
+  * through a buffered writer. Bills are read straight from the mapped
+  * bills.txt and written as they are read, so memory use does not grow
+  * with the number of rows. Errors go to standard error, since standard
+  * output may be the export itself.
+  * 
+  * @param dataset - Data set to export
+  * @param format - CSV or JSON
+  * @param filename - File to write ("-" for standard output)
+  * @param customer_number - Customer whose history to export (EXPORT_CUSTOMER only)
+  * @param rows - Receives the number of rows written
+  * @return bool - True if every row was written
+  */
+ bool exportDataset(ExportDataset dataset, ExportFormat format, const char *filename, const char *customer_number, long *rows) {
+     Exporter exporter;
+     *rows = 0;
+     
+     if (!exportOpen(&exporter, filename, format)) {
+         fprintf(stderr, "Error: Could not open %s for writing.\n", filename);
+         return false;
+     }
+     
+     bool found = exportRows(&exporter, dataset, customer_number);
+     *rows = exporter.rows;
+     bool written = exportClose(&exporter);
+     if (!found) {
+         fprintf(stderr, "Error: Customer %s not found.\n", customer_number);
+     } else if (!written) {
+         fprintf(stderr, "Error: Could not write %s.\n", filename);
+     }
+     return found && written;
+ }
+ 
+ // Write the rows of a data set to an open export (false if the customer of EXPORT_CUSTOMER is not found)
+ bool exportRows(Exporter *exporter, ExportDataset dataset, const char *customer_number) {
+     switch (dataset) {
+         case EXPORT_PAID:
+         case EXPORT_OWING:
+             exportBillReport(exporter, dataset == EXPORT_PAID);
+             return true;
+         case EXPORT_ARCHIVED:
+             exportArchivedReport(exporter);
+             return true;
+         case EXPORT_CUSTOMER:
+             return exportBillingHistory(exporter, customer_number);
+         case EXPORT_BILLS:
+             exportBillingHistory(exporter, NULL);
+             return true;
+     }
+     return false;
+ }
+ 
+ // Export the paid bills (amount paid) or unpaid bills (balance owing) in record order
+ void exportBillReport(Exporter *exporter, bool paid) {
+     static const char *const columns[] = { "customer_number", "premises_number", "name", "month", "amount" };
+     exportColumns(exporter, columns, 5);
+     
+     MappedFile bills;
+     if (!mapRecordFile(FILE_BILLS, sizeof(Bill), &bills)) {
+         return;
+     }
+     
+     // Consecutive bills usually share a customer, so the name join is cached
+     uint32_t last_key = NUMBER_NONE;
+     char full_name[MAX_NAME_LENGTH * 2 + 1] = "";
+     
+     for (long k = 0; k < bills.count; k++) {
+         const Bill *bill = (const Bill *)bills.data + k;
+         if (bill->is_paid != paid) {
+             continue;
+         }
+         
+         uint32_t key = packNumber(bill->customer_number);
+         if (key != last_key) {
+             int customer_row = findCustomerRow(bill->customer_number, false);
+             full_name[0] = '\0';
+             if (customer_row >= 0) {
+                 sprintf(full_name, "%s %s", customerAt(customer_row)->first_name, customerAt(customer_row)->last_name);
+             }
+             last_key = key;
+         }
+         
+         exportBeginRow(exporter);
+         exportText(exporter, bill->customer_number);
+         exportText(exporter, bill->premises_number);
+         exportText(exporter, full_name);
+         exportInt(exporter, bill->month_number);
+         exportMoney(exporter, paid ? moneyFromDouble(bill->amount_paid) : billBalance(bill));
+         exportEndRow(exporter);
+     }
+     unmapRecordFile(&bills);
+ }
+ 
+ // Export the archived customers with their premises and balances from the archived view
+ void exportArchivedReport(Exporter *exporter) {
+     static const char *const columns[] = { "customer_number", "premises", "name", "balance", "archive_date" };
+     exportColumns(exporter, columns, 5);
+     
+     for (int i = 0; i < report_views.archived.count; i++) {
+         const ArchivedViewRow *row = tableRow(&report_views.archived, i);
+         int customer_row = findCustomerRow(row->customer_number, false);
+         if (customer_row < 0) {
+             continue;
+         }
+         
+         char premises_list[100] = "";
+         for (int j = firstCustomerPremises(customer_row); j >= 0; j = nextCustomerPremises(j)) {
+             if (strlen(premises_list) + 9 <= sizeof(premises_list)) {
+                 if (premises_list[0] != '\0') {
+                     strcat(premises_list, " ");
+                 }
+                 strcat(premises_list, premisesAt(j)->premises_number);
+             }
+         }
+         
+         exportBeginRow(exporter);
+         exportText(exporter, row->customer_number);
+         exportText(exporter, premises_list);
+         exportText(exporter, customerAt(customer_row)->first_name);
+         exportMoney(exporter, row->balance);
+         exportText(exporter, row->archive_date);
+         exportEndRow(exporter);
+     }
+ }
+ 
+ /**
+  * Export a billing history
+  * 
+  * Writes the bills of one customer (the billing history shown with the
+  * customer's details, found through the bill index) or every bill in
+  * bills.txt in record order.
+  * 
+  * @param exporter - Export in progress
+  * @param customer_number - Customer to export, or NULL for every customer
+  * @return bool - False if the customer does not exist
+  */
+ bool exportBillingHistory(Exporter *exporter, const char *customer_number) {
+     static const char *const columns[] = { "bill_id", "customer_number", "premises_number", "month", "year",
+                                            "consumption", "total_amount_due", "amount_paid", "balance", "status",
+                                            "bill_date", "due_date" };
+     exportColumns(exporter, columns, 12);
+     
+     if (customer_number != NULL && findCustomerRow(customer_number, false) < 0) {
+         return false;
+     }
+     
+     MappedFile bills;
+     if (!mapRecordFile(FILE_BILLS, sizeof(Bill), &bills)) {
+         return true;
+     }
+     
+     if (customer_number == NULL) {
+         for (long k = 0; k < bills.count; k++) {
+             exportBillRow(exporter, (const Bill *)bills.data + k);
+         }
+     } else {
+         int32_t *records = NULL;
+         int record_count = collectCustomerBillRecords(customer_number, &records);
+         for (int i = 0; i < record_count; i++) {
+             if (records[i] < bills.count) {
+                 exportBillRow(exporter, (const Bill *)bills.data + records[i]);
+             }
+         }
+         free(records);
+     }
+     
+     unmapRecordFile(&bills);
+     return true;
+ }
+ 
+ // Export one bill as a billing history row
+ void exportBillRow(Exporter *exporter, const Bill *bill) {
+     exportBeginRow(exporter);
+     exportText(exporter, bill->bill_id);
+     exportText(exporter, bill->customer_number);
+     exportText(exporter, bill->premises_number);
+     exportInt(exporter, bill->month_number);
+     exportInt(exporter, bill->year);
+     exportInt(exporter, bill->consumption);
+     exportMoney(exporter, moneyFromDouble(bill->total_amount_due));
+     exportMoney(exporter, moneyFromDouble(bill->amount_paid));
+     exportMoney(exporter, billBalance(bill));
+     exportText(exporter, bill->is_paid ? "PAID" : "UNPAID");
+     exportText(exporter, bill->bill_date);
+     exportText(exporter, bill->due_date);
+     exportEndRow(exporter);
+ }
+ 
+ // Start an export to a file ("-" for standard output)
+ bool exportOpen(Exporter *exporter, const char *filename, ExportFormat format) {
+     memset(exporter, 0, sizeof(Exporter));
+     exporter->format = format;
+     return writerOpen(&exporter->writer, filename);
+ }
+ 
+ // Set the columns of an export and write the CSV header row or opening JSON bracket
+ void exportColumns(Exporter *exporter, const char *const *columns, int count) {
+     exporter->columns = columns;
+     exporter->column_count = count;
+     
+     if (exporter->format == EXPORT_JSON) {
+         writerChar(&exporter->writer, '[');
+         return;
+     }
+     for (int i = 0; i < count; i++) {
+         if (i > 0) {
+             writerChar(&exporter->writer, ',');
+         }
+         writerQuoted(&exporter->writer, columns[i], EXPORT_CSV);
+     }
+     writerChar(&exporter->writer, '\n');
+ }
+ 
+ // Start a row of an export
+ void exportBeginRow(Exporter *exporter) {
+     if (exporter->format == EXPORT_JSON) {
+         writerBytes(&exporter->writer, exporter->rows > 0 ? ",\n{" : "\n{", exporter->rows > 0 ? 3 : 2);
+     }
+     exporter->field = 0;
+ }
+ 
+ // Write the separator before the next field of a row and, for JSON, its name
+ void exportKey(Exporter *exporter) {
+     if (exporter->field > 0) {
+         writerChar(&exporter->writer, ',');
+     }
+     if (exporter->format == EXPORT_JSON && exporter->field < exporter->column_count) {
+         writerQuoted(&exporter->writer, exporter->columns[exporter->field], EXPORT_JSON);
+         writerChar(&exporter->writer, ':');
+     }
+     exporter->field++;
+ }
+ 
+ // Write a text field
+ void exportText(Exporter *exporter, const char *text) {
+     exportKey(exporter);
+     writerQuoted(&exporter->writer, text, exporter->format);
+ }
+ 
+ // Write an integer field
+ void exportInt(Exporter *exporter, int64_t value) {
+     exportKey(exporter);
+     writerInt(&exporter->writer, value);
+ }
+ 
+ // Write a money field as a decimal dollar amount
+ void exportMoney(Exporter *exporter, Money amount) {
+     exportKey(exporter);
+     writerMoney(&exporter->writer, amount);
+ }
+ 
+ // Finish a row of an export
+ void exportEndRow(Exporter *exporter) {
+     writerChar(&exporter->writer, exporter->format == EXPORT_JSON ? '}' : '\n');
+     exporter->rows++;
+ }
+ 
+ // Close the JSON array, then flush and close the export file
+ bool exportClose(Exporter *exporter) {
+     if (exporter->format == EXPORT_JSON) {
+         writerBytes(&exporter->writer, "\n]\n", 3);
+     }
+     return writerClose(&exporter->writer);
+ }
+ 
+ /**
+  * Register a payment card (Customer function)
+  * 
+  * Allows customers to register a payment card for bill payments.
+  * A customer must register a card before making any bill payments.
+  * 
+  * Stores basic card identifier (not full card details for security).
+  * Updates customer record to indicate card registration.
+  */
+ void registerPaymentCard() {
+     clearScreen();
+     PaymentCard card;
+     char card_identifier[20];
+     
+     printf("\n=== Register Payment Card ===\n");
+     
+     // Check if customer already has a registered card
+     if (console.customer.has_payment_card) {
+         printf("You already have a registered payment card.\n");
+         pauseScreen();
+         return;
+     }
+     
+     printf("Enter Card Identifier (e.g., last 4 digits): ");
+     fgets(card_identifier, 20, stdin);
+     card_identifier[strcspn(card_identifier, "\n")] = '\0';
+     
+     // Create payment card
+     strcpy(card.customer_number, console.customer.customer_number);
+     strcpy(card.card_identifier, card_identifier);
+     card.is_active = true;
+     
+     // Save payment card to file
+     FILE *file = openAppend(FILE_PAYMENT_CARDS);
+     if (file != NULL) {
+         fwrite(&card, sizeof(PaymentCard), 1, file);
+         fclose(file);
+         
+         // Update customer's has_payment_card flag
+         int customer_row = findCustomerRow(console.customer.customer_number, false);
+         if (customer_row >= 0) {
+             Customer updated = *customerAt(customer_row);
+             updated.has_payment_card = true;
+             journalStage(JOURNAL_CUSTOMERS, customer_row, &updated, sizeof(Customer));
+         }
+         
+         if (journalCommit()) {
+             console.customer.has_payment_card = true;
+             printf("Payment card registered successfully!\n");
+         } else {
+             printf("Error: Could not update customer data.\n");
+         }
+     } else {
+         printf("Error: Could not save payment card data.\n");
+     }
+     
+     pauseScreen();
+ }
+ 
+ // View bill (Customer function)
+ void viewBill() {
+     clearScreen();
+     bool bill_found = false;
+     Bill latest_bill;
+     
+     printf("\n=== View Bill ===\n");
+     
+     // Find the most recent bill for the customer (bills are appended in billing order)
+     int32_t *records = NULL;
+     int record_count = collectCustomerBillRecords(console.customer.customer_number, &records);
+     if (record_count > 0) {
+         FILE *file = fopen(FILE_BILLS, "rb");
+         if (file != NULL) {
+             bill_found = readBillRecord(file, records[record_count - 1], &latest_bill);
+             fclose(file);
+         }
+     }
+     free(records);
+     
+     if (!bill_found) {
+         printf("No bills found for your account.\n");
+         pauseScreen();
+         return;
+     }
+     
+     // Find premises details
+     char meter_size_str[10] = "";
+     int premises_row = findPremisesRow(latest_bill.premises_number, false);
+     if (premises_row >= 0) {
+         switch (premisesAt(premises_row)->meter_size) {
+             case METER_15MM:
+                 strcpy(meter_size_str, "15mm");
+                 break;
+             case METER_30MM:
+                 strcpy(meter_size_str, "30mm");
+                 break;
+             case METER_150MM:
+                 strcpy(meter_size_str, "150mm");
+                 break;
+         }
+     }
+     
+     // Display bill details
+     printf("\n======= NATIONAL WATER COMMISSION =======\n");
+     printf("Bill ID: %s\n", latest_bill.bill_id);
+     printf("Customer: %s %s\n", console.customer.first_name, console.customer.last_name);
+     printf("Customer Number: %s\n", latest_bill.customer_number);
+     printf("Premises Number: %s\n", latest_bill.premises_number);
+     printf("Meter Size: %s\n", meter_size_str);
+     printf("Bill Date: %s\n", latest_bill.bill_date);
+     printf("Due Date: %s\n", latest_bill.due_date);
+     printf("\n--- Meter Readings ---\n");
+     printf("Previous Reading: %d\n", latest_bill.previous_reading);
+     printf("Current Reading: %d\n", latest_bill.current_reading);
+     printf("Consumption: %d litres\n", latest_bill.consumption);
+     printf("\n--- Charges ---\n");
+     printf("Water Charge: $%.2f\n", latest_bill.water_charge);
+     printf("Sewerage Charge: $%.2f\n", latest_bill.sewerage_charge);
+     printf("Service Charge: $%.2f\n", latest_bill.service_charge);
+     printf("PAM: $%.2f\n", latest_bill.pam);
+     printf("X-Factor: $%.2f\n", latest_bill.x_factor);
+     printf("K-Factor: $%.2f\n", latest_bill.k_factor);
+     printf("Total Current Charges: $%.2f\n", latest_bill.total_current_charges);
+     
+     if (latest_bill.is_early_payment_eligible) {
+         printf("Early Payment Discount: $%.2f\n", latest_bill.early_payment_amount);
+     }
+     
+     if (latest_bill.overdue_amount > 0) {
+         printf("Overdue Amount: $%.2f\n", latest_bill.overdue_amount);
+     } else if (latest_bill.overdue_amount < 0) {
+         printf("Credit Applied: $%.2f\n", -latest_bill.overdue_amount);
+     }
+     
+     printf("\nTotal Amount Due: $%.2f\n", latest_bill.total_amount_due);
+     
+     if (latest_bill.amount_paid > 0) {
+         printf("Amount Paid: $%.2f\n", latest_bill.amount_paid);
+         printf("Balance: $%.2f\n", moneyToDouble(billBalance(&latest_bill)));
+     }
+     
+     printf("\nPayment Status: %s\n", latest_bill.is_paid ? "PAID" : "UNPAID");
+     printf("========================================\n");
+     
+     pauseScreen();
+ }
+ 
+ /**
+  * Pay bill (Customer function)
+  * 
+  * Allows customers to make payments toward their bills.
+  * Supports both partial and full payments.
+  * Handles overpayments as credits toward future bills.
+  * 
+  * Requires a registered payment card.
+  * Generates a receipt with payment details.
+  * Updates bill status and logs payment activity.
+  */
+ void payBill() {
+     clearScreen();
+     Bill latest_bill;
+     Money payment_amount;
+     char amount_input[32];
+     
+     printf("\n=== Pay Bill ===\n");
+     
+     // Check if customer has registered a payment card
+     if (!console.customer.has_payment_card) {
+         printf("You must register a payment card before making payments.\n");
+         printf("Please select 'Register Payment Card' from the menu first.\n");
+         pauseScreen();
+         return;
+     }
+     
+     // Find the most recent unpaid bill for the customer
+     int32_t latest_record = findLatestUnpaidBill(console.customer.customer_number, &latest_bill);
+     
+     if (latest_record < 0) {
+         printf("No unpaid bills found for your account.\n");
+         pauseScreen();
+         return;
+     }
+     
+     // Display bill summary
+     printf("Latest Unpaid Bill Summary:\n");
+     printf("Bill ID: %s\n", latest_bill.bill_id);
+     printf("Total Amount Due: $%.2f\n", latest_bill.total_amount_due);
+     printf("Amount Already Paid: $%.2f\n", latest_bill.amount_paid);
+     printf("Remaining Balance: $%.2f\n", moneyToDouble(billBalance(&latest_bill)));
+     
+     // Get payment amount (dollars with at most two decimal places)
+     printf("\nEnter payment amount: $");
+     fgets(amount_input, sizeof(amount_input), stdin);
+     
+     if (!parseMoney(amount_input, &payment_amount)) {
+         printf("Invalid payment amount. Enter dollars and cents, e.g. 1250.75.\n");
+         pauseScreen();
+         return;
+     }
+     
+     if (payment_amount <= 0) {
+         printf("Invalid payment amount. Must be greater than zero.\n");
+         pauseScreen();
+         return;
+     }
+     
+     // Handle overpayment (the ledger carries the credit until the next bill is generated)
+     Money balance = billBalance(&latest_bill);
+     if (payment_amount > balance) {
+         printf("Overpayment of $%.2f will be credited to your next bill.\n", moneyToDouble(payment_amount - balance));
+     }
+     
+     Payment payment;
+     Bill paid_bill;
+     const char *error = savePayment(console.customer.customer_number, latest_record, &latest_bill, payment_amount, &payment, &paid_bill);
+     
+     if (error == NULL) {
+         // Display receipt
+         clearScreen();
+         printf("\n========= PAYMENT RECEIPT =========\n");
+         printf("Receipt ID: %s\n", payment.payment_id);
+         printf("Date: %s\n", payment.payment_date);
+         printf("Customer: %s %s\n", console.customer.first_name, console.customer.last_name);
+         printf("Customer Number: %s\n", payment.customer_number);
+         printf("Premises Number: %s\n", payment.premises_number);
+         printf("Bill ID: %s\n", payment.bill_id);
+         printf("Payment Amount: $%.2f\n", payment.amount);
+         printf("Remaining Balance: $%.2f\n", moneyToDouble(billBalance(&paid_bill)));
+         printf("Status: %s\n", paid_bill.is_paid ? "PAID IN FULL" : "PARTIALLY PAID");
+         printf("==================================\n");
+         
+         printf("\nPayment processed successfully!\n");
+     } else {
+         printf("Error: %s\n", error);
+     }
+     
+     pauseScreen();
+ }
+ 
+ // Find the most recent unpaid bill of a customer (newest record first); returns its record, or -1 if none
+ int32_t findLatestUnpaidBill(const char *customer_number, Bill *bill) {
+     int32_t latest_record = -1;
+     int32_t *records = NULL;
+     int record_count = collectCustomerBillRecords(customer_number, &records);
+     FILE *file = record_count > 0 ? fopen(FILE_BILLS, "rb") : NULL;
+     
+     if (file != NULL) {
+         for (int i = record_count - 1; i >= 0 && latest_record < 0; i--) {
+             if (readBillRecord(file, records[i], bill) && !bill->is_paid) {
+                 latest_record = records[i];
+             }
+         }
+         fclose(file);
+     }
+     free(records);
+     
+     return latest_record;
+ }
+ 
+ /**
+  * Save a payment against a bill
+  * 
+  * Commits the payment, the bill updated in place, its premises ledger
+  * and its report views as one journal group (so a crash or a commit that
+  * loses a race leaves either all of them or none) and logs the payment.
+  * Any amount over the balance is left on the ledger as credit for the
+  * next bill.
+  * 
+  * @param customer_number - Customer making the payment
+  * @param record - Record number of the bill in bills.txt
+  * @param unpaid_bill - Bill as it is before the payment
+  * @param amount - Amount paid in cents (greater than zero)
+  * @param payment - Receives the payment
+  * @param paid_bill - Receives the bill with the payment applied
+  * @return const char* - NULL if the payment was saved, otherwise why not
+  */
+ const char *savePayment(const char *customer_number, int32_t record, const Bill *unpaid_bill, Money amount, Payment *payment, Bill *paid_bill) {
+     memset(payment, 0, sizeof(Payment));
+     generateID(payment->payment_id, "PMT");
+     strcpy(payment->bill_id, unpaid_bill->bill_id);
+     strcpy(payment->customer_number, customer_number);
+     strcpy(payment->premises_number, unpaid_bill->premises_number);
+     payment->amount = moneyToDouble(amount);
+     getCurrentDate(payment->payment_date);
+     
+     // Update bill, marking it paid once nothing is owed
+     *paid_bill = *unpaid_bill;
+     paid_bill->amount_paid = moneyToDouble(moneyFromDouble(unpaid_bill->amount_paid) + amount);
+     if (billBalance(paid_bill) <= 0) {
+         paid_bill->is_paid = true;
+     }
+     
+     journalStage(JOURNAL_BILLS, record, paid_bill, sizeof(Bill));
+     int premises_row = findPremisesRow(paid_bill->premises_number, false);
+     if (premises_row >= 0) {
+         PremisesLedger updated_ledger = *ledgerAt(premises_row);
+         ledgerRecordBill(&updated_ledger, unpaid_bill, paid_bill);
+         journalStage(JOURNAL_LEDGER, premises_row, &updated_ledger, sizeof(PremisesLedger));
+     }
+     stageReportViews(record, unpaid_bill, paid_bill);
+     journalStage(JOURNAL_PAYMENTS, -1, payment, sizeof(Payment));
+     
+     if (!journalCommit()) {
+         return "Could not save payment and bill data.";
+     }
+     
+     logActivity(customer_number, amount, false);
+     return NULL;
+ }
+ 
+ /**
+  * Run the headless remittance command
+  * 
+  * Usage: --remit FILE [--data DIR]. Each line of FILE is a payment
+  * "customer,premises,amount" (amount in dollars, e.g. 1250.75); blank lines,
+  * lines starting with '#' and a header line are skipped. Rejected rows are
+  * listed and the accepted ones committed together.
+  * 
+  * @param argc - Argument count
+  * @param argv - Arguments
+  * @return int - Exit code (0 if the accepted payments were committed)
+  */
+ int remitCommand(int argc, char *argv[]) {
+     const char *data_directory = NULL;
+     bool valid = argc == 3 || (argc == 5 && strcmp(argv[3], "--data") == 0);
+     if (argc == 5) {
+         data_directory = argv[4];
+     }
+     
+     if (!valid) {
+         printf("Usage: %s --remit FILE [--data DIR]\n", argv[0]);
+         return 1;
+     }
+     
+     // Resolve the remittance file before changing to the data directory
+     char remittance_path[4096];
+     #ifdef _WIN32
+         if (_fullpath(remittance_path, argv[2], sizeof(remittance_path)) == NULL) {
+     #else
+         if (realpath(argv[2], remittance_path) == NULL) {
+     #endif
+         printf("Error: Could not open remittance file %s.\n", argv[2]);
+         return 1;
+     }
+     
+     #ifdef _WIN32
+         if (data_directory != NULL && _chdir(data_directory) != 0) {
+     #else
+         if (data_directory != NULL && chdir(data_directory) != 0) {
+     #endif
+         printf("Error: Could not open data directory %s.\n", data_directory);
+         return 1;
+     }
+     
+     initializeSystem();
+     
+     double started = monotonicSeconds();
+     Remittance remit;
+     bool loaded = loadRemittance(remittance_path, &remit);
+     bool committed = loaded && commitRemittance(&remit);
+     double seconds = monotonicSeconds() - started;
+     
+     if (committed) {
+         printf("Applied %d payment(s) to %d bill(s) of %d customer(s), total $%.2f; %d row(s) rejected.\n",
+                remit.payments.count, remit.paid_bills.count, remit.customers.count,
+                moneyToDouble(remit.total_paid), remit.rejected);
+         printf("Processed in %.3f second(s) (%.0f payments/sec)\n", seconds,
+                seconds > 0 ? remit.payments.count / seconds : 0.0);
+     } else if (loaded) {
+         printf("Error: Could not save the remittance. No payments were applied.\n");
+     }
+     
+     releaseRemittance(&remit);
+     saveData();
+     return committed ? 0 : 1;
+ }
+ 
+ /**
+  * Apply a remittance file in memory
+  * 
+  * Applies each row to the latest unpaid bill of its premises, as payBill
+  * does for one typed payment. Bills are read from the mapped bills.txt and
+  * updated copies kept in the remittance, so several rows for the same
+  * premises pay its bills in turn. Nothing is written until
+  * commitRemittance.
+  * 
+  * @param filename - Remittance file to read
+  * @param remit - Receives the applied payments (release with releaseRemittance)
+  * @return bool - True if the file could be read
+  */
+ bool loadRemittance(const char *filename, Remittance *remit) {
+     memset(remit, 0, sizeof(Remittance));
+     tableInit(&remit->paid_bills, sizeof(RemittanceBill));
+     tableInit(&remit->customers, sizeof(RemittanceCustomer));
+     tableInit(&remit->payments, sizeof(Payment));
+     hashIndexInit(&remit->bills_by_record, 1024);
+     hashIndexInit(&remit->customers_by_number, 1024);
+     mapRecordFile(FILE_BILLS, sizeof(Bill), &remit->bills);
+     
+     FILE *file = fopen(filename, "r");
+     if (file == NULL) {
+         printf("Error: Could not open remittance file %s.\n", filename);
+         return false;
+     }
+     
+     char line[256];
+     int line_number = 0;
+     bool first_row = true;
+     
+     while (fgets(line, sizeof(line), file) != NULL) {
+         line_number++;
+         line[strcspn(line, "\r\n")] = '\0';
+         
+         char *start = line;
+         while (isspace((unsigned char)*start)) {
+             start++;
+         }
+         if (*start == '\0' || *start == '#') {
+             continue;
+         }
+         
+         // A first row that does not start with a customer number is a header
+         bool header = first_row && !isdigit((unsigned char)*start);
+         first_row = false;
+         if (header) {
+             continue;
+         }
+         
+         // Split the row into its three fields, trimming spaces
+         char *fields[3];
+         int field_count = 0;
+         for (char *field = start; field != NULL && field_count < 3; field_count++) {
+             char *comma = strchr(field, ',');
+             if (comma != NULL) {
+                 *comma = '\0';
+             }
+             while (isspace((unsigned char)*field)) {
+                 field++;
+             }
+             char *end = field + strlen(field);
+             while (end > field && isspace((unsigned char)end[-1])) {
+                 *--end = '\0';
+             }
+             fields[field_count] = field;
+             field = comma != NULL ? comma + 1 : NULL;
+         }
+         
+         const char *reason = field_count == 3 ? remitPayment(remit, fields[0], fields[1], fields[2])
+                                               : "expected customer,premises,amount";
+         if (reason != NULL) {
+             printf("Line %d rejected: %s\n", line_number, reason);
+             remit->rejected++;
+         }
+     }
+     
+     fclose(file);
+     return true;
+ }
+ 
+ /**
+  * Apply one remittance row
+  * 
+  * @param remit - Remittance being applied
+  * @param customer_number - Customer number of the row
+  * @param premises_number - Premises number of the row
+  * @param amount_text - Payment amount in dollars
+  * @return const char* - Reason the row was rejected, or NULL if it was applied
+  */
+ const char *remitPayment(Remittance *remit, const char *customer_number, const char *premises_number, const char *amount_text) {
+     Money amount;
+     if (!parseMoney(amount_text, &amount) || amount <= 0) {
+         return "invalid payment amount";
+     }
+     
+     int customer_row = strlen(customer_number) == 7 ? findCustomerRow(customer_number, true) : -1;
+     if (customer_row < 0) {
+         return "customer not found or archived";
+     }
+     int premises_row = strlen(premises_number) == 7 ? findCustomerPremisesRow(customer_row, premises_number, false) : -1;
+     if (premises_row < 0) {
+         return "premises not found for this customer";
+     }
+     
+     // Find the latest unpaid bill of the premises, as updated by earlier rows
+     BillIndexBucket *bucket = findBillBucket(customer_number, premises_number);
+     RemittanceBill *target = NULL;
+     int32_t target_record = -1;
+     for (int k = bucket != NULL ? bucket->count - 1 : -1; k >= 0 && target_record < 0; k--) {
+         int32_t record = bucket->records[k];
+         int cursor = -1;
+         int32_t position = hashIndexFind(&remit->bills_by_record, (uint64_t)record, &cursor);
+         if (position >= 0) {
+             RemittanceBill *paid = tableRow(&remit->paid_bills, position);
+             if (!paid->updated.is_paid) {
+                 target = paid;
+                 target_record = record;
+             }
+         } else if (record < remit->bills.count && !((const Bill *)remit->bills.data)[record].is_paid) {
+             target_record = record;
+         }
+     }
+     
+     if (target_record < 0) {
+         return "no unpaid bill for this premises";
+     }
+     if (target == NULL) {
+         hashIndexInsert(&remit->bills_by_record, (uint64_t)target_record, remit->paid_bills.count);
+         target = tableAppend(&remit->paid_bills);
+         target->record = target_record;
+         target->premises_row = premises_row;
+         target->original = ((const Bill *)remit->bills.data)[target_record];
+         target->updated = target->original;
+     }
+     
+     target->updated.amount_paid = moneyToDouble(moneyFromDouble(target->updated.amount_paid) + amount);
+     target->updated.is_paid = billBalance(&target->updated) <= 0;
+     
+     Payment *payment = tableAppend(&remit->payments);
+     generateID(payment->payment_id, "PMT");
+     strcpy(payment->bill_id, target->updated.bill_id);
+     strcpy(payment->customer_number, customerAt(customer_row)->customer_number);
+     strcpy(payment->premises_number, premisesAt(premises_row)->premises_number);
+     payment->amount = moneyToDouble(amount);
+     getCurrentDate(payment->payment_date);
+     
+     int cursor = -1;
+     uint32_t key = packNumber(customer_number);
+     int32_t position = hashIndexFind(&remit->customers_by_number, key, &cursor);
+     if (position < 0) {
+         position = remit->customers.count;
+         RemittanceCustomer *customer = tableAppend(&remit->customers);
+         strcpy(customer->customer_number, customerAt(customer_row)->customer_number);
+         strcpy(customer->log.customer_number, customer->customer_number);
+         hashIndexInsert(&remit->customers_by_number, key, position);
+     }
+     RemittanceCustomer *customer = tableRow(&remit->customers, position);
+     customer->payments++;
+     customer->last_payment = amount;
+     remit->total_paid += amount;
+     
+     return NULL;
+ }
+ 
+ /**
+  * Commit a remittance
+  * 
+  * Stages each paid bill once (with its final amount paid), the ledger row
+  * of each premises, the report view rows and every payment and commits
+  * them as one journal group, so a remittance refused because another
+  * session changed the same bills first records no payments. Finally the
+  * customers' latest log records are found in one pass over
+  * system_logs.txt and one log record per customer appended with one
+  * write.
+  * 
+  * @param remit - Remittance applied by loadRemittance
+  * @return bool - True if the payments and bills were saved (if not, none were)
+  */
+ bool commitRemittance(Remittance *remit) {
+     if (remit->payments.count == 0) {
+         return true;
+     }
+     
+     // Account for every paid bill in its premises' ledger row, then stage each ledger row once
+     RecordTable ledgers;
+     HashIndex ledgers_by_premises;
+     memset(&ledgers, 0, sizeof(RecordTable));
+     tableInit(&ledgers, sizeof(RemittanceLedger));
+     hashIndexInit(&ledgers_by_premises, remit->paid_bills.count);
+     
+     for (int i = 0; i < remit->paid_bills.count; i++) {
+         const RemittanceBill *paid = tableRow(&remit->paid_bills, i);
+         int cursor = -1;
+         int32_t position = hashIndexFind(&ledgers_by_premises, (uint64_t)paid->premises_row, &cursor);
+         if (position < 0) {
+             position = ledgers.count;
+             RemittanceLedger *ledger = tableAppend(&ledgers);
+             ledger->premises_row = paid->premises_row;
+             ledger->ledger = *ledgerAt(paid->premises_row);
+             hashIndexInsert(&ledgers_by_premises, (uint64_t)paid->premises_row, position);
+         }
+         ledgerRecordBill(&((RemittanceLedger *)tableRow(&ledgers, position))->ledger, &paid->original, &paid->updated);
+         
+         journalStage(JOURNAL_BILLS, paid->record, &paid->updated, sizeof(Bill));
+         stageReportViews(paid->record, &paid->original, &paid->updated);
+     }
+     for (int i = 0; i < ledgers.count; i++) {
+         const RemittanceLedger *ledger = tableRow(&ledgers, i);
+         journalStage(JOURNAL_LEDGER, ledger->premises_row, &ledger->ledger, sizeof(PremisesLedger));
+     }
+     tableInit(&ledgers, sizeof(RemittanceLedger));
+     hashIndexFree(&ledgers_by_premises);
+     for (int i = 0; i < remit->payments.count; i++) {
+         journalStage(JOURNAL_PAYMENTS, -1, tableRow(&remit->payments, i), sizeof(Payment));
+     }
+     
+     if (!journalCommit()) {
+         return false;
+     }
+     
+     // Carry each customer's latest log forward with their payments
+     FILE *file = fopen(FILE_LOGS, "rb");
+     if (file != NULL) {
+         SystemLog existing_log;
+         while (fread(&existing_log, sizeof(SystemLog), 1, file) == 1) {
+             int cursor = -1;
+             int32_t position = hashIndexFind(&remit->customers_by_number, packNumber(existing_log.customer_number), &cursor);
+             if (position >= 0) {
+                 ((RemittanceCustomer *)tableRow(&remit->customers, position))->log = existing_log;
+             }
+         }
+         fclose(file);
+     }
+     
+     RecordTable logs;
+     memset(&logs, 0, sizeof(RecordTable));
+     tableInit(&logs, sizeof(SystemLog));
+     for (int i = 0; i < remit->customers.count; i++) {
+         const RemittanceCustomer *customer = tableRow(&remit->customers, i);
+         SystemLog *log = tableAppend(&logs);
+         *log = customer->log;
+         generateID(log->log_id, "LOG");
+         strcpy(log->customer_number, customer->customer_number);
+         getCurrentDate(log->log_date);
+         log->payments_count += customer->payments;
+         log->last_payment_amount = moneyToDouble(customer->last_payment);
+     }
+     
+     file = openAppend(FILE_LOGS);
+     if (file == NULL || !writeTableRows(file, &logs)) {
+         printf("Warning: Could not update the activity log.\n");
+     }
+     if (file != NULL) {
+         fclose(file);
+     }
+     tableInit(&logs, sizeof(SystemLog));
+     
+     return true;
+ }
+ 
+ // Release the bills, tables and indexes of a remittance
+ void releaseRemittance(Remittance *remit) {
+     unmapRecordFile(&remit->bills);
+     tableInit(&remit->paid_bills, sizeof(RemittanceBill));
+     tableInit(&remit->customers, sizeof(RemittanceCustomer));
+     tableInit(&remit->payments, sizeof(Payment));
+     hashIndexFree(&remit->bills_by_record);
+     hashIndexFree(&remit->customers_by_number);
+ }
+ 
+ // Surrender meter (Customer function)
+ void surrenderMeter() {
+     clearScreen();
+     char premises_number[8];
+     int premises_index = -1;
+     
+     printf("\n=== Surrender Meter ===\n");
+     printf("Enter Premises Number to surrender: ");
+     fgets(premises_number, 8, stdin);
+     premises_number[strcspn(premises_number, "\n")] = '\0';
+     
+     // Find premises among the customer's premises
+     int customer_row = findCustomerRow(console.customer.customer_number, true);
+     if (customer_row >= 0) {
+         premises_index = findCustomerPremisesRow(customer_row, premises_number, true);
+     }
+     
+     if (premises_index < 0) {
+         printf("Premises not found, not associated with your account, or already inactive.\n");
+         pauseScreen();
+         return;
+     }
+     
+     // Check for unpaid bills
+     if (ledgerAt(premises_index)->unpaid_count > 0) {
+         printf("Cannot surrender meter: You have unpaid bills for this premises.\n");
+         printf("Please pay all outstanding bills before surrendering the meter.\n");
+         pauseScreen();
+         return;
+     }
+     
+     if (saveSurrender(console.customer.customer_number, premises_index)) {
+         printf("Meter surrendered successfully!\n");
+     } else {
+         printf("Error: Could not update premises data.\n");
+     }
+     
+     pauseScreen();
+ }
+ 
+ // Deactivate a surrendered premises and log the surrender
+ bool saveSurrender(const char *customer_number, int premises_row) {
+     Premises surrendered = *premisesAt(premises_row);
+     surrendered.is_active = false;
+     journalStage(JOURNAL_PREMISES, premises_row, &surrendered, sizeof(Premises));
+     
+     if (!journalCommit()) {
+         return false;
+     }
+     
+     logActivity(customer_number, 0.0, true);
+     return true;
+ }
+ 
+ /**
+  * Run headless commands
+  * 
+  * Usage: --command NAME [ARGS...] [--data DIR] runs one command, and
+  * --batch [--data DIR] runs one command per line of standard input until
+  * it ends. Commands answer on standard output with one line starting
+  * "OK" and key=value fields, or "ERR CODE message" (CODE is usage,
+  * unknown, invalid, not_found, exists, refused, conflict or io; a
+  * command refused with conflict lost a race with another process
+  * changing the same records and may be sent again; one that only raced
+  * another process appending rows is run again by itself). A report
+  * answers "OK", then its CSV or JSON rows, then "END rows=N". Messages
+  * from loading the data go to standard error, so responses can be parsed
+  * as they arrive. Batch responses are flushed whenever no more input is
+  * waiting, so a client may send many commands before reading their
+  * answers, or one at a time. Commands run as an agent unless a login
+  * command signs in as another user.
+  * 
+  * @param argc - Argument count from main
+  * @param argv - Arguments from main (argv[1] is "--command" or "--batch")
+  * @return int - Exit code (0 if every command succeeded)
+  */
+ int headlessCommand(int argc, char *argv[]) {
+     bool batch = strcmp(argv[1], "--batch") == 0;
+     const char *data_directory = NULL;
+     
+     if (argc >= 4 && strcmp(argv[argc - 2], "--data") == 0) {
+         data_directory = argv[argc - 1];
+         argc -= 2;
+     }
+     if (batch ? argc != 2 : argc < 3) {
+         fprintf(stderr, "Usage: %s --command NAME [ARGS...] [--data DIR]\n", argv[0]);
+         fprintf(stderr, "       %s --batch [--data DIR] < COMMANDS\n", argv[0]);
+         return 1;
+     }
+     
+     #ifdef _WIN32
+         if (data_directory != NULL && _chdir(data_directory) != 0) {
+     #else
+         if (data_directory != NULL && chdir(data_directory) != 0) {
+     #endif
+         fprintf(stderr, "Error: Could not open data directory %s.\n", data_directory);
+         return 1;
+     }
+     
+     // Responses get their own stream on the real standard output; everything printed goes to standard error
+     fflush(stdout);
+     #ifdef _WIN32
+         FILE *out = _fdopen(_dup(_fileno(stdout)), "w");
+         _dup2(_fileno(stderr), _fileno(stdout));
+     #else
+         FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+         dup2(STDERR_FILENO, STDOUT_FILENO);
+     #endif
+     if (out == NULL) {
+         fprintf(stderr, "Error: Could not open standard output.\n");
+         return 1;
+     }
+     initializeSystem();
+     
+     // The operator running the program acts as an agent
+     Session session;
+     memset(&session, 0, sizeof(Session));
+     session.signed_in = true;
+     session.user.type = AGENT;
+     
+     bool succeeded = true;
+     if (!batch) {
+         succeeded = runCommand(&session, argc - 2, argv + 2, out);
+     } else {
+         LineReader reader;
+         char *line;
+         readerInit(&reader, 0);
+         
+         while (!session.quit && (line = readerLine(&reader, out)) != NULL) {
+             succeeded = runCommandLine(&session, line, reader.too_long, out) && succeeded;
+         }
+         readerFree(&reader);
+     }
+     
+     fflush(stdout);
+     return fclose(out) == 0 && succeeded ? 0 : 1;
+ }
+ 
+ // Split and run one command line (blank lines and lines starting with '#' get no response)
+ bool runCommandLine(Session *session, char *line, bool too_long, FILE *out) {
+     char *words[COMMAND_MAX_ARGS];
+     int count = splitCommandLine(line, words, COMMAND_MAX_ARGS);
+     
+     if (too_long) {
+         fprintf(out, "ERR invalid command line longer than %d bytes\n", COMMAND_BUFFER_SIZE - 1);
+         return false;
+     }
+     if (count < 0) {
+         fprintf(out, "ERR invalid unbalanced quotes or more than %d words\n", COMMAND_MAX_ARGS);
+         return false;
+     }
+     if (count == 0 || words[0][0] == '#') {
+         return true;
+     }
+     return runCommand(session, count, words, out);
+ }
+ 
+ /**
+  * Run one command
+  * 
+  * Looks the command up by name, checks its argument count and that the
+  * session may run it, then runs its handler holding data_lock: shared
+  * for commands that only read, so reports from many sessions run side
+  * by side, and exclusive for commands that change the data set. Changes
+  * other processes have committed are picked up first. Every command
+  * writes exactly one response.
+  * 
+  * @param session - Session running the command
+  * @param argc - Word count (name included)
+  * @param argv - Words of the command
+  * @param out - Stream for the response
+  * @return bool - True if the command answered OK
+  */
+ bool runCommand(Session *session, int argc, char *argv[], FILE *out) {
+     static const CommandSpec commands[] = {
+         { "login", 2, 2, COMMAND_ANYONE, false, commandLogin, "EMAIL PASSWORD" },
+         { "logout", 0, 0, COMMAND_ANYONE, false, commandLogout, "" },
+         { "quit", 0, 0, COMMAND_ANYONE, false, commandQuit, "" },
+         { "add-customer", 5, 7, COMMAND_AGENT, true, commandAddCustomer, "FIRST LAST CLASS METER_MM READING [CUSTOMER|- [PREMISES|-]]" },
+         { "edit-customer", 2, 4, COMMAND_AGENT, true, commandEditCustomer, "CUSTOMER first=NAME|last=NAME|class=N..." },
+         { "generate-bill", 2, 2, COMMAND_AGENT, true, commandGenerateBill, "CUSTOMER PREMISES" },
+         { "pay", 2, 2, COMMAND_CUSTOMER, true, commandPay, "CUSTOMER AMOUNT" },
+         { "surrender", 2, 2, COMMAND_CUSTOMER, true, commandSurrender, "CUSTOMER PREMISES" },
+         { "report", 1, 3, COMMAND_CUSTOMER, false, commandReport, "paid|owing|archived|bills|customer NUMBER [csv|json]" }
+     };
+     
+     for (int i = 0; i < (int)(sizeof(commands) / sizeof(commands[0])); i++) {
+         const CommandSpec *command = &commands[i];
+         if (strcmp(argv[0], command->name) != 0) {
+             continue;
+         }
+         
+         if (argc - 1 < command->min_args || argc - 1 > command->max_args) {
+             fprintf(out, "ERR usage %s %s\n", command->name, command->usage);
+             return false;
+         }
+         if (command->access != COMMAND_ANYONE && !session->signed_in) {
+             fprintf(out, "ERR refused sign in first\n");
+             return false;
+         }
+         if (command->access == COMMAND_AGENT && session->user.type != AGENT) {
+             fprintf(out, "ERR refused %s is for agents only\n", command->name);
+             return false;
+         }
+         
+         // Pick up changes other processes have committed, then run the command
+         if (command->writes) {
+             lockWrite(&data_lock);
+             journalRefresh();
+             journal.conflict = false;
+         } else {
+             lockRead(&data_lock);
+             if (journalBehind()) {
+                 unlockRead(&data_lock);
+                 lockWrite(&data_lock);
+                 journalRefresh();
+                 unlockWrite(&data_lock);
+                 lockRead(&data_lock);
+             }
+         }
+         // A command that lost a race over appended rows has caught up and saved nothing, so it is run again
+         journal.retries = command->writes ? COMMAND_RETRIES : 0;
+         bool succeeded = command->run(session, argc, argv, out);
+         while (!succeeded && journal.conflict && journal.appended && journal.retries > 0) {
+             journal.retries--;
+             journal.conflict = false;
+             succeeded = command->run(session, argc, argv, out);
+         }
+         journal.retries = 0;
+         if (command->writes) {
+             unlockWrite(&data_lock);
+         } else {
+             unlockRead(&data_lock);
+         }
+         return succeeded;
+     }
+     
+     fprintf(out, "ERR unknown command %s\n", argv[0]);
+     return false;
+ }
+ 
+ /**
+  * Split a command line into words
+  * 
+  * Words are separated by spaces or tabs; a word may be wrapped in double
+  * quotes to include spaces (e.g. "Mary Ann"). The line is split in place.
+  * 
+  * @param line - Command line (modified)
+  * @param argv - Receives the words
+  * @param max_args - Most words accepted
+  * @return int - Number of words, or -1 for unbalanced quotes or too many words
+  */
+ int splitCommandLine(char *line, char *argv[], int max_args) {
+     int count = 0;
+     char *next = line;
+     
+     while (true) {
+         while (*next == ' ' || *next == '\t' || *next == '\r') {
+             next++;
+         }
+         if (*next == '\0') {
+             return count;
+         }
+         if (count == max_args) {
+             return -1;
+         }
+         
+         if (*next == '"') {
+             argv[count++] = ++next;
+             next = strchr(next, '"');
+             if (next == NULL) {
+                 return -1;
+             }
+         } else {
+             argv[count++] = next;
+             next += strcspn(next, " \t\r");
+             if (*next == '\0') {
+                 return count;
+             }
+         }
+         *next++ = '\0';
+     }
+ }
+ 
+ // Start reading command lines from a descriptor
+ void readerInit(LineReader *reader, int fd) {
+     memset(reader, 0, sizeof(LineReader));
+     reader->fd = fd;
+     reader->data = malloc(COMMAND_BUFFER_SIZE);
+     reader->eof = reader->data == NULL;
+ }
+ 
+ /**
+  * Read the next command line
+  * 
+  * Returns lines from a buffer filled by large reads, so thousands of
+  * pipelined commands cost a handful of system calls. Before waiting for
+  * more input it flushes the responses written so far, so a client that
+  * waits for each answer is never left waiting on a buffered response.
+  * 
+  * @param reader - Line reader
+  * @param out - Response stream to flush before blocking
+  * @return char* - Line without its newline, or NULL at the end of input
+  */
+ char *readerLine(LineReader *reader, FILE *out) {
+     char *line;
+     
+     while ((line = readerNext(reader)) == NULL && !reader->eof) {
+         fflush(out);
+         readerFill(reader);
+     }
+     return line;
+ }
+ 
+ /**
+  * Take the next complete line from the buffer
+  * 
+  * Never reads, so an event loop can call it after readerFill until it
+  * returns NULL. A line too long for the buffer is skipped and returned
+  * empty with too_long set. At the end of input a last line without a
+  * newline is returned too.
+  * 
+  * @param reader - Line reader
+  * @return char* - Line without its newline, or NULL if no complete line is buffered
+  */
+ char *readerNext(LineReader *reader) {
+     char *line = reader->data + reader->start;
+     char *newline = memchr(line, '\n', reader->end - reader->start);
+     reader->too_long = false;
+     
+     if (newline != NULL) {
+         *newline = '\0';
+         reader->start = (size_t)(newline - reader->data) + 1;
+         if (reader->discarding) {
+             reader->discarding = false;
+             reader->too_long = true;
+             line[0] = '\0';
+         }
+         return line;
+     }
+     
+     if (reader->eof && reader->start < reader->end && !reader->discarding) {
+         reader->data[reader->end] = '\0';
+         reader->start = reader->end;
+         return line;
+     }
+     return NULL;
+ }
+ 
+ // Read whatever input is available into the buffer (false at the end of input)
+ bool readerFill(LineReader *reader) {
+     if (reader->eof) {
+         return false;
+     }
+     
+     // Keep the partial line, or drop it if it already fills the buffer
+     if (reader->start == 0 && reader->end == COMMAND_BUFFER_SIZE - 1) {
+         reader->discarding = true;
+         reader->end = 0;
+     }
+     memmove(reader->data, reader->data + reader->start, reader->end - reader->start);
+     reader->end -= reader->start;
+     reader->start = 0;
+     
+     #ifdef _WIN32
+         int bytes = _read(reader->fd, reader->data + reader->end, (unsigned int)(COMMAND_BUFFER_SIZE - 1 - reader->end));
+     #else
+         ssize_t bytes = read(reader->fd, reader->data + reader->end, COMMAND_BUFFER_SIZE - 1 - reader->end);
+     #endif
+     if (bytes <= 0) {
+         reader->eof = true;
+         return false;
+     }
+     reader->end += (size_t)bytes;
+     return true;
+ }
+ 
+ // Release a line reader
+ void readerFree(LineReader *reader) {
+     free(reader->data);
+     memset(reader, 0, sizeof(LineReader));
+ }
+ 
+ // Parse a whole number between min and max (nothing else may follow)
+ bool parseCount(const char *text, int min, int max, int *value) {
+     int64_t number;
+     const char *end;
+     
+     if (!parseFixed(text, 0, &number, &end) || *end != '\0' || number < min || number > max) {
+         return false;
+     }
+     *value = (int)number;
+     return true;
+ }
+ 
+ // Answer a command whose changes were not saved, telling a lost race (conflict) from a failed write (io)
+ bool commandSaveFailed(FILE *out, const char *message) {
+     if (journal.conflict && journal.appended && journal.retries > 0) {
+         return false; // runCommand runs the command again
+     } else if (journal.conflict) {
+         fprintf(out, "ERR conflict another session changed the same records first\n");
+     } else {
+         fprintf(out, "ERR io %s\n", message);
+     }
+     return false;
+ }
+ 
+ // Check a session may act for a customer (agents for any customer, customers for themselves)
+ bool ownsCustomer(const Session *session, const char *customer_number) {
+     return session->user.type == AGENT || strcmp(session->customer.customer_number, customer_number) == 0;
+ }
+ 
+ // login EMAIL PASSWORD: sign in, answering "OK user=ID type=agent" or "OK user=ID type=customer customer=N"
+ bool commandLogin(Session *session, int argc, char *argv[], FILE *out) {
+     (void)argc;
+     Session signed_in;
+     
+     if (!authenticate(&signed_in, argv[1], argv[2])) {
+         fprintf(out, "ERR refused invalid email or password\n");
+         return false;
+     }
+     *session = signed_in;
+     
+     if (session->user.type == AGENT) {
+         fprintf(out, "OK user=%d type=agent\n", session->user.id);
+     } else {
+         fprintf(out, "OK user=%d type=customer customer=%s\n", session->user.id, session->customer.customer_number);
+     }
+     return true;
+ }
+ 
+ // logout: end the signed-in session, answering "OK"
+ bool commandLogout(Session *session, int argc, char *argv[], FILE *out) {
+     (void)argc;
+     (void)argv;
+     memset(session, 0, sizeof(Session));
+     fprintf(out, "OK\n");
+     return true;
+ }
+ 
+ // quit: answer "OK" and end the batch or close the connection
+ bool commandQuit(Session *session, int argc, char *argv[], FILE *out) {
+     (void)argc;
+     (void)argv;
+     session->quit = true;
+     fprintf(out, "OK\n");
+     return true;
+ }
+ 
+ /**
+  * add-customer FIRST LAST CLASS METER_MM READING [CUSTOMER|- [PREMISES|-]]
+  * 
+  * Adds a customer with its first premises. CLASS is the income class
+  * (1-5), METER_MM the meter size (15, 30 or 150) and READING the first
+  * meter reading. Numbers left out or given as "-" are allocated.
+  * Answers "OK customer=N premises=N".
+  */
+ bool commandAddCustomer(Session *session, int argc, char *argv[], FILE *out) {
+     (void)session;
+     const char *customer_number = argc > 6 ? argv[6] : "-";
+     const char *premises_number = argc > 7 ? argv[7] : "-";
+     int income_class;
+     int meter_mm;
+     int first_reading;
+     
+     if (strlen(argv[1]) >= MAX_NAME_LENGTH || strlen(argv[2]) >= MAX_NAME_LENGTH) {
+         fprintf(out, "ERR invalid names must be shorter than %d characters\n", MAX_NAME_LENGTH);
+         return false;
+     }
+     if (!parseCount(argv[3], 1, 5, &income_class)) {
+         fprintf(out, "ERR invalid income class must be 1 to 5\n");
+         return false;
+     }
+     if (!parseCount(argv[4], 15, 150, &meter_mm) || (meter_mm != 15 && meter_mm != 30 && meter_mm != 150)) {
+         fprintf(out, "ERR invalid meter size must be 15, 30 or 150\n");
+         return false;
+     }
+     if (!parseCount(argv[5], 0, INT32_MAX, &first_reading)) {
+         fprintf(out, "ERR invalid first reading must be a whole number\n");
+         return false;
+     }
+     if (strcmp(customer_number, "-") != 0) {
+         if (packNumber(customer_number) == NUMBER_NONE) {
+             fprintf(out, "ERR invalid customer number must be 7 digits\n");
+             return false;
+         }
+         if (isCustomerNumberExists(customer_number)) {
+             fprintf(out, "ERR exists customer %s\n", customer_number);
+             return false;
+         }
+     }
+     if (strcmp(premises_number, "-") != 0) {
+         if (packNumber(premises_number) == NUMBER_NONE) {
+             fprintf(out, "ERR invalid premises number must be 7 digits\n");
+             return false;
+         }
+         if (isPremisesNumberExists(premises_number)) {
+             fprintf(out, "ERR exists premises %s\n", premises_number);
+             return false;
+         }
+     }
+     
+     Customer new_customer;
+     Premises new_premises;
+     memset(&new_customer, 0, sizeof(Customer));
+     memset(&new_premises, 0, sizeof(Premises));
+     
+     if (strcmp(customer_number, "-") != 0) {
+         strcpy(new_customer.customer_number, customer_number);
+     } else if (!allocateNumber(&customer_numbers, new_customer.customer_number)) {
+         fprintf(out, "ERR refused no unused customer numbers left\n");
+         return false;
+     }
+     if (strcmp(premises_number, "-") != 0) {
+         strcpy(new_premises.premises_number, premises_number);
+     } else if (!allocateNumber(&premises_numbers, new_premises.premises_number)) {
+         if (strcmp(customer_number, "-") == 0) {
+             releaseNumber(&customer_numbers, new_customer.customer_number);
+         }
+         fprintf(out, "ERR refused no unused premises numbers left\n");
+         return false;
+     }
+     
+     strcpy(new_customer.first_name, argv[1]);
+     strcpy(new_customer.last_name, argv[2]);
+     new_customer.income_class = (IncomeClass)income_class;
+     new_customer.is_active = true;
+     
+     strcpy(new_premises.customer_number, new_customer.customer_number);
+     new_premises.meter_size = meter_mm == 15 ? METER_15MM : meter_mm == 30 ? METER_30MM : METER_150MM;
+     new_premises.initial_reading = first_reading;
+     new_premises.previous_reading = first_reading;
+     new_premises.current_reading = first_reading;
+     new_premises.is_active = true;
+     
+     if (!saveNewCustomer(&new_customer, &new_premises)) {
+         return commandSaveFailed(out, "could not save customer and premises data");
+     }
+     
+     fprintf(out, "OK customer=%s premises=%s\n", new_customer.customer_number, new_premises.premises_number);
+     return true;
+ }
+ 
+ /**
+  * edit-customer CUSTOMER first=NAME|last=NAME|class=N...
+  * 
+  * Changes the given fields of an active customer. Answers "OK customer=N".
+  */
+ bool commandEditCustomer(Session *session, int argc, char *argv[], FILE *out) {
+     (void)session;
+     int row = findCustomerRow(argv[1], true);
+     if (row < 0) {
+         fprintf(out, "ERR not_found customer %s\n", argv[1]);
+         return false;
+     }
+     
+     Customer updated = *customerAt(row);
+     for (int i = 2; i < argc; i++) {
+         const char *value = strchr(argv[i], '=');
+         int income_class;
+         
+         if (value != NULL && strlen(value + 1) >= MAX_NAME_LENGTH) {
+             fprintf(out, "ERR invalid names must be shorter than %d characters\n", MAX_NAME_LENGTH);
+             return false;
+         } else if (strncmp(argv[i], "first=", 6) == 0) {
+             strcpy(updated.first_name, value + 1);
+         } else if (strncmp(argv[i], "last=", 5) == 0) {
+             strcpy(updated.last_name, value + 1);
+         } else if (strncmp(argv[i], "class=", 6) == 0 && parseCount(value + 1, 1, 5, &income_class)) {
+             updated.income_class = (IncomeClass)income_class;
+         } else {
+             fprintf(out, "ERR invalid field %s (expected first=NAME, last=NAME or class=1..5)\n", argv[i]);
+             return false;
+         }
+     }
+     
+     journalStage(JOURNAL_CUSTOMERS, row, &updated, sizeof(Customer));
+     if (!journalCommit()) {
+         return commandSaveFailed(out, "could not update customer data");
+     }
+     
+     fprintf(out, "OK customer=%s\n", updated.customer_number);
+     return true;
+ }
+ 
+ /**
+  * generate-bill CUSTOMER PREMISES
+  * 
+  * Bills one active premises of a customer against today's tariff.
+  * Answers "OK bill=ID consumption=LITRES amount_due=AMOUNT early_amount=AMOUNT"
+  * (early_amount is 0.00 when the bill is not eligible for the discount).
+  */
+ bool commandGenerateBill(Session *session, int argc, char *argv[], FILE *out) {
+     (void)session;
+     (void)argc;
+     int customer_row = findCustomerRow(argv[1], true);
+     int premises_row = customer_row >= 0 ? findCustomerPremisesRow(customer_row, argv[2], true) : -1;
+     
+     if (customer_row < 0) {
+         fprintf(out, "ERR not_found customer %s\n", argv[1]);
+         return false;
+     }
+     if (premises_row < 0) {
+         fprintf(out, "ERR not_found premises %s of customer %s\n", argv[2], argv[1]);
+         return false;
+     }
+     
+     Bill new_bill;
+     Premises updated_premises;
+     const TariffSchedule *tariff = currentTariff();
+     uint64_t seed = newRunSeed();
+     if (prepareBill(customer_row, premises_row, tariff, seed, &new_bill, &updated_premises) == BILL_TOO_MANY_UNPAID) {
+         fprintf(out, "ERR refused premises %s has two or more unpaid bills\n", argv[2]);
+         return false;
+     }
+     
+     priceBills(&new_bill, 1, tariff);
+     stampBill(&new_bill);
+     if (!saveNewBill(premises_row, seed, &new_bill, &updated_premises)) {
+         return commandSaveFailed(out, "could not save bill data");
+     }
+     
+     fprintf(out, "OK bill=%s consumption=%d amount_due=%.2f early_amount=%.2f\n", new_bill.bill_id, new_bill.consumption,
+             new_bill.total_amount_due, new_bill.is_early_payment_eligible ? new_bill.early_payment_amount : 0.0);
+     return true;
+ }
+ 
+ /**
+  * pay CUSTOMER AMOUNT
+  * 
+  * Pays an amount (dollars, e.g. 1250.75) off the customer's most recent
+  * unpaid bill, as payBill does for a signed-in customer. A customer may
+  * only pay their own bills, once they have registered a payment card. Answers
+  * "OK payment=ID bill=ID balance=AMOUNT status=paid|partial"; a negative
+  * balance is credit carried to the next bill.
+  */
+ bool commandPay(Session *session, int argc, char *argv[], FILE *out) {
+     (void)argc;
+     Money amount;
+     Bill unpaid_bill;
+     
+     if (!parseMoney(argv[2], &amount) || amount <= 0) {
+         fprintf(out, "ERR invalid amount %s\n", argv[2]);
+         return false;
+     }
+     if (!ownsCustomer(session, argv[1])) {
+         fprintf(out, "ERR refused customers may only pay their own bills\n");
+         return false;
+     }
+     int customer_row = findCustomerRow(argv[1], true);
+     if (customer_row < 0) {
+         fprintf(out, "ERR not_found customer %s\n", argv[1]);
+         return false;
+     }
+     if (session->user.type == CUSTOMER && !customerAt(customer_row)->has_payment_card) {
+         fprintf(out, "ERR refused register a payment card before making payments\n");
+         return false;
+     }
+     
+     int32_t record = findLatestUnpaidBill(argv[1], &unpaid_bill);
+     if (record < 0) {
+         fprintf(out, "ERR refused customer %s has no unpaid bills\n", argv[1]);
+         return false;
+     }
+     
+     Payment payment;
+     Bill paid_bill;
+     const char *error = savePayment(argv[1], record, &unpaid_bill, amount, &payment, &paid_bill);
+     if (error != NULL) {
+         return commandSaveFailed(out, error);
+     }
+     
+     fprintf(out, "OK payment=%s bill=%s balance=%.2f status=%s\n", payment.payment_id, payment.bill_id,
+             moneyToDouble(billBalance(&paid_bill)), paid_bill.is_paid ? "paid" : "partial");
+     return true;
+ }
+ 
+ /**
+  * surrender CUSTOMER PREMISES
+  * 
+  * Surrenders the meter of an active premises with no unpaid bills. A
+  * customer may only surrender their own meters. Answers "OK premises=N".
+  */
+ bool commandSurrender(Session *session, int argc, char *argv[], FILE *out) {
+     (void)argc;
+     if (!ownsCustomer(session, argv[1])) {
+         fprintf(out, "ERR refused customers may only surrender their own meters\n");
+         return false;
+     }
+     
+     int customer_row = findCustomerRow(argv[1], true);
+     int premises_row = customer_row >= 0 ? findCustomerPremisesRow(customer_row, argv[2], true) : -1;
+     
+     if (customer_row < 0) {
+         fprintf(out, "ERR not_found customer %s\n", argv[1]);
+         return false;
+     }
+     if (premises_row < 0) {
+         fprintf(out, "ERR not_found premises %s of customer %s\n", argv[2], argv[1]);
+         return false;
+     }
+     if (ledgerAt(premises_row)->unpaid_count > 0) {
+         fprintf(out, "ERR refused premises %s has unpaid bills\n", argv[2]);
+         return false;
+     }
+     
+     if (!saveSurrender(argv[1], premises_row)) {
+         return commandSaveFailed(out, "could not update premises data");
+     }
+     
+     fprintf(out, "OK premises=%s\n", argv[2]);
+     return true;
+ }
+ 
+ /**
+  * report paid|owing|archived|bills [csv|json], report customer NUMBER [csv|json]
+  * 
+  * Answers "OK report=NAME format=FORMAT", then the rows as --export
+  * writes them (CSV by default), then "END rows=N". Customers may only
+  * see their own billing history.
+  */
+ bool commandReport(Session *session, int argc, char *argv[], FILE *out) {
+     ExportDataset dataset;
+     const char *customer_number = "";
+     int format_arg = 2;
+     
+     if (!parseExportDataset(argv[1], &dataset)) {
+         fprintf(out, "ERR invalid report %s\n", argv[1]);
+         return false;
+     }
+     if (dataset == EXPORT_CUSTOMER) {
+         if (argc < 3) {
+             fprintf(out, "ERR usage report customer NUMBER [csv|json]\n");
+             return false;
+         }
+         customer_number = argv[2];
+         format_arg = 3;
+     }
+     if (argc > format_arg + 1 || (argc == format_arg + 1 && strcmp(argv[format_arg], "csv") != 0 && strcmp(argv[format_arg], "json") != 0)) {
+         fprintf(out, "ERR usage report paid|owing|archived|bills|customer NUMBER [csv|json]\n");
+         return false;
+     }
+     if (session->user.type == CUSTOMER && (dataset != EXPORT_CUSTOMER || !ownsCustomer(session, customer_number))) {
+         fprintf(out, "ERR refused customers may only see their own billing history\n");
+         return false;
+     }
+     if (dataset == EXPORT_CUSTOMER && findCustomerRow(customer_number, false) < 0) {
+         fprintf(out, "ERR not_found customer %s\n", customer_number);
+         return false;
+     }
+     
+     ExportFormat format = argc > format_arg && strcmp(argv[format_arg], "json") == 0 ? EXPORT_JSON : EXPORT_CSV;
+     Exporter exporter;
+     memset(&exporter, 0, sizeof(Exporter));
+     exporter.format = format;
+     if (!writerAttach(&exporter.writer, out)) {
+         fprintf(out, "ERR io out of memory\n");
+         return false;
+     }
+     
+     fprintf(out, "OK report=%s format=%s\n", argv[1], format == EXPORT_JSON ? "json" : "csv");
+     exportRows(&exporter, dataset, customer_number);
+     bool written = exportClose(&exporter);
+     fprintf(out, "END rows=%ld\n", exporter.rows);
+     return written;
+ }
+ 
+ /**
+  * Run the multi-session server
+  * 
+  * Usage: --serve SOCKET [--data DIR]. Listens on a Unix domain socket and
+  * serves up to SERVER_MAX_CONNECTIONS clients at once from one in-memory
+  * data set. Each connection speaks the --batch protocol with its own
+  * session, starting signed out: "login EMAIL PASSWORD" signs in an agent
+  * or a customer. One event loop thread reads requests with poll() and
+  * hands complete lines to a pool of worker threads, one line per
+  * connection at a time so every client gets its answers in order.
+  * Reports run in parallel; changes run one at a time (see runCommand).
+  * Stops on SIGINT or SIGTERM, finishing the lines already queued.
+  * 
+  * @param argc - Argument count from main
+  * @param argv - Arguments from main (argv[1] is "--serve")
+  * @return int - Exit code
+  */
+ int serverCommand(int argc, char *argv[]) {
+     bool valid = argc == 3 || (argc == 5 && strcmp(argv[3], "--data") == 0);
+     if (!valid) {
+         fprintf(stderr, "Usage: %s --serve SOCKET [--data DIR]\n", argv[0]);
+         return 1;
+     }
+     
+     #ifdef _WIN32
+         fprintf(stderr, "Error: --serve needs Unix domain sockets, which this build does not support.\n");
+         return 1;
+     #else
+         // Open the socket before changing directory, so a relative path is relative to where the server was started
+         char socket_path[4096];
+         if (argv[2][0] == '/' || getcwd(socket_path, sizeof(socket_path)) == NULL) {
+             socket_path[0] = '\0';
+         } else {
+             strncat(socket_path, "/", sizeof(socket_path) - strlen(socket_path) - 1);
+         }
+         strncat(socket_path, argv[2], sizeof(socket_path) - strlen(socket_path) - 1);
+         
+         int listener = openServerSocket(socket_path);
+         if (listener < 0) {
+             return 1;
+         }
+         if (argc == 5 && chdir(argv[4]) != 0) {
+             fprintf(stderr, "Error: Could not open data directory %s.\n", argv[4]);
+             close(listener);
+             unlink(socket_path);
+             return 1;
+         }
+         
+         initializeSystem();
+         
+         memset(&server, 0, sizeof(Server));
+         for (int i = 0; i < SERVER_MAX_CONNECTIONS; i++) {
+             server.connections[i].fd = -1;
+         }
+         pthread_mutex_init(&server.lock, NULL);
+         pthread_cond_init(&server.ready, NULL);
+         if (pipe(server.done) != 0) {
+             printf("Error: Could not create the worker pipe.\n");
+             close(listener);
+             unlink(socket_path);
+             return 1;
+         }
+         
+         // Workers block SIGINT/SIGTERM so the signals interrupt the event loop's poll()
+         sigset_t signals;
+         sigset_t previous;
+         sigemptyset(&signals);
+         sigaddset(&signals, SIGINT);
+         sigaddset(&signals, SIGTERM);
+         signal(SIGPIPE, SIG_IGN);
+         signal(SIGINT, interruptServer);
+         signal(SIGTERM, interruptServer);
+         pthread_sigmask(SIG_BLOCK, &signals, &previous);
+         
+         WorkerThread threads[MAX_WORKERS];
+         int workers = 0;
+         for (int i = 0; i < workerCount(); i++) {
+             if (startWorker(&threads[workers], serverWorker, NULL)) {
+                 workers++;
+             }
+         }
+         pthread_sigmask(SIG_SETMASK, &previous, NULL);
+         
+         if (workers == 0) {
+             printf("Error: Could not start any worker threads.\n");
+         } else {
+             printf("Serving on %s with %d worker(s). Press Ctrl+C to stop.\n", socket_path, workers);
+             fflush(stdout);
+             runServer(listener);
+         }
+         
+         pthread_mutex_lock(&server.lock);
+         server.stopping = true;
+         pthread_cond_broadcast(&server.ready);
+         pthread_mutex_unlock(&server.lock);
+         for (int i = 0; i < workers; i++) {
+             joinWorker(threads[i]);
+         }
+         
+         for (int i = 0; i < SERVER_MAX_CONNECTIONS; i++) {
+             if (server.connections[i].fd >= 0) {
+                 closeConnection(i);
+             }
+         }
+         close(listener);
+         unlink(socket_path);
+         close(server.done[0]);
+         close(server.done[1]);
+         
+         saveData();
+         printf("Server stopped.\n");
+         return 0;
+     #endif
+ }
+ 
+ #ifndef _WIN32
+ /**
+  * Listen on a Unix domain socket
+  * 
+  * A socket file left behind by a server that is no longer running is
+  * replaced; one that still accepts connections is left alone.
+  * 
+  * @param path - Socket path
+  * @return int - Listening socket, or -1 on error
+  */
+ int openServerSocket(const char *path) {
+     struct sockaddr_un address;
+     struct stat info;
+     
+     memset(&address, 0, sizeof(address));
+     address.sun_family = AF_UNIX;
+     if (strlen(path) >= sizeof(address.sun_path)) {
+         printf("Error: Socket path %s is too long.\n", path);
+         return -1;
+     }
+     strcpy(address.sun_path, path);
+     
+     int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+     if (fd < 0) {
+         printf("Error: Could not create a socket.\n");
+         return -1;
+     }
+     
+     if (stat(path, &info) == 0) {
+         if (!S_ISSOCK(info.st_mode) || connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0) {
+             printf("Error: %s is in use.\n", path);
+             close(fd);
+             return -1;
+         }
+         unlink(path);
+     }
+     
+     if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+         printf("Error: Could not listen on %s.\n", path);
+         close(fd);
+         return -1;
+     }
+     return fd;
+ }
+ 
+ /**
+  * Run the server event loop
+  * 
+  * Polls the listening socket, the idle connections and the pipe workers
+  * report finished lines on. A connection is not polled while a worker
+  * runs one of its lines, which keeps its answers in order, keeps the
+  * running line's buffer still, and stops a client that sends faster
+  * than it reads from filling memory.
+  * 
+  * @param listener - Listening socket
+  */
+ void runServer(int listener) {
+     struct pollfd polls[SERVER_MAX_CONNECTIONS + 2];
+     int slots[SERVER_MAX_CONNECTIONS + 2];
+     
+     while (!server_interrupted) {
+         int count = 0;
+         int open = 0;
+         
+         polls[count].fd = server.done[0];
+         polls[count].events = POLLIN;
+         slots[count++] = -1;
+         for (int i = 0; i < SERVER_MAX_CONNECTIONS; i++) {
+             Connection *connection = &server.connections[i];
+             if (connection->fd < 0) {
+                 continue;
+             }
+             open++;
+             if (connection->running == NULL) {
+                 polls[count].fd = connection->fd;
+                 polls[count].events = POLLIN;
+                 slots[count++] = i;
+             }
+         }
+         if (open < SERVER_MAX_CONNECTIONS) {
+             polls[count].fd = listener;
+             polls[count].events = POLLIN;
+             slots[count++] = -2;
+         }
+         
+         if (poll(polls, count, -1) < 0) {
+             if (errno == EINTR) {
+                 continue;
+             }
+             printf("Error: poll failed.\n");
+             return;
+         }
+         
+         for (int p = 0; p < count; p++) {
+             if (polls[p].revents == 0) {
+                 continue;
+             }
+             
+             if (slots[p] == -1) {
+                 // Lines finished by the workers: run the next line of each connection
+                 int finished[64];
+                 ssize_t bytes = read(server.done[0], finished, sizeof(finished));
+                 for (int k = 0; k < (int)(bytes / (ssize_t)sizeof(int)); k++) {
+                     server.connections[finished[k]].running = NULL;
+                     dispatchConnection(finished[k]);
+                 }
+             } else if (slots[p] == -2) {
+                 acceptConnection(listener);
+             } else if (server.connections[slots[p]].fd >= 0 && server.connections[slots[p]].running == NULL) {
+                 readerFill(&server.connections[slots[p]].input);
+                 dispatchConnection(slots[p]);
+             }
+         }
+     }
+ }
+ 
+ // Accept a client into a free connection slot
+ void acceptConnection(int listener) {
+     int fd = accept(listener, NULL, NULL);
+     if (fd < 0) {
+         return;
+     }
+     
+     for (int i = 0; i < SERVER_MAX_CONNECTIONS; i++) {
+         Connection *connection = &server.connections[i];
+         if (connection->fd >= 0) {
+             continue;
+         }
+         
+         int out_fd = dup(fd);
+         connection->out = out_fd >= 0 ? fdopen(out_fd, "w") : NULL;
+         if (connection->out == NULL) {
+             if (out_fd >= 0) {
+                 close(out_fd);
+             }
+             break;
+         }
+         connection->fd = fd;
+         connection->running = NULL;
+         memset(&connection->session, 0, sizeof(Session));
+         readerInit(&connection->input, fd);
+         return;
+     }
+     
+     close(fd);
+ }
+ 
+ // Queue the next line of an idle connection for a worker, closing the connection once its input is used up
+ void dispatchConnection(int slot) {
+     Connection *connection = &server.connections[slot];
+     if (connection->fd < 0 || connection->running != NULL) {
+         return;
+     }
+     
+     char *line = connection->session.quit ? NULL : readerNext(&connection->input);
+     if (line == NULL) {
+         if (connection->session.quit || connection->input.eof) {
+             closeConnection(slot);
+         }
+         return;
+     }
+     connection->running = line;
+     connection->too_long = connection->input.too_long;
+     
+     pthread_mutex_lock(&server.lock);
+     server.queue[(server.queue_head + server.queue_count) % SERVER_MAX_CONNECTIONS] = slot;
+     server.queue_count++;
+     pthread_cond_signal(&server.ready);
+     pthread_mutex_unlock(&server.lock);
+ }
+ 
+ // Close a connection and free its slot
+ void closeConnection(int slot) {
+     Connection *connection = &server.connections[slot];
+     
+     fclose(connection->out);
+     close(connection->fd);
+     readerFree(&connection->input);
+     memset(connection, 0, sizeof(Connection));
+     connection->fd = -1;
+ }
+ 
+ // Run queued command lines, sending each answer and reporting the connection back to the event loop
+ WORKER_RESULT serverWorker(void *arg) {
+     (void)arg;
+     
+     while (true) {
+         pthread_mutex_lock(&server.lock);
+         while (server.queue_count == 0 && !server.stopping) {
+             pthread_cond_wait(&server.ready, &server.lock);
+         }
+         if (server.queue_count == 0) {
+             pthread_mutex_unlock(&server.lock);
+             break;
+         }
+         int slot = server.queue[server.queue_head];
+         server.queue_head = (server.queue_head + 1) % SERVER_MAX_CONNECTIONS;
+         server.queue_count--;
+         pthread_mutex_unlock(&server.lock);
+         
+         Connection *connection = &server.connections[slot];
+         runCommandLine(&connection->session, connection->running, connection->too_long, connection->out);
+         fflush(connection->out);
+         
+         if (write(server.done[1], &slot, sizeof(int)) != sizeof(int)) {
+             printf("Error: Could not report a finished command.\n");
+         }
+     }
+     return WORKER_RETURN;
+ }
+ 
+ // Stop the server on SIGINT/SIGTERM (the event loop checks the flag when poll() is interrupted)
+ void interruptServer(int signal_number) {
+     (void)signal_number;
+     server_interrupted = 1;
+ }
+ #endif
+ 
+ /**
+  * Run the headless simulation command
+  * 
+  * Handles "--simulate CUSTOMERS MONTHS [--seed SEED] [--data DIR]". The
+  * simulation works on the data files of DIR (default: the working
+  * directory), creating them if they do not exist.
+  * 
+  * @param argc - Argument count from main
+  * @param argv - Arguments from main (argv[1] is "--simulate")
+  * @return int - Exit code
+  */
+ int simulationCommand(int argc, char *argv[]) {
+     int customers = argc > 2 ? atoi(argv[2]) : 0;
+     int months = argc > 3 ? atoi(argv[3]) : 0;
+     uint64_t seed = 0;
+     bool seed_given = false;
+     const char *data_directory = NULL;
+     bool valid = argc >= 4 && customers >= 0 && months > 0;
+     
+     for (int i = 4; i < argc && valid; i += 2) {
+         if (i + 1 >= argc) {
+             valid = false;
+         } else if (strcmp(argv[i], "--seed") == 0) {
+             char *end;
+             seed = strtoull(argv[i + 1], &end, 0);
+             seed_given = true;
+             valid = *end == '\0';
+         } else if (strcmp(argv[i], "--data") == 0) {
+             data_directory = argv[i + 1];
+         } else {
+             valid = false;
+         }
+     }
+     
+     if (!valid) {
+         printf("Usage: %s --simulate CUSTOMERS MONTHS [--seed SEED] [--data DIR]\n", argv[0]);
+         return 1;
+     }
+     
+     #ifdef _WIN32
+         if (data_directory != NULL && _chdir(data_directory) != 0) {
+     #else
+         if (data_directory != NULL && chdir(data_directory) != 0) {
+     #endif
+         printf("Error: Could not open data directory %s.\n", data_directory);
+         return 1;
+     }
+     
+     initializeSystem();
+     return runSimulation(customers, months, seed_given ? seed : newRunSeed());
+ }
+ 
+ /**
+  * Run a headless simulation
+  * 
+  * Registers customer accounts (user, customer, payment card and premises),
+  * then runs months of billing, payments and meter surrenders on a simulated
+  * calendar that starts at the month after the latest month already billed
+  * (the current month if nothing has been billed), so that bill dates
+  * follow on from the billing months in the premises ledger. Runs of more
+  * than a year cross year ends. Each month every active premises is billed on the 1st,
+  * customers pay towards their latest unpaid bill on the 15th and a few
+  * premises with nothing owing are surrendered on the 28th. Every random
+  * choice comes from streams derived from the seed, so the same seed and
+  * starting data give the same bills and payments. Activity logs are not
+  * written.
+  * 
+  * @param customers - Number of customers to register
+  * @param months - Number of months to run
+  * @param seed - Seed of the simulation
+  * @return int - Exit code (0 if every step was saved)
+  */
+ int runSimulation(int customers, int months, uint64_t seed) {
+     char today[11];
+     int start_year, start_month;
+     RandomStream stream;
+     uint64_t month_seeds = seed;
+     long bills = 0, skipped = 0, payments = 0, surrenders = 0;
+     double billing_seconds = 0.0, payment_seconds = 0.0;
+     bool saved = true;
+     
+     getCurrentDate(today);
+     sscanf(today, "%d-%d", &start_year, &start_month);
+     randomSeed(&stream, seed, 0);
+     
+     // Continue from the latest month billed by an earlier run
+     int last_year = 0, last_month = 0;
+     for (int i = 0; i < ledger_table.count; i++) {
+         const PremisesLedger *ledger = ledgerAt(i);
+         if (ledger->last_month > 0 && ledger->last_year * 12 + ledger->last_month > last_year * 12 + last_month) {
+             last_year = ledger->last_year;
+             last_month = ledger->last_month;
+         }
+     }
+     if (last_month > 0) {
+         start_year = last_year;
+         start_month = last_month + 1;
+     }
+     
+     printf("\n=== Simulation: %d customer(s), %d month(s), seed %016" PRIx64 " ===\n", customers, months, seed);
+     
+     double started = monotonicSeconds();
+     int registered = simulateRegistrations(&stream, customers);
+     double registration_seconds = monotonicSeconds() - started;
+     if (registered < customers) {
+         saved = false;
+     }
+     printf("Registered %d customer(s) in %.2f second(s)\n", registered, registration_seconds);
+     
+     for (int month = 0; month < months && saved; month++) {
+         // Billing on the 1st
+         BillingTotals totals;
+         setSimulationDate(start_year, start_month + month, 1);
+         started = monotonicSeconds();
+         saved = billActivePremises(splitMix64(&month_seeds), &totals);
+         billing_seconds += monotonicSeconds() - started;
+         bills += totals.billed;
+         skipped += totals.skipped;
+         
+         // Payments on the 15th
+         setSimulationDate(start_year, start_month + month, 15);
+         started = monotonicSeconds();
+         int paid = saved ? simulatePayments(&stream) : -1;
+         payment_seconds += monotonicSeconds() - started;
+         saved = saved && paid >= 0;
+         payments += paid > 0 ? paid : 0;
+         
+         // Surrenders on the 28th
+         setSimulationDate(start_year, start_month + month, 28);
+         int surrendered = saved ? simulateSurrenders(&stream) : -1;
+         saved = saved && surrendered >= 0;
+         surrenders += surrendered > 0 ? surrendered : 0;
+         
+         printf("%.7s: %d billed, %d skipped, %d paid, %d surrendered\n",
+                simulation_date, totals.billed, totals.skipped, paid, surrendered);
+     }
+     
+     simulation_date[0] = '\0';
+     saveData();
+     
+     if (!saved) {
+         printf("Error: Could not save simulation data. The simulation stopped early.\n");
+     }
+     
+     printf("\n=== Simulation Summary ===\n");
+     printf("Customers registered: %d (%.0f/sec)\n", registered,
+            registration_seconds > 0 ? registered / registration_seconds : 0.0);
+     printf("Bills generated: %ld in %.2f second(s) (%.0f bills/sec)\n", bills, billing_seconds,
+            billing_seconds > 0 ? bills / billing_seconds : 0.0);
+     printf("Bills skipped (two or more unpaid bills): %ld\n", skipped);
+     printf("Payments made: %ld in %.2f second(s) (%.0f payments/sec)\n", payments, payment_seconds,
+            payment_seconds > 0 ? payments / payment_seconds : 0.0);
+     printf("Meters surrendered: %ld\n", surrenders);
+     
+     const char *files[] = { FILE_USERS, FILE_CUSTOMERS, FILE_PREMISES, FILE_PAYMENT_CARDS, FILE_BILLS,
+                             FILE_PAYMENTS, FILE_BILL_INDEX, FILE_LEDGER, FILE_BILLING_RUNS,
+                             FILE_PAID_VIEW, FILE_OWING_VIEW, FILE_ARCHIVED_VIEW, FILE_ID_COUNTER, FILE_JOURNAL };
+     long total_size = 0;
+     printf("\nData files:\n");
+     for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+         long size = fileSize(files[i]);
+         printf("  %-20s %14ld bytes\n", files[i], size > 0 ? size : 0);
+         total_size += size > 0 ? size : 0;
+     }
+     printf("  %-20s %14ld bytes\n", "Total", total_size);
+     
+     return saved ? 0 : 1;
+ }
+ 
+ /**
+  * Register simulated customers
+  * 
+  * Gives each customer a user account, a payment card and one premises with
+  * the next unused customer and premises numbers. Users and cards are
+  * appended with one write per batch and the customers, premises and ledger
+  * rows committed as one journal group per batch.
+  * 
+  * @param stream - Random stream for income classes, meters and readings
+  * @param count - Number of customers to register
+  * @return int - Number of customers registered
+  */
+ int simulateRegistrations(RandomStream *stream, int count) {
+     int registered = 0;
+     
+     User *users = malloc(sizeof(User) * SIM_COMMIT_BATCH);
+     PaymentCard *cards = malloc(sizeof(PaymentCard) * SIM_COMMIT_BATCH);
+     if (users == NULL || cards == NULL) {
+         printf("Error: Out of memory while registering customers.\n");
+         free(users);
+         free(cards);
+         return 0;
+     }
+     
+     while (registered < count) {
+         int batch = 0;
+         
+         while (batch < SIM_COMMIT_BATCH && registered + batch < count) {
+             Customer customer;
+             Premises premises;
+             PremisesLedger ledger;
+             User *user = &users[batch];
+             memset(&customer, 0, sizeof(Customer));
+             memset(&premises, 0, sizeof(Premises));
+             memset(&ledger, 0, sizeof(PremisesLedger));
+             memset(user, 0, sizeof(User));
+             
+             // Next unused customer number (with an unused email) and premises number
+             bool allocated;
+             do {
+                 allocated = allocateNumber(&customer_numbers, customer.customer_number);
+                 sprintf(user->email, "sim%s@nwc.sim", customer.customer_number);
+             } while (allocated && isEmailExists(user->email));
+             
+             if (!allocated || !allocateNumber(&premises_numbers, premises.premises_number)) {
+                 printf("Error: No unused customer or premises numbers left.\n");
+                 count = registered + batch;
+                 break;
+             }
+             
+             user->id = allocateUserId();
+             strcpy(user->password, "password");
+             user->type = CUSTOMER;
+             user->is_active = true;
+             
+             strcpy(customer.first_name, "Sim");
+             strcpy(customer.last_name, customer.customer_number);
+             customer.user_id = user->id;
+             customer.income_class = (IncomeClass)(1 + randomBelow(stream, 5));
+             customer.is_active = true;
+             customer.has_payment_card = true;
+             
+             // Mostly domestic 15mm meters, a few larger ones
+             uint32_t meter_roll = randomBelow(stream, 100);
+             strcpy(premises.customer_number, customer.customer_number);
+             premises.meter_size = meter_roll < 90 ? METER_15MM : (meter_roll < 99 ? METER_30MM : METER_150MM);
+             premises.initial_reading = (int)randomBelow(stream, 10000);
+             premises.previous_reading = premises.initial_reading;
+             premises.current_reading = premises.initial_reading;
+             premises.is_active = true;
+             strcpy(ledger.premises_number, premises.premises_number);
+             
+             memset(&cards[batch], 0, sizeof(PaymentCard));
+             strcpy(cards[batch].customer_number, customer.customer_number);
+             sprintf(cards[batch].card_identifier, "%04u", randomBelow(stream, 10000));
+             cards[batch].is_active = true;
+             
+             journalStage(JOURNAL_CUSTOMERS, customer_table.count + batch, &customer, sizeof(Customer));
+             journalStage(JOURNAL_PREMISES, premises_table.count + batch, &premises, sizeof(Premises));
+             journalStage(JOURNAL_LEDGER, premises_table.count + batch, &ledger, sizeof(PremisesLedger));
+             batch++;
+         }
+         
+         if (batch == 0) {
+             break;
+         }
+         
+         FILE *file = openAppend(FILE_PAYMENT_CARDS);
+         bool cards_written = file != NULL && fwrite(cards, sizeof(PaymentCard), batch, file) == (size_t)batch;
+         if (file != NULL) {
+             fclose(file);
+         }
+         
+         stageUsers(users, batch);
+         if (!cards_written || !journalCommit()) {
+             printf("Error: Could not save registered customers.\n");
+             break;
+         }
+         registered += batch;
+     }
+     
+     free(users);
+     free(cards);
+     return registered;
+ }
+ 
+ /**
+  * Simulate a month of payments
+  * 
+  * Each premises with unpaid bills pays towards its latest unpaid bill, as
+  * payBill does: in full (sometimes with a little over), half of it, or not
+  * at all. The payments, bills, ledger rows and report view rows are
+  * committed as one journal group.
+  * 
+  * @param stream - Random stream for the payment choices
+  * @return int - Number of payments made (-1 if they could not be saved)
+  */
+ int simulatePayments(RandomStream *stream) {
+     MappedFile bills;
+     if (!mapRecordFile(FILE_BILLS, sizeof(Bill), &bills)) {
+         return 0;
+     }
+     
+     int count = 0;
+     for (int i = 0; i < premises_table.count; i++) {
+         if (ledgerAt(i)->unpaid_count == 0 || !premisesAt(i)->is_active) {
+             continue;
+         }
+         
+         // Find the latest unpaid bill of the premises
+         const Premises *premises = premisesAt(i);
+         BillIndexBucket *bucket = findBillBucket(premises->customer_number, premises->premises_number);
+         int32_t record = -1;
+         for (int k = bucket != NULL ? bucket->count - 1 : -1; k >= 0 && record < 0; k--) {
+             if (bucket->records[k] < bills.count && !((const Bill *)bills.data)[bucket->records[k]].is_paid) {
+                 record = bucket->records[k];
+             }
+         }
+         
+         uint32_t roll = randomBelow(stream, 100);
+         if (record < 0 || roll >= SIM_PAY_FULL_PERCENT + SIM_PAY_PART_PERCENT) {
+             continue;
+         }
+         
+         Bill unpaid_bill = ((const Bill *)bills.data)[record];
+         Money amount = billBalance(&unpaid_bill);
+         if (roll >= SIM_PAY_FULL_PERCENT) {
+             amount /= 2;
+         } else if (randomBelow(stream, 100) < SIM_OVERPAY_PERCENT) {
+             amount += (Money)(1 + randomBelow(stream, 100)) * CENTS_PER_DOLLAR;
+         }
+         if (amount <= 0) {
+             continue;
+         }
+         
+         Bill paid_bill = unpaid_bill;
+         paid_bill.amount_paid = moneyToDouble(moneyFromDouble(paid_bill.amount_paid) + amount);
+         paid_bill.is_paid = billBalance(&paid_bill) <= 0;
+         
+         PremisesLedger updated_ledger = *ledgerAt(i);
+         ledgerRecordBill(&updated_ledger, &unpaid_bill, &paid_bill);
+         journalStage(JOURNAL_BILLS, record, &paid_bill, sizeof(Bill));
+         journalStage(JOURNAL_LEDGER, i, &updated_ledger, sizeof(PremisesLedger));
+         stageReportViews(record, &unpaid_bill, &paid_bill);
+         
+         Payment payment;
+         memset(&payment, 0, sizeof(Payment));
+         generateID(payment.payment_id, "PMT");
+         strcpy(payment.bill_id, paid_bill.bill_id);
+         strcpy(payment.customer_number, paid_bill.customer_number);
+         strcpy(payment.premises_number, paid_bill.premises_number);
+         payment.amount = moneyToDouble(amount);
+         getCurrentDate(payment.payment_date);
+         journalStage(JOURNAL_PAYMENTS, -1, &payment, sizeof(Payment));
+         count++;
+     }
+     unmapRecordFile(&bills);
+     
+     return journalCommit() ? count : -1;
+ }
+ 
+ /**
+  * Simulate a month of meter surrenders
+  * 
+  * Surrenders SIM_SURRENDER_PER_MILLE in a thousand of the active premises
+  * that owe nothing (the same rule surrenderMeter enforces), committing them
+  * as one journal group.
+  * 
+  * @param stream - Random stream for the surrender choices
+  * @return int - Number of meters surrendered (-1 if they could not be saved)
+  */
+ int simulateSurrenders(RandomStream *stream) {
+     int count = 0;
+     
+     for (int i = 0; i < premises_table.count; i++) {
+         if (premisesAt(i)->is_active && ledgerAt(i)->unpaid_count == 0 &&
+             randomBelow(stream, 1000) < SIM_SURRENDER_PER_MILLE) {
+             Premises surrendered = *premisesAt(i);
+             surrendered.is_active = false;
+             journalStage(JOURNAL_PREMISES, i, &surrendered, sizeof(Premises));
+             count++;
+         }
+     }
+     
+     return journalCommit() ? count : -1;
+ }
+ 
+ // Set the simulation clock to a day of a month (months past 12 roll into later years)
+ void setSimulationDate(int year, int month, int day) {
+     struct tm tm_info;
+     memset(&tm_info, 0, sizeof(struct tm));
+     tm_info.tm_year = year - 1900;
+     tm_info.tm_mon = month - 1;
+     tm_info.tm_mday = day;
+     tm_info.tm_hour = 12;
+     mktime(&tm_info);
+     
+     strftime(simulation_date, sizeof(simulation_date), "%Y-%m-%d", &tm_info);
+ }
+ 
+ // Load data from files
+ void loadData() {
+     // Load customers and premises (mapped in place, no per-record reads)
+     tableLoad(&customer_table, sizeof(Customer), FILE_CUSTOMERS);
+     tableLoad(&premises_table, sizeof(Premises), FILE_PREMISES);
+     
+     // Load users and build the authentication indexes
+     tableLoad(&user_table, sizeof(User), FILE_USERS);
+     buildLookupIndexes();
+     
+     // Count the billing runs logged and payments made so far
+     billing_run_count = (int)countRecords(FILE_BILLING_RUNS, sizeof(BillingRunRecord));
+     payment_count = (int32_t)countRecords(FILE_PAYMENTS, sizeof(Payment));
+ }
+ 
+ // Create the designated agent accounts if they don't exist and show their credentials
+ void createAgentAccounts() {
+     User *admin_user = findUserByEmail("admin@nwc.com");
+     User *agent_user = findUserByEmail("agent@nwc.com");
+     bool admin_exists = admin_user != NULL && admin_user->type == AGENT;
+     bool agent_exists = agent_user != NULL && agent_user->type == AGENT;
+     
+     // Create admin account
+     if (!admin_exists) {
+         User admin;
+         memset(&admin, 0, sizeof(User));
+         admin.id = 1;
+         strcpy(admin.email, "admin@nwc.com");
+         strcpy(admin.password, "admin123");
+         admin.type = AGENT;
+         admin.is_active = true;
+         stageUsers(&admin, 1);
+     }
+     
+     // Create agent account
+     if (!agent_exists) {
+         User agent;
+         memset(&agent, 0, sizeof(User));
+         agent.id = 2;
+         strcpy(agent.email, "agent@nwc.com");
+         strcpy(agent.password, "agent123");
+         agent.type = AGENT;
+         agent.is_active = true;
+         stageUsers(&agent, 1);
+     }
+     journalCommit();
+     
+     printf("Agent Login Credentials:\n");
+     printf("Email: admin@nwc.com\nPassword: admin123\n\n");
+     printf("Email: agent@nwc.com\nPassword: agent123\n\n");
+ }
+ 
+ /**
+  * Save data to files
+  * 
+  * Every change is already durable in the journal, so saving commits any
+  * staged records and checkpoints the journal into the base data files.
+  */
+ void saveData() {
+     journalCommit();
+     checkpointJournal();
+ }
+ 
+ // Generate a unique ID with prefix (e.g., BILL-0679A8E2400001), 14 hex digits that sort by creation time
+ void generateID(char *id, const char *prefix) {
+     sprintf(id, "%s-%014" PRIX64, prefix, nextId());
+ }
+ 
+ /**
+  * Issue the next unique ID
+  * 
+  * Hands out the calling thread's claimed block in order, claiming a new
+  * block from the shared counter when it runs out. A block starts at the
+  * later of the shared counter and the current second, so IDs increase
+  * with time and never repeat, even if the clock goes back or more than
+  * 2^ID_SEQUENCE_BITS IDs are issued in a second. A block is only used
+  * once id_counter.txt records a ceiling above it, so IDs are not reused
+  * after a restart.
+  * 
+  * @return uint64_t - New ID
+  */
+ uint64_t nextId() {
+     while (id_block.next == id_block.end) {
+         uint64_t claimed = atomicLoad64(&id_service.next);
+         uint64_t now = (uint64_t)time(NULL) << ID_SEQUENCE_BITS;
+         uint64_t start = claimed > now ? claimed : now;
+         if (!atomicCompareSwap64(&id_service.next, claimed, start + ID_BLOCK_SIZE)) {
+             continue;
+         }
+         
+         // reserved is read before floor, which reserveIds raises first
+         bool owned = start + ID_BLOCK_SIZE <= atomicLoad64(&id_service.reserved) &&
+                      start >= atomicLoad64(&id_service.floor);
+         if (!owned && !reserveIds(start, start + ID_BLOCK_SIZE, &owned)) {
+             printf("Error: Could not update %s.\n", FILE_ID_COUNTER);
+             exit(1);
+         }
+         if (owned) {
+             id_block.next = start;
+             id_block.end = start + ID_BLOCK_SIZE;
+         }
+     }
+     
+     return id_block.next++;
+ }
+ 
+ // Load the ID ceiling from id_counter.txt so IDs issued before a restart are never reissued
+ void loadIdCounter() {
+     uint64_t reserved = 0;
+     FILE *file = fopen(FILE_ID_COUNTER, "rb");
+     if (file != NULL) {
+         if (fread(&reserved, sizeof(uint64_t), 1, file) != 1) {
+             reserved = 0;
+         }
+         fclose(file);
+     }
+     
+     id_service.next = reserved;
+     id_service.floor = reserved;
+     id_service.reserved = reserved;
+     id_block.next = 0;
+     id_block.end = 0;
+ }
+ 
+ /**
+  * Reserve a claimed block of IDs in id_counter.txt
+  * 
+  * Raises the persisted ceiling to at least end (plus ID_RESERVE_SIZE
+  * spare IDs). If another process has reserved IDs since this one last
+  * did, its range is skipped: this process's range restarts at the new
+  * ceiling, a block that overlaps the other range is refused and the
+  * shared counter is moved past it so the caller can claim again.
+  * 
+  * @param start - First ID of the claimed block
+  * @param end - One past the last ID of the claimed block
+  * @param owned - Receives true if the block may be issued
+  * @return bool - False if id_counter.txt could not be updated
+  */
+ bool reserveIds(uint64_t start, uint64_t end, bool *owned) {
+     bool reserved = true;
+     
+     lockShared(&id_service.lock);
+     lockDataFile(LOCK_IDS);
+     
+     uint64_t ceiling = 0;
+     FILE *file = fopen(FILE_ID_COUNTER, "rb");
+     if (file != NULL) {
+         if (fread(&ceiling, sizeof(uint64_t), 1, file) != 1) {
+             ceiling = 0;
+         }
+         fclose(file);
+     }
+     if (ceiling > id_service.reserved) {
+         atomicStore64(&id_service.floor, ceiling);
+         atomicStore64(&id_service.reserved, ceiling);
+     }
+     
+     if (start >= id_service.floor && end > id_service.reserved) {
+         ceiling = end + ID_RESERVE_SIZE;
+         file = fopen(FILE_ID_COUNTER, "wb");
+         reserved = file != NULL && fwrite(&ceiling, sizeof(uint64_t), 1, file) == 1;
+         if (file != NULL) {
+             reserved = syncFile(file) && reserved;
+             fclose(file);
+         }
+         if (reserved) {
+             atomicStore64(&id_service.reserved, ceiling);
+         }
+     }
+     
+     *owned = reserved && start >= id_service.floor && end <= id_service.reserved;
+     if (!*owned) {
+         uint64_t claimed;
+         do {
+             claimed = atomicLoad64(&id_service.next);
+         } while (claimed < id_service.floor && !atomicCompareSwap64(&id_service.next, claimed, id_service.floor));
+     }
+     
+     unlockDataFile(LOCK_IDS);
+     unlockShared(&id_service.lock);
+     
+     return reserved;
+ }
+ 
+ // Get current date in YYYY-MM-DD format
+ void getCurrentDate(char *date) {
+     if (simulation_date[0] != '\0') {
+         strcpy(date, simulation_date);
+         return;
+     }
+     
+     // localtime_r/localtime_s, since server workers ask for the date at the same time
+     time_t t = time(NULL);
+     struct tm tm_info;
+     #ifdef _WIN32
+         localtime_s(&tm_info, &t);
+     #else
+         localtime_r(&t, &tm_info);
+     #endif
+     
+     strftime(date, 11, "%Y-%m-%d", &tm_info);
+ }
+ 
+ // Add days to a YYYY-MM-DD date
+ void addDays(const char *date, int days, char *result) {
+     struct tm tm_info;
+     memset(&tm_info, 0, sizeof(struct tm));
+     sscanf(date, "%d-%d-%d", &tm_info.tm_year, &tm_info.tm_mon, &tm_info.tm_mday);
+     tm_info.tm_year -= 1900;
+     tm_info.tm_mon -= 1;
+     tm_info.tm_mday += days;
+     tm_info.tm_hour = 12; // Midday, clear of daylight saving changes
+     mktime(&tm_info);
+     
+     strftime(result, 11, "%Y-%m-%d", &tm_info);
+ }
+ 
+ // Seconds on a monotonic clock (for measuring throughput)
+ double monotonicSeconds() {
+     #ifdef _WIN32
+         LARGE_INTEGER frequency, counter;
+         QueryPerformanceFrequency(&frequency);
+         QueryPerformanceCounter(&counter);
+         return (double)counter.QuadPart / (double)frequency.QuadPart;
+     #else
+         struct timespec now;
+         clock_gettime(CLOCK_MONOTONIC, &now);
+         return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+     #endif
+ }
+ 
+ // Advance a SplitMix64 generator and return its next output (used to seed streams)
+ uint64_t splitMix64(uint64_t *state) {
+     uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+     z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+     z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+     return z ^ (z >> 31);
+ }
+ 
+ /**
+  * Seed a random stream
+  * 
+  * Streams with the same seed but different stream IDs are independent, so
+  * each bill (or worker) can own a stream without sharing generator state,
+  * and a stream can always be recreated from its seed and ID.
+  * 
+  * @param stream - Stream to seed
+  * @param seed - Seed of the run
+  * @param stream_id - Identifies the stream within the run (e.g. a packed premises number)
+  */
+ void randomSeed(RandomStream *stream, uint64_t seed, uint64_t stream_id) {
+     uint64_t state = seed ^ splitMix64(&stream_id);
+     for (int i = 0; i < 4; i++) {
+         stream->state[i] = splitMix64(&state);
+     }
+ }
+ 
+ // Next 64 random bits of a stream (xoshiro256**)
+ uint64_t randomNext(RandomStream *stream) {
+     uint64_t *s = stream->state;
+     uint64_t x = s[1] * 5;
+     uint64_t result = ((x << 7) | (x >> 57)) * 9;
+     uint64_t t = s[1] << 17;
+     
+     s[2] ^= s[0];
+     s[3] ^= s[1];
+     s[1] ^= s[2];
+     s[0] ^= s[3];
+     s[2] ^= t;
+     s[3] = (s[3] << 45) | (s[3] >> 19);
+     
+     return result;
+ }
+ 
+ // Random number in [0, bound) without modulo bias (multiply and reject, bound > 0)
+ uint32_t randomBelow(RandomStream *stream, uint32_t bound) {
+     uint64_t product = (randomNext(stream) >> 32) * bound;
+     
+     if ((uint32_t)product < bound) {
+         uint32_t threshold = (0U - bound) % bound;
+         while ((uint32_t)product < threshold) {
+             product = (randomNext(stream) >> 32) * bound;
+         }
+     }
+     
+     return (uint32_t)(product >> 32);
+ }
+ 
+ /**
+  * Generate daily meter usage
+  * 
+  * Fills usage with one reading in [0, daily_limit] per day. Each 64-bit
+  * output of the stream supplies two days, and the rejection threshold that
+  * keeps the readings unbiased is worked out once for the whole batch.
+  * 
+  * @param stream - Random stream to draw from
+  * @param daily_limit - Most litres used in one day
+  * @param usage - Receives the daily readings
+  * @param days - Number of days to generate
+  */
+ void generateDailyUsage(RandomStream *stream, int daily_limit, int *usage, int days) {
+     uint32_t bound = (uint32_t)daily_limit + 1;
+     uint32_t threshold = (0U - bound) % bound;
+     uint64_t bits = 0;
+     int halves = 0;
+     
+     for (int day = 0; day < days; ) {
+         if (halves == 0) {
+             bits = randomNext(stream);
+             halves = 2;
+         }
+         uint64_t product = (bits & 0xffffffffULL) * bound;
+         bits >>= 32;
+         halves--;
+         
+         if ((uint32_t)product >= threshold) {
+             usage[day++] = (int)(product >> 32);
+         }
+     }
+ }
+ 
+ // Pick a fresh seed for a billing run (recorded in the billing runs log)
+ uint64_t newRunSeed() {
+     uint64_t state = (uint64_t)time(NULL) ^ ((uint64_t)clock() << 32) ^ ((uint64_t)billing_run_count << 48);
+     return splitMix64(&state);
+ }
+ 
+ // Stage a billing runs log record with the bills it describes
+ void stageBillingRun(uint64_t seed, int32_t first_record, int bill_count) {
+     BillingRunRecord run;
+     memset(&run, 0, sizeof(BillingRunRecord));
+     run.seed = seed;
+     run.first_record = first_record;
+     run.bill_count = bill_count;
+     getCurrentDate(run.run_date);
+     
+     journalStage(JOURNAL_RUNS, billing_run_count, &run, sizeof(BillingRunRecord));
+ }
+ 
+ // Round a stored dollar amount to whole cents (half away from zero)
+ Money moneyFromDouble(double amount) {
+     double cents = amount * CENTS_PER_DOLLAR;
+     return (Money)(cents < 0 ? cents - 0.5 : cents + 0.5);
+ }
+ 
+ // Convert cents to the dollar amount stored in record files
+ double moneyToDouble(Money amount) {
+     return (double)amount / CENTS_PER_DOLLAR;
+ }
+ 
+ /**
+  * Apply a tariff rate to an amount
+  * 
+  * Multiplies in integers and rounds the product to whole cents, half away
+  * from zero, so credits such as the X-Factor round the same way as charges.
+  * 
+  * @param amount - Amount in cents
+  * @param rate - Rate in parts per RATE_SCALE (may be negative)
+  * @return Money - Rated amount in cents
+  */
+ Money applyRate(Money amount, int64_t rate) {
+     int64_t product = amount * rate;
+     int64_t half = RATE_SCALE / 2;
+     return product < 0 ? -((-product + half) / RATE_SCALE) : (product + half) / RATE_SCALE;
+ }
+ 
+ // Amount still owed on a bill (negative if it was overpaid)
+ Money billBalance(const Bill *bill) {
+     return moneyFromDouble(bill->total_amount_due) - moneyFromDouble(bill->amount_paid);
+ }
+ 
+ /**
+  * Parse a fixed-point decimal number
+  * 
+  * Reads an optional sign, digits and at most the given number of decimal
+  * places, skipping leading whitespace, without going through floating
+  * point. "12.5" with 2 decimals gives 1250.
+  * 
+  * @param text - Text to parse
+  * @param decimals - Decimal places of the result
+  * @param value - Receives the number scaled by 10^decimals
+  * @param end - Receives the position after the number (may be NULL)
+  * @return bool - False if there is no number, it has too many decimal
+  *         places, or it is out of range
+  */
+ bool parseFixed(const char *text, int decimals, int64_t *value, const char **end) {
+     bool negative = false;
+     bool digits = false;
+     int64_t result = 0;
+     int places = -1; // Decimal places read (-1 until the decimal point)
+     
+     while (isspace((unsigned char)*text)) {
+         text++;
+     }
+     if (*text == '-' || *text == '+') {
+         negative = *text == '-';
+         text++;
+     }
+     
+     for (; isdigit((unsigned char)*text) || (*text == '.' && places < 0); text++) {
+         if (*text == '.') {
+             places = 0;
+             continue;
+         }
+         if (places >= 0 && ++places > decimals) {
+             return false;
+         }
+         if (result > (INT64_MAX - 9) / 10) {
+             return false;
+         }
+         result = result * 10 + (*text - '0');
+         digits = true;
+     }
+     
+     if (!digits) {
+         return false;
+     }
+     for (int i = places < 0 ? 0 : places; i < decimals; i++) {
+         if (result > INT64_MAX / 10) {
+             return false;
+         }
+         result *= 10;
+     }
+     
+     *value = negative ? -result : result;
+     if (end != NULL) {
+         *end = text;
+     }
+     return true;
+ }
+ 
+ // Parse a dollar amount such as "1250.75" into cents (nothing else may follow)
+ bool parseMoney(const char *text, Money *amount) {
+     const char *end;
+     
+     if (!parseFixed(text, 2, amount, &end)) {
+         return false;
+     }
+     while (isspace((unsigned char)*end)) {
+         end++;
+     }
+     return *end == '\0';
+ }
+ 
+ /**
+  * Build the rating table of a tiered tariff
+  * 
+  * Precomputes the charge for all consumption below each tier so a
+  * consumption can be rated with one tier lookup and one multiply. A rate in
+  * cents per cubic metre is also thousandths of a cent per litre, so the
+  * bases are exact integers and rounding happens once, on the final charge.
+  * 
+  * @param tariff - Receives the rating table
+  * @param lower - First litre of each tier (lower[0] must be 0)
+  * @param rate - Rate of each tier in cents per cubic metre
+  */
+ void buildTariffTiers(TariffTiers *tariff, const int *lower, const Money *rate) {
+     int64_t base = 0;
+     
+     for (int t = 0; t < TARIFF_TIERS; t++) {
+         if (t > 0) {
+             base += (int64_t)(lower[t] - lower[t - 1]) * rate[t - 1];
+         }
+         tariff->lower[t] = lower[t];
+         tariff->rate[t] = rate[t];
+         tariff->base[t] = base;
+     }
+ }
+ 
+ /**
+  * Build the built-in tariff schedule
+  * 
+  * Used when tariffs.txt is missing or cannot be loaded, so billing always
+  * has a schedule. It holds the rates the platform launched with.
+  * 
+  * @param schedule - Receives the schedule
+  */
+ void buildDefaultTariff(TariffSchedule *schedule) {
+     static const int lower[TARIFF_TIERS] = { 0, 14000, 27000, 41000 };
+     static const Money water_rate[TARIFF_TIERS] = { 14955, 26615, 29010, 49487 };
+     static const Money sewerage_rate[TARIFF_TIERS] = { 17272, 30742, 33506, 57156 };
+     
+     memset(schedule, 0, sizeof(TariffSchedule));
+     strcpy(schedule->effective_date, "0000-01-01");
+     buildTariffTiers(&schedule->water, lower, water_rate);
+     buildTariffTiers(&schedule->sewerage, lower, sewerage_rate);
+     schedule->service_charge[METER_15MM - 1] = 115592;
+     schedule->service_charge[METER_30MM - 1] = 621703;
+     schedule->service_charge[METER_150MM - 1] = 3935459;
+     schedule->pam_rate = 12100;     // 1.21%
+     schedule->x_factor_rate = -50000; // -5%
+     schedule->k_factor_rate = 200000; // 20%
+ }
+ 
+ // Order tariff schedules by effective date (qsort callback)
+ int compareTariffSchedules(const void *a, const void *b) {
+     return strcmp(((const TariffSchedule *)a)->effective_date, ((const TariffSchedule *)b)->effective_date);
+ }
+ 
+ // Read up to max fixed-point numbers following a keyword on a schedule line (returns how many were read)
+ int parseTariffValues(const char *text, int64_t *values, int max, int decimals) {
+     int count = 0;
+     const char *end;
+     
+     while (count <= max) {
+         int64_t value;
+         if (!parseFixed(text, decimals, &value, &end)) {
+             break;
+         }
+         if (count < max) {
+             values[count] = value;
+         }
+         count++;
+         text = end;
+     }
+     
+     // Anything other than whitespace after the numbers makes the line invalid
+     while (isspace((unsigned char)*text)) {
+         text++;
+     }
+     return *text == '\0' ? count : -1;
+ }
+ 
+ /**
+  * Load the tariff schedules
+  * 
+  * Reads tariffs.txt and compiles every schedule into the flat rating
+  * tables billing uses, sorted by effective date. A schedule starts with an
+  * "effective YYYY-MM-DD" line followed by one line per setting:
+  * 
+  *   tiers     first litre of each of the 4 consumption tiers (0 first)
+  *   water     water rate per cubic metre in each tier
+  *   sewerage  sewerage rate per cubic metre in each tier
+  *   service   monthly service charge for 15mm, 30mm and 150mm meters
+  *   pam       PAM rate (fraction of water, sewerage and service)
+  *   x_factor  X-Factor rate (fraction of water, sewerage and service)
+  *   k_factor  K-Factor rate (fraction of water, sewerage, service and PAM)
+  * 
+  * Text after '#' is a comment. If the file is missing the built-in
+  * schedule is used; if it is invalid, an error is reported and the
+  * built-in schedule is used rather than a partial one.
+  */
+ void loadTariffSchedules() {
+     free(tariff_schedules);
+     tariff_schedules = NULL;
+     tariff_schedule_count = 0;
+     
+     FILE *file = fopen(FILE_TARIFFS, "r");
+     TariffSchedule *schedules = NULL;
+     int count = 0;
+     bool valid = file != NULL;
+     int settings = 0;
+     int line_number = 0;
+     char line[256];
+     
+     while (valid && fgets(line, sizeof(line), file) != NULL) {
+         line_number++;
+         line[strcspn(line, "#\r\n")] = '\0';
+         
+         char keyword[16];
+         int consumed = 0;
+         if (sscanf(line, "%15s%n", keyword, &consumed) != 1) {
+             continue; // Blank or comment-only line
+         }
+         
+         const char *rest = line + consumed;
+         int64_t values[TARIFF_TIERS];
+         int found;
+         
+         if (strcmp(keyword, "effective") == 0) {
+             if (count > 0 && settings != TARIFF_ALL_SETTINGS) {
+                 valid = false; // Previous schedule is incomplete
+                 break;
+             }
+             TariffSchedule *grown = realloc(schedules, sizeof(TariffSchedule) * (count + 1));
+             if (grown == NULL) {
+                 valid = false;
+                 break;
+             }
+             schedules = grown;
+             memset(&schedules[count], 0, sizeof(TariffSchedule));
+             char date[16];
+             if (sscanf(rest, "%15s", date) != 1 || strlen(date) != 10 || date[4] != '-' || date[7] != '-') {
+                 valid = false;
+                 break;
+             }
+             strcpy(schedules[count].effective_date, date);
+             count++;
+             settings = 0;
+             continue;
+         }
+         
+         if (count == 0) {
+             valid = false; // Setting before the first effective line
+             break;
+         }
+         
+         TariffSchedule *schedule = &schedules[count - 1];
+         if (strcmp(keyword, "tiers") == 0) {
+             found = parseTariffValues(rest, values, TARIFF_TIERS, 0);
+             valid = found == TARIFF_TIERS && values[0] == 0;
+             for (int t = 0; valid && t < TARIFF_TIERS; t++) {
+                 schedule->water.lower[t] = (int)values[t];
+                 valid = values[t] <= INT32_MAX && (t == 0 || values[t] > values[t - 1]);
+             }
+             settings |= TARIFF_SET_TIERS;
+         } else if (strcmp(keyword, "water") == 0 || strcmp(keyword, "sewerage") == 0) {
+             TariffTiers *tiers = keyword[0] == 'w' ? &schedule->water : &schedule->sewerage;
+             found = parseTariffValues(rest, values, TARIFF_TIERS, 2);
+             valid = found == TARIFF_TIERS;
+             for (int t = 0; valid && t < TARIFF_TIERS; t++) {
+                 tiers->rate[t] = values[t];
+             }
+             settings |= keyword[0] == 'w' ? TARIFF_SET_WATER : TARIFF_SET_SEWERAGE;
+         } else if (strcmp(keyword, "service") == 0) {
+             found = parseTariffValues(rest, values, METER_SIZE_COUNT, 2);
+             valid = found == METER_SIZE_COUNT;
+             for (int m = 0; valid && m < METER_SIZE_COUNT; m++) {
+                 schedule->service_charge[m] = values[m];
+             }
+             settings |= TARIFF_SET_SERVICE;
+         } else if (strcmp(keyword, "pam") == 0 || strcmp(keyword, "x_factor") == 0 || strcmp(keyword, "k_factor") == 0) {
+             found = parseTariffValues(rest, values, 1, RATE_DECIMALS);
+             valid = found == 1;
+             if (!valid) {
+                 break;
+             } else if (keyword[0] == 'p') {
+                 schedule->pam_rate = values[0];
+                 settings |= TARIFF_SET_PAM;
+             } else if (keyword[0] == 'x') {
+                 schedule->x_factor_rate = values[0];
+                 settings |= TARIFF_SET_X_FACTOR;
+             } else {
+                 schedule->k_factor_rate = values[0];
+                 settings |= TARIFF_SET_K_FACTOR;
+             }
+         } else {
+             valid = false;
+         }
+     }
+     
+     if (file != NULL) {
+         fclose(file);
+         
+         if (valid && (count == 0 || settings != TARIFF_ALL_SETTINGS)) {
+             valid = false;
+             line_number = 0;
+         }
+         
+         if (valid) {
+             // Tiers may be given before or after the rates, so build the bases last
+             for (int i = 0; i < count; i++) {
+                 TariffTiers *water = &schedules[i].water;
+                 TariffTiers *sewerage = &schedules[i].sewerage;
+                 buildTariffTiers(sewerage, water->lower, sewerage->rate);
+                 buildTariffTiers(water, water->lower, water->rate);
+             }
+             
+             qsort(schedules, count, sizeof(TariffSchedule), compareTariffSchedules);
+             for (int i = 1; i < count; i++) {
+                 if (strcmp(schedules[i].effective_date, schedules[i - 1].effective_date) == 0) {
+                     valid = false;
+                     line_number = 0;
+                 }
+             }
+         }
+         
+         if (!valid) {
+             if (line_number > 0) {
+                 printf("Error: Invalid tariff schedule in %s (line %d). Using the built-in tariff.\n", FILE_TARIFFS, line_number);
+             } else {
+                 printf("Error: Incomplete or duplicate tariff schedule in %s. Using the built-in tariff.\n", FILE_TARIFFS);
+             }
+         }
+     }
+     
+     if (!valid) {
+         free(schedules);
+         schedules = malloc(sizeof(TariffSchedule));
+         if (schedules == NULL) {
+             printf("Error: Out of memory while loading tariffs.\n");
+             exit(1);
+         }
+         buildDefaultTariff(schedules);
+         count = 1;
+     }
+     
+     tariff_schedules = schedules;
+     tariff_schedule_count = count;
+ }
+ 
+ /**
+  * Find the tariff schedule in force on a date
+  * 
+  * @param date - Bill date (YYYY-MM-DD)
+  * @return const TariffSchedule* - Latest schedule effective on or before the
+  *         date (the earliest schedule if the date precedes them all)
+  */
+ const TariffSchedule *tariffInForce(const char *date) {
+     int low = 0;
+     int high = tariff_schedule_count - 1;
+     int found = 0;
+     
+     while (low <= high) {
+         int middle = (low + high) / 2;
+         if (strcmp(tariff_schedules[middle].effective_date, date) <= 0) {
+             found = middle;
+             low = middle + 1;
+         } else {
+             high = middle - 1;
+         }
+     }
+     
+     return &tariff_schedules[found];
+ }
+ 
+ // Get the tariff schedule in force today
+ const TariffSchedule *currentTariff() {
+     char today[11];
+     getCurrentDate(today);
+     return tariffInForce(today);
+ }
+ 
+ // Get the service charge of a meter size under a tariff schedule
+ Money tariffServiceCharge(const TariffSchedule *tariff, MeterSize meter_size) {
+     if (meter_size < METER_15MM || meter_size > METER_150MM) {
+         return 0;
+     }
+     return tariff->service_charge[meter_size - 1];
+ }
+ 
+ /**
+  * Rate an array of consumptions against a tiered tariff
+  * 
+  * The charge is the tier's cumulative base plus the consumption inside the
+  * tier at the tier's rate, in thousandths of a cent, rounded half up to
+  * whole cents. The table is held in locals and the tier is chosen with
+  * selects rather than branches or table lookups, so the loop has no
+  * data-dependent control flow and the rounding division by a constant
+  * compiles to a multiply.
+  * 
+  * @param tariff - Rating table built by buildTariffTiers
+  * @param consumption - Consumptions in litres
+  * @param charges - Receives the charge for each consumption
+  * @param count - Number of consumptions
+  */
+ void rateConsumption(const TariffTiers *tariff, const int *consumption, Money *charges, int count) {
+     const int lower0 = tariff->lower[0], lower1 = tariff->lower[1], lower2 = tariff->lower[2], lower3 = tariff->lower[3];
+     const int64_t base0 = tariff->base[0], base1 = tariff->base[1], base2 = tariff->base[2], base3 = tariff->base[3];
+     const int64_t rate0 = tariff->rate[0], rate1 = tariff->rate[1], rate2 = tariff->rate[2], rate3 = tariff->rate[3];
+     
+     for (int i = 0; i < count; i++) {
+         int litres = consumption[i];
+         int lower = litres > lower3 ? lower3 : litres > lower2 ? lower2 : litres > lower1 ? lower1 : lower0;
+         int64_t base = litres > lower3 ? base3 : litres > lower2 ? base2 : litres > lower1 ? base1 : base0;
+         int64_t rate = litres > lower3 ? rate3 : litres > lower2 ? rate2 : litres > lower1 ? rate1 : rate0;
+         charges[i] = (base + (int64_t)(litres - lower) * rate + 500) / 1000;
+     }
+ }
+ 
+ /**
+  * Calculate water charge based on consumption
+  * 
+  * Applies the tiered water rates of the tariff schedule in force today.
+  * The built-in schedule rates consumption brackets as follows:
+  * - 0-14,000 litres: $149.55 per cubic meter
+  * - 14,001-27,000 litres: $266.15 per cubic meter
+  * - 27,001-41,000 litres: $290.10 per cubic meter
+  * - Over 41,000 litres: $494.87 per cubic meter
+  * 
+  * @param consumption - Water consumption in litres
+  * @return Money - Calculated water charge in cents
+  */
+ Money calculateWaterCharge(int consumption) {
+     Money charge;
+     rateConsumption(&currentTariff()->water, &consumption, &charge, 1);
+     return charge;
+ }
+ 
+ /**
+  * Calculate sewerage charge based on consumption
+  * 
+  * Applies the tiered sewerage rates of the tariff schedule in force today.
+  * The built-in schedule rates consumption brackets as follows:
+  * - 0-14,000 litres: $172.72 per cubic meter
+  * - 14,001-27,000 litres: $307.42 per cubic meter
+  * - 27,001-41,000 litres: $335.06 per cubic meter
+  * - Over 41,000 litres: $571.56 per cubic meter
+  * 
+  * @param consumption - Water consumption in litres
+  * @return Money - Calculated sewerage charge in cents
+  */
+ Money calculateSewerageCharge(int consumption) {
+     Money charge;
+     rateConsumption(&currentTariff()->sewerage, &consumption, &charge, 1);
+     return charge;
+ }
+ 
+ // Calculate service charge based on meter size (tariff schedule in force today)
+ Money calculateServiceCharge(MeterSize meter_size) {
+     return tariffServiceCharge(currentTariff(), meter_size);
+ }
+ 
+ // Check if customer number already exists
+ bool isCustomerNumberExists(const char *customer_number) {
+     return numberInUse(&customer_numbers, packNumber(customer_number));
+ }
+ 
+ // Check if premises number already exists (surrendered premises keep their numbers)
+ bool isPremisesNumberExists(const char *premises_number) {
+     return numberInUse(&premises_numbers, packNumber(premises_number));
+ }
+ 
+ // Check if email already exists
+ bool isEmailExists(const char *email) {
+     return findUserByEmail(email) != NULL;
+ }
+ 
+ // Mask password input
+ void maskPassword(char *password) {
+     char ch;
+     int i = 0;
+     
+     while (1) {
+         ch = getchar();
+         
+         if (ch == '\n' || ch == '\r') {
+             password[i] = '\0';
+             break;
+         } else if (ch == '\b' && i > 0) { // Backspace
+             i--;
+             printf("\b \b");
+         } else if (ch != '\b') {
+             password[i++] = ch;
+             printf("*");
+         }
+     }
+     printf("\n");
+ }
+ 
+ /**
+  * Get daily usage limit based on income class
+  * 
+  * Returns the maximum daily water usage limit in litres according to
+  * the customer's assigned income class.
+  * 
+  * @param income_class - Customer's income class
+  * @return int - Daily usage limit in litres
+  */
+ int getDailyUsageLimit(IncomeClass income_class) {
+     switch (income_class) {
+         case LOW:
+             return 125;
+         case LOW_MEDIUM:
+             return 175;
+         case MEDIUM:
+             return 220;
+         case MEDIUM_HIGH:
+             return 250;
+         case HIGH:
+             return 300;
+         default:
+             return 150; // Default value
+     }
+ }
+ 
+ /**
+  * Log system activity
+  * 
+  * Records customer activities including payments and meter surrenders.
+  * Updates existing logs or creates new log entries as needed.
+  * 
+  * @param customer_number - Customer number
+  * @param payment_amount - Amount paid (0 if not a payment activity)
+  * @param surrender_meter - True if this is a meter surrender activity
+  */
+ void logActivity(const char *customer_number, Money payment_amount, bool surrender_meter) {
+     SystemLog log;
+     memset(&log, 0, sizeof(SystemLog));
+     generateID(log.log_id, "LOG");
+     strcpy(log.customer_number, customer_number);
+     getCurrentDate(log.log_date);
+     
+     // Read the latest existing log for this customer if any
+     FILE *file = fopen(FILE_LOGS, "rb");
+     if (file != NULL) {
+         SystemLog existing_log;
+         while (fread(&existing_log, sizeof(SystemLog), 1, file) == 1) {
+             if (strcmp(existing_log.customer_number, customer_number) == 0) {
+                 log.payments_count = existing_log.payments_count;
+                 log.last_payment_amount = existing_log.last_payment_amount;
+                 log.meters_surrendered = existing_log.meters_surrendered;
+             }
+         }
+         fclose(file);
+     }
+     
+     // Update log data
+     if (payment_amount > 0) {
+         log.payments_count++;
+         log.last_payment_amount = moneyToDouble(payment_amount);
+     }
+     
+     if (surrender_meter) {
+         log.meters_surrendered++;
+     }
+     
+     // Save to file (append)
+     file = openAppend(FILE_LOGS);
+     if (file != NULL) {
+         fwrite(&log, sizeof(SystemLog), 1, file);
+         fclose(file);
+     }
+ }
+ 
+ // Display customer details
+ void displayCustomerDetails(const char *customer_number) {
+     // Find customer by number
+     int customer_index = findCustomerRow(customer_number, false);
+     
+     if (customer_index < 0) {
+         printf("Customer not found.\n");
+         return;
+     }
+     
+     // Display customer details
+     Customer *customer = customerAt(customer_index);
+     printf("\nCustomer Details:\n");
+     printf("Customer Number: %s\n", customer->customer_number);
+     printf("Name: %s %s\n", customer->first_name, customer->last_name);
+     printf("Status: %s\n", customer->is_active ? "Active" : "Archived");
+     printf("Income Class: ");
+     
+     switch (customer->income_class) {
+         case LOW:
+             printf("Low (up to 125 L/day)\n");
+             break;
+         case LOW_MEDIUM:
+             printf("Low/Medium (up to 175 L/day)\n");
+             break;
+         case MEDIUM:
+             printf("Medium (up to 220 L/day)\n");
+             break;
+         case MEDIUM_HIGH:
+             printf("Medium/High (up to 250 L/day)\n");
+             break;
+         case HIGH:
+             printf("High (up to 300 L/day)\n");
+             break;
+     }
+     
+     // Display associated premises
+     printf("\nAssociated Premises:\n");
+     bool has_premises = false;
+     
+     for (int i = firstCustomerPremises(customer_index); i >= 0; i = nextCustomerPremises(i)) {
+         Premises *premises = premisesAt(i);
+         has_premises = true;
+         printf("Premises Number: %s\n", premises->premises_number);
+         printf("Status: %s\n", premises->is_active ? "Active" : "Inactive");
+         printf("Meter Size: ");
+         
+         switch (premises->meter_size) {
+             case METER_15MM:
+                 printf("15mm\n");
+                 break;
+             case METER_30MM:
+                 printf("30mm\n");
+                 break;
+             case METER_150MM:
+                 printf("150mm\n");
+                 break;
+         }
+         
+         printf("Initial Reading: %d\n", premises->initial_reading);
+         printf("Previous Reading: %d\n", premises->previous_reading);
+         printf("Current Reading: %d\n", premises->current_reading);
+         printf("---------------------------\n");
+     }
+     
+     if (!has_premises) {
+         printf("No premises associated with this customer.\n");
+     }
+     
+     // Display billing history
+     printf("\nBilling History:\n");
+     bool has_bills = false;
+     
+     int32_t *records = NULL;
+     int record_count = collectCustomerBillRecords(customer_number, &records);
+     FILE *file = record_count > 0 ? fopen(FILE_BILLS, "rb") : NULL;
+     if (file != NULL) {
+         Bill bill;
+         for (int i = 0; i < record_count; i++) {
+             if (readBillRecord(file, records[i], &bill)) {
+                 has_bills = true;
+                 printf("Bill ID: %s\n", bill.bill_id);
+                 printf("Premises Number: %s\n", bill.premises_number);
+                 printf("Month: %d\n", bill.month_number);
+                 printf("Consumption: %d litres\n", bill.consumption);
+                 printf("Total Amount Due: $%.2f\n", bill.total_amount_due);
+                 printf("Amount Paid: $%.2f\n", bill.amount_paid);
+                 printf("Status: %s\n", bill.is_paid ? "PAID" : "UNPAID");
+                 printf("---------------------------\n");
+             }
+         }
+         fclose(file);
+     }
+     free(records);
+     
+     if (!has_bills) {
+         printf("No bills found for this customer.\n");
+     }
+ }
+ 
+ // Clear the screen
+ void clearScreen() {
+     #ifdef _WIN32
+         system("cls");
+     #else
+         system("clear");
+     #endif
+ }
+ 
+ // Pause the screen
+ void pauseScreen() {
+     printf("\nPress Enter to continue...");
+     getchar();
+ }
+
+ /**
+  * Hash a string
+  * 
+  * Computes the 64-bit FNV-1a hash of a NUL-terminated string. Used as the
+  * key for string-keyed hash indexes.
+  * 
+  * @param text - String to hash
+  * @return uint64_t - Hash value
+  */
+ uint64_t hashString(const char *text) {
+     uint64_t hash = 14695981039346656037ULL;
+     
+     while (*text != '\0') {
+         hash ^= (unsigned char)*text++;
+         hash *= 1099511628211ULL;
+     }
+     
+     return hash;
+ }
+ 
+ // Scramble a key so that sequential keys spread over the slot range
+ uint64_t mixHashKey(uint64_t key) {
+     key ^= key >> 33;
+     key *= 0xff51afd7ed558ccdULL;
+     key ^= key >> 33;
+     key *= 0xc4ceb9fe1a85ec53ULL;
+     key ^= key >> 33;
+     return key;
+ }
+ 
+ // Initialize a hash index sized for the expected number of entries
+ void hashIndexInit(HashIndex *index, int expected_count) {
+     index->capacity = 16;
+     while (index->capacity < expected_count * 2) {
+         index->capacity *= 2;
+     }
+     index->count = 0;
+     index->keys = malloc(sizeof(uint64_t) * index->capacity);
+     index->values = malloc(sizeof(int32_t) * index->capacity);
+     
+     if (index->keys == NULL || index->values == NULL) {
+         printf("Error: Out of memory while building index.\n");
+         exit(1);
+     }
+     
+     memset(index->values, 0xff, sizeof(int32_t) * index->capacity); // All slots empty (-1)
+ }
+ 
+ // Release a hash index
+ void hashIndexFree(HashIndex *index) {
+     free(index->keys);
+     free(index->values);
+     index->keys = NULL;
+     index->values = NULL;
+     index->capacity = 0;
+     index->count = 0;
+ }
+ 
+ /**
+  * Add a key/value pair to a hash index
+  * 
+  * Uses linear probing. Duplicate keys are allowed; callers that need unique
+  * keys verify candidates returned by hashIndexFind. The index doubles in size
+  * once it is three quarters full.
+  * 
+  * @param index - Hash index to update
+  * @param key - Key to insert
+  * @param value - Non-negative value stored for the key
+  */
+ void hashIndexInsert(HashIndex *index, uint64_t key, int32_t value) {
+     if ((index->count + 1) * 4 > index->capacity * 3) {
+         HashIndex grown;
+         hashIndexInit(&grown, index->capacity);
+         
+         for (int i = 0; i < index->capacity; i++) {
+             if (index->values[i] >= 0) {
+                 hashIndexInsert(&grown, index->keys[i], index->values[i]);
+             }
+         }
+         
+         hashIndexFree(index);
+         *index = grown;
+     }
+     
+     int mask = index->capacity - 1;
+     int slot = (int)(mixHashKey(key) & (uint64_t)mask);
+     while (index->values[slot] >= 0) {
+         slot = (slot + 1) & mask;
+     }
+     
+     index->keys[slot] = key;
+     index->values[slot] = value;
+     index->count++;
+ }
+ 
+ /**
+  * Find the next value stored for a key
+  * 
+  * Start a lookup with *cursor set to -1 and call again with the same cursor
+  * to visit every value stored under the key.
+  * 
+  * @param index - Hash index to search
+  * @param key - Key to look up
+  * @param cursor - Probe position of the previous match (-1 to start)
+  * @return int32_t - Next value for the key, or -1 if there are no more
+  */
+ int32_t hashIndexFind(const HashIndex *index, uint64_t key, int *cursor) {
+     if (index->capacity == 0) {
+         return -1;
+     }
+     
+     int mask = index->capacity - 1;
+     int slot = (*cursor < 0) ? (int)(mixHashKey(key) & (uint64_t)mask) : ((*cursor + 1) & mask);
+     
+     while (index->values[slot] >= 0) {
+         if (index->keys[slot] == key) {
+             *cursor = slot;
+             return index->values[slot];
+         }
+         slot = (slot + 1) & mask;
+     }
+     
+     return -1;
+ }
+ 
+ // Count the fixed-size records in a file (0 if the file does not exist)
+ long countRecords(const char *filename, size_t record_size) {
+     long size = fileSize(filename);
+     return size > 0 ? size / (long)record_size : 0;
+ }
+ 
+ // Size of a file in bytes (-1 if it cannot be opened)
+ long fileSize(const char *filename) {
+     FILE *file = fopen(filename, "rb");
+     if (file == NULL) {
+         return -1;
+     }
+     
+     fseek(file, 0, SEEK_END);
+     long size = ftell(file);
+     fclose(file);
+     
+     return size;
+ }
+ 
+ // Release the in-memory bill index and start an empty one
+ void resetBillIndex() {
+     for (int i = 0; i < bill_index.bucket_count; i++) {
+         free(bill_index.buckets[i].records);
+     }
+     free(bill_index.buckets);
+     hashIndexFree(&bill_index.by_customer);
+     
+     memset(&bill_index, 0, sizeof(BillIndex));
+     hashIndexInit(&bill_index.by_customer, customer_table.count);
+ }
+ 
+ /**
+  * Load the bill index
+  * 
+  * Reads bills_index.txt into memory. Bills appended after the index was last
+  * written (e.g. after a crash) are indexed from bills.txt and appended to the
+  * index file. If the index is missing or does not match bills.txt it is
+  * rebuilt from scratch.
+  */
+ void loadBillIndex() {
+     long bill_records = countRecords(FILE_BILLS, sizeof(Bill));
+     bool valid = true;
+     
+     resetBillIndex();
+     
+     MappedFile index_file;
+     if (mapRecordFile(FILE_BILL_INDEX, sizeof(BillIndexEntry), &index_file)) {
+         const BillIndexEntry *entry = index_file.data;
+         for (long i = 0; i < index_file.count; i++) {
+             if (entry[i].record != bill_index.record_count || entry[i].record >= bill_records) {
+                 valid = false;
+                 break;
+             }
+             indexBillRecord(entry[i].customer_number, entry[i].premises_number, entry[i].record);
+         }
+         unmapRecordFile(&index_file);
+     } else if (bill_records > 0) {
+         valid = false;
+     }
+     
+     if (!valid) {
+         rebuildBillIndex();
+         return;
+     }
+     
+     // Index any bills appended after the index file was last updated
+     if (bill_index.record_count < bill_records) {
+         FILE *bill_file = fopen(FILE_BILLS, "rb");
+         FILE *index_file = fopen(FILE_BILL_INDEX, "ab");
+         if (bill_file != NULL && index_file != NULL) {
+             Bill bill;
+             BillIndexEntry entry;
+             fseek(bill_file, (long)bill_index.record_count * (long)sizeof(Bill), SEEK_SET);
+             while (fread(&bill, sizeof(Bill), 1, bill_file) == 1) {
+                 memcpy(entry.customer_number, bill.customer_number, sizeof(entry.customer_number));
+                 memcpy(entry.premises_number, bill.premises_number, sizeof(entry.premises_number));
+                 entry.record = bill_index.record_count;
+                 fwrite(&entry, sizeof(BillIndexEntry), 1, index_file);
+                 indexBillRecord(entry.customer_number, entry.premises_number, entry.record);
+             }
+         }
+         if (bill_file != NULL) {
+             fclose(bill_file);
+         }
+         if (index_file != NULL) {
+             fclose(index_file);
+         }
+     }
+ }
+ 
+ /**
+  * Rebuild the bill index
+  * 
+  * Scans bills.txt once and rewrites bills_index.txt with one entry per
+  * bill record, replacing the in-memory index.
+  */
+ void rebuildBillIndex() {
+     resetBillIndex();
+     
+     FILE *index_file = fopen(FILE_BILL_INDEX, "wb");
+     MappedFile bills;
+     
+     if (mapRecordFile(FILE_BILLS, sizeof(Bill), &bills)) {
+         const Bill *bill = bills.data;
+         BillIndexEntry entry;
+         for (long i = 0; i < bills.count; i++) {
+             memcpy(entry.customer_number, bill[i].customer_number, sizeof(entry.customer_number));
+             memcpy(entry.premises_number, bill[i].premises_number, sizeof(entry.premises_number));
+             entry.record = bill_index.record_count;
+             if (index_file != NULL) {
+                 fwrite(&entry, sizeof(BillIndexEntry), 1, index_file);
+             }
+             indexBillRecord(entry.customer_number, entry.premises_number, entry.record);
+         }
+         unmapRecordFile(&bills);
+     }
+     
+     if (index_file != NULL) {
+         fclose(index_file);
+     } else {
+         printf("Warning: Could not write bill index file.\n");
+     }
+ }
+ 
+ // Add a bill record to the in-memory index
+ void indexBillRecord(const char *customer_number, const char *premises_number, int32_t record) {
+     BillIndexBucket *bucket = findBillBucket(customer_number, premises_number);
+     
+     if (bucket == NULL) {
+         if (bill_index.bucket_count == bill_index.bucket_capacity) {
+             int new_capacity = bill_index.bucket_capacity == 0 ? 64 : bill_index.bucket_capacity * 2;
+             BillIndexBucket *grown = realloc(bill_index.buckets, sizeof(BillIndexBucket) * new_capacity);
+             if (grown == NULL) {
+                 printf("Error: Out of memory while building bill index.\n");
+                 exit(1);
+             }
+             bill_index.buckets = grown;
+             bill_index.bucket_capacity = new_capacity;
+         }
+         
+         bucket = &bill_index.buckets[bill_index.bucket_count];
+         memset(bucket, 0, sizeof(BillIndexBucket));
+         bucket->customer_key = packNumber(customer_number);
+         bucket->premises_key = packNumber(premises_number);
+         hashIndexInsert(&bill_index.by_customer, bucket->customer_key, bill_index.bucket_count);
+         bill_index.bucket_count++;
+     }
+     
+     if (bucket->count == bucket->capacity) {
+         int new_capacity = bucket->capacity == 0 ? 4 : bucket->capacity * 2;
+         int32_t *grown = realloc(bucket->records, sizeof(int32_t) * new_capacity);
+         if (grown == NULL) {
+             printf("Error: Out of memory while building bill index.\n");
+             exit(1);
+         }
+         bucket->records = grown;
+         bucket->capacity = new_capacity;
+     }
+     
+     bucket->records[bucket->count++] = record;
+     if (record >= bill_index.record_count) {
+         bill_index.record_count = record + 1;
+     }
+ }
+ 
+ // Find the bill records of a customer/premises pair (NULL if it has no bills)
+ BillIndexBucket *findBillBucket(const char *customer_number, const char *premises_number) {
+     int cursor = -1;
+     int32_t position;
+     uint32_t premises_key = packNumber(premises_number);
+     
+     while ((position = hashIndexFind(&bill_index.by_customer, packNumber(customer_number), &cursor)) >= 0) {
+         if (bill_index.buckets[position].premises_key == premises_key) {
+             return &bill_index.buckets[position];
+         }
+     }
+     
+     return NULL;
+ }
+ 
+ // Order bill record numbers ascending (qsort callback)
+ int compareRecords(const void *a, const void *b) {
+     int32_t left = *(const int32_t *)a;
+     int32_t right = *(const int32_t *)b;
+     return (left > right) - (left < right);
+ }
+ 
+ /**
+  * Collect the bill records of a customer
+  * 
+  * Gathers the record numbers of every bill for the customer across all of
+  * their premises, in file (billing) order. The caller frees *records.
+  * 
+  * @param customer_number - Customer number
+  * @param records - Receives a malloc'd array of record numbers (NULL if none)
+  * @return int - Number of records collected
+  */
+ int collectCustomerBillRecords(const char *customer_number, int32_t **records) {
+     int cursor = -1;
+     int32_t position;
+     int total = 0;
+     uint32_t key = packNumber(customer_number);
+     
+     *records = NULL;
+     
+     while ((position = hashIndexFind(&bill_index.by_customer, key, &cursor)) >= 0) {
+         total += bill_index.buckets[position].count;
+     }
+     
+     if (total == 0) {
+         return 0;
+     }
+     
+     *records = malloc(sizeof(int32_t) * total);
+     if (*records == NULL) {
+         return 0;
+     }
+     
+     int count = 0;
+     cursor = -1;
+     while ((position = hashIndexFind(&bill_index.by_customer, key, &cursor)) >= 0) {
+         BillIndexBucket *bucket = &bill_index.buckets[position];
+         memcpy(*records + count, bucket->records, sizeof(int32_t) * bucket->count);
+         count += bucket->count;
+     }
+     
+     qsort(*records, count, sizeof(int32_t), compareRecords);
+     return count;
+ }
+ 
+ // Read a bill by its record number from an open bills file
+ bool readBillRecord(FILE *file, int32_t record, Bill *bill) {
+     if (fseek(file, (long)record * (long)sizeof(Bill), SEEK_SET) != 0) {
+         return false;
+     }
+     return fread(bill, sizeof(Bill), 1, file) == 1;
+ }
+ 
+ /**
+  * Stage a new bill
+  * 
+  * Stages the bill as the next record of bills.txt. The bill is written and
+  * indexed when the journal commits, together with any other records staged
+  * in the same group.
+  * 
+  * @param bill - Bill to append
+  * @return int32_t - Record number the bill will occupy
+  */
+ int32_t stageBillAppend(const Bill *bill) {
+     int32_t record = bill_index.record_count + journal.staged_bills;
+     journalStage(JOURNAL_BILLS, record, bill, sizeof(Bill));
+     journal.staged_bills++;
+     return record;
+ }
+ 
+ // Record newly written bills in the in-memory index and, for this process's own commits, bills_index.txt
+ void indexAppendedBills(const unsigned char *data, size_t size, bool write_index) {
+     FILE *index_file = NULL;
+     size_t offset = 0;
+     
+     while (offset + sizeof(JournalRecordHeader) <= size) {
+         JournalRecordHeader header;
+         memcpy(&header, data + offset, sizeof(JournalRecordHeader));
+         offset += sizeof(JournalRecordHeader);
+         
+         if (header.target == JOURNAL_BILLS && header.record == bill_index.record_count) {
+             const Bill *bill = (const Bill *)(data + offset);
+             BillIndexEntry entry;
+             memcpy(entry.customer_number, bill->customer_number, sizeof(entry.customer_number));
+             memcpy(entry.premises_number, bill->premises_number, sizeof(entry.premises_number));
+             entry.record = header.record;
+             indexBillRecord(entry.customer_number, entry.premises_number, entry.record);
+             
+             if (index_file == NULL && write_index) {
+                 index_file = fopen(FILE_BILL_INDEX, "ab");
+             }
+             if (index_file != NULL) {
+                 fwrite(&entry, sizeof(BillIndexEntry), 1, index_file);
+             }
+         }
+         offset += header.size;
+     }
+     
+     if (index_file != NULL) {
+         fclose(index_file);
+     }
+ }
+ 
+ // Flush a file's buffers and force its contents to disk
+ bool syncFile(FILE *file) {
+     if (fflush(file) != 0) {
+         return false;
+     }
+     #ifdef _WIN32
+         return _commit(_fileno(file)) == 0;
+     #else
+         return fsync(fileno(file)) == 0;
+     #endif
+ }
+
+ // Number of worker threads to use (one per online processor, up to MAX_WORKERS)
+ int workerCount() {
+     long processors;
+     
+     #ifdef _WIN32
+         SYSTEM_INFO info;
+         GetSystemInfo(&info);
+         processors = (long)info.dwNumberOfProcessors;
+     #else
+         processors = sysconf(_SC_NPROCESSORS_ONLN);
+     #endif
+     
+     if (processors < 1) {
+         return 1;
+     }
+     return processors > MAX_WORKERS ? MAX_WORKERS : (int)processors;
+ }
+ 
+ // Start a worker thread running function(arg) (false if it could not be started)
+ bool startWorker(WorkerThread *thread, WorkerFunction function, void *arg) {
+     #ifdef _WIN32
+         *thread = CreateThread(NULL, 0, function, arg, 0, NULL);
+         return *thread != NULL;
+     #else
+         return pthread_create(thread, NULL, function, arg) == 0;
+     #endif
+ }
+ 
+ // Wait for a worker thread to finish
+ void joinWorker(WorkerThread thread) {
+     #ifdef _WIN32
+         WaitForSingleObject(thread, INFINITE);
+         CloseHandle(thread);
+     #else
+         pthread_join(thread, NULL);
+     #endif
+ }
+ 
+ // Checksum a journal record image (32-bit FNV-1a)
+ uint32_t journalChecksum(const void *data, size_t size) {
+     const unsigned char *bytes = data;
+     uint32_t hash = 2166136261U;
+     
+     for (size_t i = 0; i < size; i++) {
+         hash ^= bytes[i];
+         hash *= 16777619U;
+     }
+     
+     return hash;
+ }
+ 
+ // Get the data file and record size a journal target refers to
+ const char *journalTargetFile(JournalTarget target, size_t *record_size) {
+     switch (target) {
+         case JOURNAL_BILLS:
+             *record_size = sizeof(Bill);
+             return FILE_BILLS;
+         case JOURNAL_CUSTOMERS:
+             *record_size = sizeof(Customer);
+             return FILE_CUSTOMERS;
+         case JOURNAL_PREMISES:
+             *record_size = sizeof(Premises);
+             return FILE_PREMISES;
+         case JOURNAL_LEDGER:
+             *record_size = sizeof(PremisesLedger);
+             return FILE_LEDGER;
+         case JOURNAL_RUNS:
+             *record_size = sizeof(BillingRunRecord);
+             return FILE_BILLING_RUNS;
+         case JOURNAL_PAID_VIEW:
+             *record_size = sizeof(BillViewRow);
+             return FILE_PAID_VIEW;
+         case JOURNAL_OWING_VIEW:
+             *record_size = sizeof(BillViewRow);
+             return FILE_OWING_VIEW;
+         case JOURNAL_ARCHIVED_VIEW:
+             *record_size = sizeof(ArchivedViewRow);
+             return FILE_ARCHIVED_VIEW;
+         case JOURNAL_USERS:
+             *record_size = sizeof(User);
+             return FILE_USERS;
+         case JOURNAL_PAYMENTS:
+             *record_size = sizeof(Payment);
+             return FILE_PAYMENTS;
+         default:
+             *record_size = 0;
+             return NULL;
+     }
+ }
+ 
+ /**
+  * Stage a record image for the next journal commit
+  * 
+  * Nothing is written until journalCommit is called, so several record
+  * updates can be committed together as one atomic group.
+  * 
+  * @param target - Data file the record belongs to
+  * @param record - Record number within the data file
+  * @param image - New contents of the record
+  * @param size - Size of the record image
+  */
+ void journalStage(JournalTarget target, int32_t record, const void *image, size_t size) {
+     size_t needed = journal.size + sizeof(JournalRecordHeader) + size;
+     
+     if (needed > journal.capacity) {
+         size_t new_capacity = journal.capacity == 0 ? 4096 : journal.capacity;
+         while (new_capacity < needed) {
+             new_capacity *= 2;
+         }
+         unsigned char *grown = realloc(journal.data, new_capacity);
+         if (grown == NULL) {
+             printf("Error: Out of memory while staging journal records.\n");
+             exit(1);
+         }
+         journal.data = grown;
+         journal.capacity = new_capacity;
+     }
+     
+     JournalRecordHeader header;
+     header.magic = JOURNAL_MAGIC;
+     header.target = (uint32_t)target;
+     header.record = record;
+     header.size = (uint32_t)size;
+     header.checksum = journalChecksum(image, size);
+     
+     memcpy(journal.data + journal.size, &header, sizeof(JournalRecordHeader));
+     memcpy(journal.data + journal.size + sizeof(JournalRecordHeader), image, size);
+     journal.size = needed;
+     journal.records++;
+ }
+ 
+ /**
+  * Commit staged journal records
+  * 
+  * Appends the staged records and a commit marker to journal.txt with a
+  * single write and a single fsync, so any number of record updates cost one
+  * small sequential append. Once the group is durable, customer, premises
+  * and ledger images are applied to the in-memory tables (the base files
+  * catch up at the next checkpoint) and bill and payment images are written
+  * in place so that readers of bills.txt and payments.txt see them
+  * immediately. The journal is checkpointed once it holds
+  * JOURNAL_CHECKPOINT_RECORDS records.
+  * 
+  * journal.txt is also how processes sharing the data directory see each
+  * other's changes. The append is made holding LOCK_JOURNAL, after
+  * applying the groups other processes committed since this one last
+  * looked. The journal position works as a version stamp: if one of
+  * those groups wrote a record this group stages (the same bill paid
+  * twice, or the same next row appended by both), this process worked
+  * from an old copy and its group is discarded. Groups that touch
+  * different records all commit. New paid and owing view rows and
+  * payments are only given their row numbers at this point, once the rows
+  * other processes took are known, so they never collide. A group that
+  * lost only over other appended rows is marked journal.appended, and a
+  * command run by runCommand is then simply run again.
+  * 
+  * @return bool - True if the staged records were committed
+  */
+ bool journalCommit() {
+     if (journal.records == 0) {
+         return true;
+     }
+     
+     bool committed = false;
+     lockDataFile(LOCK_JOURNAL);
+     journal.conflict = catchUpJournal();
+     if (!journal.conflict) {
+         placeStagedRows();
+         
+         JournalRecordHeader marker;
+         marker.magic = JOURNAL_MAGIC;
+         marker.target = JOURNAL_COMMIT;
+         marker.record = journal.records;
+         marker.size = 0;
+         marker.checksum = journalChecksum(journal.data, journal.size);
+         
+         FILE *file = fopen(FILE_JOURNAL, "ab");
+         if (file != NULL) {
+             committed = fwrite(journal.data, 1, journal.size, file) == journal.size &&
+                         fwrite(&marker, sizeof(JournalRecordHeader), 1, file) == 1 &&
+                         syncFile(file);
+             fclose(file);
+         }
+         
+         if (committed) {
+             journal.applied += (long)(journal.size + sizeof(JournalRecordHeader));
+             applyJournalToMemory(journal.data, journal.size);
+             applyJournal(journal.data, journal.size, JOURNAL_BILLS);
+             applyJournal(journal.data, journal.size, JOURNAL_PAYMENTS);
+             indexAppendedBills(journal.data, journal.size, true);
+             journal.pending_records += journal.records;
+         }
+     } else if (!journal.appended || journal.retries == 0) {
+         printf("Error: Another session changed the same records first. Nothing was saved; please try again.\n");
+     }
+     unlockDataFile(LOCK_JOURNAL);
+     
+     journal.size = 0;
+     journal.records = 0;
+     journal.staged_bills = 0;
+     journal.staged_users = 0;
+     report_views.staged_archived = 0;
+     
+     if (committed && journal.pending_records >= JOURNAL_CHECKPOINT_RECORDS) {
+         checkpointJournal();
+     }
+     
+     return committed;
+ }
+ 
+ // Apply committed user, customer, premises, ledger and report view images to the in-memory tables (and count payments)
+ void applyJournalToMemory(const unsigned char *data, size_t size) {
+     size_t offset = 0;
+     
+     while (offset + sizeof(JournalRecordHeader) <= size) {
+         JournalRecordHeader header;
+         memcpy(&header, data + offset, sizeof(JournalRecordHeader));
+         offset += sizeof(JournalRecordHeader);
+         
+         if (header.target == JOURNAL_USERS && header.size == sizeof(User)) {
+             bool appended = header.record == user_table.count;
+             if (tableStore(&user_table, header.record, data + offset) && appended) {
+                 const User *user = userAt(header.record);
+                 hashIndexInsert(&users_by_email, hashString(user->email), header.record);
+                 if (user->id >= next_user_id) {
+                     next_user_id = user->id + 1;
+                 }
+             }
+         } else if (header.target == JOURNAL_CUSTOMERS && header.size == sizeof(Customer)) {
+             bool appended = header.record == customer_table.count;
+             if (tableStore(&customer_table, header.record, data + offset) && appended) {
+                 indexCustomerRow(header.record);
+             }
+         } else if (header.target == JOURNAL_PREMISES && header.size == sizeof(Premises)) {
+             bool appended = header.record == premises_table.count;
+             if (tableStore(&premises_table, header.record, data + offset) && appended) {
+                 indexPremisesRow(header.record);
+             }
+         } else if (header.target == JOURNAL_LEDGER && header.size == sizeof(PremisesLedger)) {
+             tableStore(&ledger_table, header.record, data + offset);
+             debtor_index.current = false;
+         } else if (header.target == JOURNAL_RUNS && header.record == billing_run_count) {
+             billing_run_count++;
+         } else if (header.target == JOURNAL_PAYMENTS && header.record >= payment_count) {
+             payment_count = header.record + 1;
+         } else if (header.target == JOURNAL_PAID_VIEW && header.size == sizeof(BillViewRow)) {
+             tableStore(&report_views.paid, header.record, data + offset);
+         } else if (header.target == JOURNAL_OWING_VIEW && header.size == sizeof(BillViewRow)) {
+             bool existing = header.record < report_views.owing.count;
+             int32_t previous = existing ? ((BillViewRow *)tableRow(&report_views.owing, header.record))->record : -1;
+             if (tableStore(&report_views.owing, header.record, data + offset)) {
+                 int32_t current = ((BillViewRow *)tableRow(&report_views.owing, header.record))->record;
+                 if (current >= 0 && current != previous) {
+                     hashIndexInsert(&report_views.owing_by_record, (uint64_t)current, header.record);
+                 }
+                 if (current >= 0 && existing && previous < 0) {
+                     claimOwingViewRow(header.record);
+                 } else if (current < 0 && previous >= 0) {
+                     releaseOwingViewRow(header.record);
+                 }
+             }
+         } else if (header.target == JOURNAL_ARCHIVED_VIEW && header.size == sizeof(ArchivedViewRow)) {
+             bool appended = header.record == report_views.archived.count;
+             if (tableStore(&report_views.archived, header.record, data + offset) && appended) {
+                 const ArchivedViewRow *row = tableRow(&report_views.archived, header.record);
+                 hashIndexInsert(&report_views.archived_by_customer, packNumber(row->customer_number), header.record);
+             }
+         }
+         offset += header.size;
+     }
+ }
+ 
+ /**
+  * Apply journal records to the data files
+  * 
+  * Writes each record image at its record offset in the target data file
+  * and forces the data files to disk. Applying the same records twice is
+  * harmless, which is what makes crash recovery safe.
+  * 
+  * @param data - Journal records (headers followed by images)
+  * @param size - Size of the journal records in bytes
+  * @param only_target - Apply only records for this target (JOURNAL_COMMIT for all)
+  * @return bool - True if every image was written
+  */
+ bool applyJournal(const unsigned char *data, size_t size, JournalTarget only_target) {
+     FILE *files[JOURNAL_TARGET_COUNT] = { NULL };
+     bool success = true;
+     size_t offset = 0;
+     
+     while (offset + sizeof(JournalRecordHeader) <= size) {
+         JournalRecordHeader header;
+         memcpy(&header, data + offset, sizeof(JournalRecordHeader));
+         offset += sizeof(JournalRecordHeader);
+         
+         size_t record_size;
+         const char *filename = journalTargetFile((JournalTarget)header.target, &record_size);
+         if (filename == NULL || header.size != record_size ||
+             (only_target != JOURNAL_COMMIT && header.target != (uint32_t)only_target)) {
+             offset += header.size;
+             continue;
+         }
+         
+         if (files[header.target] == NULL) {
+             files[header.target] = fopen(filename, "r+b");
+             if (files[header.target] == NULL) {
+                 files[header.target] = fopen(filename, "w+b");
+             }
+         }
+         
+         FILE *file = files[header.target];
+         if (file == NULL ||
+             fseek(file, (long)header.record * (long)record_size, SEEK_SET) != 0 ||
+             fwrite(data + offset, record_size, 1, file) != 1) {
+             success = false;
+         }
+         offset += header.size;
+     }
+     
+     for (int i = 0; i < JOURNAL_TARGET_COUNT; i++) {
+         if (files[i] != NULL) {
+             if (!syncFile(files[i])) {
+                 success = false;
+             }
+             fclose(files[i]);
+         }
+     }
+     
+     return success;
+ }
+ 
+ /**
+  * Checkpoint the journal
+  * 
+  * Reads journal.txt, writes every group that has a valid commit marker in
+  * place into the base data files and truncates the journal. A trailing
+  * group without a marker was never committed and is discarded, so each
+  * group is applied either completely or not at all. Run at start-up this
+  * recovers the changes of an interrupted session.
+  * 
+  * Other processes using the data directory may not have applied every
+  * group to their tables yet, so the journal is only checkpointed by a
+  * process that is alone; otherwise it keeps growing until one is.
+  * 
+  * @return int - Number of record images checkpointed
+  */
+ int checkpointJournal() {
+     lockDataFile(LOCK_JOURNAL);
+     if (!holdDataDirectory(true)) {
+         unlockDataFile(LOCK_JOURNAL);
+         return 0;
+     }
+     catchUpJournal();
+     
+     int applied = 0;
+     FILE *file = fopen(FILE_JOURNAL, "rb");
+     if (file == NULL) {
+         journal.pending_records = 0;
+         journal.applied = 0;
+     } else {
+         fseek(file, 0, SEEK_END);
+         long length = ftell(file);
+         fseek(file, 0, SEEK_SET);
+         
+         unsigned char *data = length > 0 ? malloc(length) : NULL;
+         size_t size = data != NULL ? fread(data, 1, length, file) : 0;
+         fclose(file);
+         
+         // Everything before the valid length belongs to complete, committed groups
+         size_t valid = journalValidLength(data, size, &applied);
+         bool success = valid == 0 || applyJournal(data, valid, JOURNAL_COMMIT);
+         free(data);
+         
+         if (success) {
+             file = fopen(FILE_JOURNAL, "wb");
+             if (file != NULL) {
+                 fclose(file);
+             }
+             journal.pending_records = 0;
+             journal.applied = 0;
+         }
+     }
+     
+     holdDataDirectory(false);
+     unlockDataFile(LOCK_JOURNAL);
+     return applied;
+ }
+ 
+ /**
+  * Find the end of the complete groups in journal data
+  * 
+  * A group counts once its commit marker is present and every record and
+  * the marker checksum match. Anything after the last such group (a torn
+  * write, or a group whose commit never finished) is not part of the
+  * journal.
+  * 
+  * @param data - Journal bytes, starting at a group boundary
+  * @param size - Number of bytes
+  * @param records - Receives the number of records in the complete groups
+  * @return size_t - Bytes taken by the complete groups
+  */
+ size_t journalValidLength(const unsigned char *data, size_t size, int *records) {
+     size_t group_start = 0;
+     size_t offset = 0;
+     int group_records = 0;
+     
+     *records = 0;
+     while (offset + sizeof(JournalRecordHeader) <= size) {
+         JournalRecordHeader header;
+         memcpy(&header, data + offset, sizeof(JournalRecordHeader));
+         
+         if (header.magic != JOURNAL_MAGIC || offset + sizeof(JournalRecordHeader) + header.size > size) {
+             break; // Torn write at the end of the journal
+         }
+         
+         if (header.target == JOURNAL_COMMIT) {
+             if (header.record != group_records ||
+                 header.checksum != journalChecksum(data + group_start, offset - group_start)) {
+                 break;
+             }
+             offset += sizeof(JournalRecordHeader);
+             group_start = offset;
+             *records += group_records;
+             group_records = 0;
+             continue;
+         }
+         
+         if (header.checksum != journalChecksum(data + offset + sizeof(JournalRecordHeader), header.size)) {
+             break;
+         }
+         
+         offset += sizeof(JournalRecordHeader) + header.size;
+         group_records++;
+     }
+     
+     return group_start;
+ }
+ 
+ /**
+  * Apply journal groups committed by other processes
+  * 
+  * Reads journal.txt from the end of the last group this process applied
+  * and applies every complete group after it to the in-memory tables and
+  * bill index, as if this process had committed them (their bill images
+  * are already in bills.txt). Bytes after the last complete group were
+  * left by a process that stopped part way through a commit and are cut
+  * off, so the next group follows the last complete one. The caller
+  * holds LOCK_JOURNAL.
+  * 
+  * @return bool - True if an applied group wrote a record that is staged here
+  */
+ bool catchUpJournal() {
+     long length = fileSize(FILE_JOURNAL);
+     if (length < journal.applied) {
+         journal.applied = length > 0 ? length : 0; // Cut by a process that was not using data.lock
+     }
+     if (!journal.loaded || length <= journal.applied) {
+         return false;
+     }
+     
+     size_t size = (size_t)(length - journal.applied);
+     unsigned char *data = malloc(size);
+     FILE *file = data != NULL ? fopen(FILE_JOURNAL, "rb") : NULL;
+     bool read = file != NULL && fseek(file, journal.applied, SEEK_SET) == 0 && fread(data, 1, size, file) == size;
+     if (file != NULL) {
+         fclose(file);
+     }
+     if (!read) {
+         free(data);
+         return false;
+     }
+     
+     int records;
+     size_t valid = journalValidLength(data, size, &records);
+     bool conflict = valid > 0 && journalOverlaps(data, valid);
+     if (valid > 0) {
+         applyJournalToMemory(data, valid);
+         indexAppendedBills(data, valid, false);
+         journal.applied += (long)valid;
+         journal.pending_records += records;
+     }
+     free(data);
+     
+     if (valid < size) {
+         #ifdef _WIN32
+             file = fopen(FILE_JOURNAL, "r+b");
+             if (file != NULL) {
+                 _chsize_s(_fileno(file), journal.applied);
+                 fclose(file);
+             }
+         #else
+             if (truncate(FILE_JOURNAL, journal.applied) != 0) {
+                 printf("Warning: Could not remove an unfinished commit from %s.\n", FILE_JOURNAL);
+             }
+         #endif
+     }
+     
+     return conflict;
+ }
+ 
+ // Check whether committed journal records write any record staged in this process (and whether only appended ones)
+ bool journalOverlaps(const unsigned char *data, size_t size) {
+     if (journal.records == 0) {
+         return false;
+     }
+     
+     HashIndex written;
+     size_t offset = 0;
+     hashIndexInit(&written, 64);
+     while (offset + sizeof(JournalRecordHeader) <= size) {
+         JournalRecordHeader header;
+         memcpy(&header, data + offset, sizeof(JournalRecordHeader));
+         if (header.target != JOURNAL_COMMIT) {
+             hashIndexInsert(&written, ((uint64_t)header.target << 32) | (uint32_t)header.record, 0);
+         }
+         offset += sizeof(JournalRecordHeader) + header.size;
+     }
+     
+     // Both processes appending the same next row is a lost race; both changing one row means the copy was old
+     bool overlaps = false;
+     bool changed = false;
+     offset = 0;
+     while (!changed && offset + sizeof(JournalRecordHeader) <= journal.size) {
+         JournalRecordHeader header;
+         int cursor = -1;
+         memcpy(&header, journal.data + offset, sizeof(JournalRecordHeader));
+         if (hashIndexFind(&written, ((uint64_t)header.target << 32) | (uint32_t)header.record, &cursor) >= 0) {
+             overlaps = true;
+             changed = header.record < journalTargetCount((JournalTarget)header.target);
+         }
+         offset += sizeof(JournalRecordHeader) + header.size;
+     }
+     
+     hashIndexFree(&written);
+     journal.appended = overlaps && !changed;
+     return overlaps;
  }
  
- // Get current date in YYYY-MM-DD format
- void getCurrentDate(char *date) {
-     time_t t = time(NULL);
-     struct tm *tm_info = localtime(&t);
+ // Number of records of a journal target held in memory (staged records from here on append)
+ int32_t journalTargetCount(JournalTarget target) {
+     switch (target) {
+         case JOURNAL_BILLS:
+             return bill_index.record_count;
+         case JOURNAL_CUSTOMERS:
+             return customer_table.count;
+         case JOURNAL_PREMISES:
+             return premises_table.count;
+         case JOURNAL_LEDGER:
+             return ledger_table.count;
+         case JOURNAL_RUNS:
+             return billing_run_count;
+         case JOURNAL_PAID_VIEW:
+             return report_views.paid.count;
+         case JOURNAL_OWING_VIEW:
+             return report_views.owing.count;
+         case JOURNAL_ARCHIVED_VIEW:
+             return report_views.archived.count;
+         case JOURNAL_USERS:
+             return user_table.count;
+         case JOURNAL_PAYMENTS:
+             return payment_count;
+         default:
+             return 0;
+     }
+ }
+ 
+ // Check whether other processes have committed since this process last read journal.txt
+ bool journalBehind() {
+     long length = fileSize(FILE_JOURNAL);
+     return journal.loaded && (length > 0 ? length : 0) != journal.applied;
+ }
+ 
+ // Pick up the changes other processes have committed (nothing may be staged)
+ void journalRefresh() {
+     if (!journalBehind()) {
+         return;
+     }
+     lockDataFile(LOCK_JOURNAL);
+     catchUpJournal();
+     unlockDataFile(LOCK_JOURNAL);
+ }
+ 
+ /**
+  * Open data.lock and join the processes using the data directory
+  * 
+  * Processes sharing a data directory lock single bytes of data.lock (see
+  * DataFileLock) rather than the data files, which are opened and closed
+  * all the time. If data.lock cannot be opened, e.g. in a read-only
+  * directory, the process runs without locking.
+  * 
+  * @return bool - True if data.lock is open
+  */
+ bool openLockFile() {
+     #ifdef _WIN32
+         lock_file = CreateFileA(FILE_LOCK, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                 NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+         if (lock_file == INVALID_HANDLE_VALUE) {
+             printf("Warning: Could not open %s; other processes using this directory are not locked out.\n", FILE_LOCK);
+             return false;
+         }
+     #else
+         // Closing any descriptor of a file drops the process's locks on it, so data.lock stays open
+         lock_file = open(FILE_LOCK, O_RDWR | O_CREAT, 0644);
+         if (lock_file < 0) {
+             printf("Warning: Could not open %s; other processes using this directory are not locked out.\n", FILE_LOCK);
+             return false;
+         }
+     #endif
+     return holdDataDirectory(false);
+ }
+ 
+ // Lock a byte of data.lock, waiting while another process holds it (does nothing without data.lock)
+ void lockDataFile(DataFileLock range) {
+     #ifdef _WIN32
+         if (lock_file != INVALID_HANDLE_VALUE) {
+             OVERLAPPED overlapped;
+             memset(&overlapped, 0, sizeof(OVERLAPPED));
+             overlapped.Offset = (DWORD)range;
+             LockFileEx(lock_file, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped);
+         }
+     #else
+         if (lock_file >= 0) {
+             struct flock lock;
+             memset(&lock, 0, sizeof(lock));
+             lock.l_type = F_WRLCK;
+             lock.l_whence = SEEK_SET;
+             lock.l_start = range;
+             lock.l_len = 1;
+             while (fcntl(lock_file, F_SETLKW, &lock) != 0 && errno == EINTR) {
+             }
+         }
+     #endif
+ }
+ 
+ // Unlock a byte of data.lock
+ void unlockDataFile(DataFileLock range) {
+     #ifdef _WIN32
+         if (lock_file != INVALID_HANDLE_VALUE) {
+             OVERLAPPED overlapped;
+             memset(&overlapped, 0, sizeof(OVERLAPPED));
+             overlapped.Offset = (DWORD)range;
+             UnlockFileEx(lock_file, 0, 1, 0, &overlapped);
+         }
+     #else
+         if (lock_file >= 0) {
+             struct flock lock;
+             memset(&lock, 0, sizeof(lock));
+             lock.l_type = F_UNLCK;
+             lock.l_whence = SEEK_SET;
+             lock.l_start = range;
+             lock.l_len = 1;
+             fcntl(lock_file, F_SETLK, &lock);
+         }
+     #endif
+ }
+ 
+ /**
+  * Hold data.lock's presence byte
+  * 
+  * Every process using the data directory holds the byte shared. To
+  * checkpoint, a process tries to make its hold exclusive without
+  * waiting, which only succeeds while no other process is using the
+  * directory, and afterwards goes back to a shared hold.
+  * 
+  * @param alone - True to try for an exclusive hold, false for a shared one
+  * @return bool - True if the hold was taken (always true without data.lock)
+  */
+ bool holdDataDirectory(bool alone) {
+     #ifdef _WIN32
+         if (lock_file == INVALID_HANDLE_VALUE) {
+             return true;
+         }
+         // Windows cannot convert a lock, so the current hold is released first
+         OVERLAPPED overlapped;
+         memset(&overlapped, 0, sizeof(OVERLAPPED));
+         overlapped.Offset = LOCK_PRESENCE;
+         UnlockFileEx(lock_file, 0, 1, 0, &overlapped);
+         if (alone && LockFileEx(lock_file, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, 1, 0, &overlapped)) {
+             return true;
+         }
+         LockFileEx(lock_file, 0, 0, 1, 0, &overlapped);
+         return !alone;
+     #else
+         if (lock_file < 0) {
+             return true;
+         }
+         struct flock lock;
+         memset(&lock, 0, sizeof(lock));
+         lock.l_type = alone ? F_WRLCK : F_RDLCK;
+         lock.l_whence = SEEK_SET;
+         lock.l_start = LOCK_PRESENCE;
+         lock.l_len = 1;
+         if (alone) {
+             return fcntl(lock_file, F_SETLK, &lock) == 0;
+         }
+         while (fcntl(lock_file, F_SETLKW, &lock) != 0 && errno == EINTR) {
+         }
+         return true;
+     #endif
+ }
+ 
+ // Open a record file for appending whole records: unbuffered, so each fwrite is a single append other processes cannot split
+ FILE *openAppend(const char *filename) {
+     FILE *file = fopen(filename, "ab");
+     if (file != NULL) {
+         setvbuf(file, NULL, _IONBF, 0);
+     }
+     return file;
+ }
+
+ // Initialize an empty record table (releases the rows of a previous use)
+ void tableInit(RecordTable *table, size_t row_size) {
+     for (int i = table->borrowed_chunks; i < table->chunk_count; i++) {
+         free(table->chunks[i]);
+     }
+     free(table->chunks);
+     unmapRecordFile(&table->source);
+     
+     table->row_size = row_size;
+     table->chunks = NULL;
+     table->chunk_count = 0;
+     table->chunk_capacity = 0;
+     table->count = 0;
+     table->borrowed_chunks = 0;
+ }
+ 
+ // Get a pointer to a table row (valid for the lifetime of the table)
+ void *tableRow(const RecordTable *table, int row) {
+     return table->chunks[row >> TABLE_CHUNK_SHIFT] + (size_t)(row & (TABLE_CHUNK_ROWS - 1)) * table->row_size;
+ }
+ 
+ /**
+  * Add a row to a record table
+  * 
+  * Allocates a new chunk when the last one is full. Existing chunks are never
+  * moved or resized, so pointers to existing rows remain valid.
+  * 
+  * @param table - Table to grow
+  * @return void* - Pointer to the new, zeroed row
+  */
+ void *tableAppend(RecordTable *table) {
+     int chunk = table->count >> TABLE_CHUNK_SHIFT;
+     
+     if (chunk == table->chunk_count) {
+         if (table->chunk_count == table->chunk_capacity) {
+             int new_capacity = table->chunk_capacity == 0 ? 16 : table->chunk_capacity * 2;
+             unsigned char **grown = realloc(table->chunks, sizeof(unsigned char *) * new_capacity);
+             if (grown == NULL) {
+                 printf("Error: Out of memory while growing table.\n");
+                 exit(1);
+             }
+             table->chunks = grown;
+             table->chunk_capacity = new_capacity;
+         }
+         
+         table->chunks[chunk] = malloc(table->row_size * TABLE_CHUNK_ROWS);
+         if (table->chunks[chunk] == NULL) {
+             printf("Error: Out of memory while growing table.\n");
+             exit(1);
+         }
+         table->chunk_count++;
+     }
+     
+     void *row = tableRow(table, table->count);
+     memset(row, 0, table->row_size);
+     table->count++;
+     return row;
+ }
+ 
+ // Overwrite an existing row, or append when row is the next row number
+ bool tableStore(RecordTable *table, int row, const void *data) {
+     if (row < 0 || row > table->count) {
+         return false;
+     }
+     
+     void *target = (row == table->count) ? tableAppend(table) : tableRow(table, row);
+     memcpy(target, data, table->row_size);
+     return true;
+ }
+ 
+ // Write every row of a table to a record file and sync it
+ bool writeTableFile(const char *filename, const RecordTable *table) {
+     FILE *file = fopen(filename, "wb");
+     bool written = file != NULL && writeTableRows(file, table);
+     if (file != NULL) {
+         written = syncFile(file) && written;
+         fclose(file);
+     }
+     return written;
+ }
+ 
+ // Write every row of a table to an open file, one chunk per write
+ bool writeTableRows(FILE *file, const RecordTable *table) {
+     for (int row = 0; row < table->count; row += TABLE_CHUNK_ROWS) {
+         int rows = table->count - row < TABLE_CHUNK_ROWS ? table->count - row : TABLE_CHUNK_ROWS;
+         if (fwrite(tableRow(table, row), table->row_size, rows, file) != (size_t)rows) {
+             return false;
+         }
+     }
+     return true;
+ }
+ 
+ // Get a customer row
+ Customer *customerAt(int index) {
+     return (Customer *)tableRow(&customer_table, index);
+ }
+ 
+ // Get a premises row
+ Premises *premisesAt(int index) {
+     return (Premises *)tableRow(&premises_table, index);
+ }
+
+ /**
+  * Map a fixed-size record file into memory
+  * 
+  * The records can then be read in place as an array of structs in their
+  * on-disk layout, with no per-record reads or copies. The mapping is
+  * private: rows may be modified in memory without touching the file. Where
+  * mmap is unavailable the file is read into memory with a single read.
+  * 
+  * @param filename - Record file to map
+  * @param record_size - Size of each record
+  * @param mapped - Receives the mapping
+  * @return bool - True if the file exists and was loaded (it may be empty)
+  */
+ bool mapRecordFile(const char *filename, size_t record_size, MappedFile *mapped) {
+     memset(mapped, 0, sizeof(MappedFile));
+     
+     #ifndef _WIN32
+         int fd = open(filename, O_RDONLY);
+         if (fd < 0) {
+             return false;
+         }
+         
+         struct stat info;
+         if (fstat(fd, &info) == 0) {
+             mapped->count = (long)(info.st_size / (off_t)record_size);
+             mapped->size = (size_t)mapped->count * record_size;
+             
+             if (mapped->size == 0) {
+                 close(fd);
+                 return true;
+             }
+             
+             void *data = mmap(NULL, mapped->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+             if (data != MAP_FAILED) {
+                 close(fd);
+                 mapped->data = data;
+                 mapped->mapped = true;
+                 return true;
+             }
+         }
+         close(fd);
+     #endif
+     
+     // Fall back to one bulk read into the heap
+     FILE *file = fopen(filename, "rb");
+     if (file == NULL) {
+         return false;
+     }
+     
+     fseek(file, 0, SEEK_END);
+     long length = ftell(file);
+     fseek(file, 0, SEEK_SET);
+     
+     mapped->count = length / (long)record_size;
+     mapped->size = (size_t)mapped->count * record_size;
+     if (mapped->size > 0) {
+         mapped->data = malloc(mapped->size);
+         if (mapped->data == NULL || fread(mapped->data, record_size, mapped->count, file) != (size_t)mapped->count) {
+             free(mapped->data);
+             memset(mapped, 0, sizeof(MappedFile));
+         }
+     }
+     fclose(file);
+     
+     return true;
+ }
+ 
+ // Release a mapped record file
+ void unmapRecordFile(MappedFile *mapped) {
+     if (mapped->data != NULL) {
+         #ifndef _WIN32
+             if (mapped->mapped) {
+                 munmap(mapped->data, mapped->size);
+             } else {
+                 free(mapped->data);
+             }
+         #else
+             free(mapped->data);
+         #endif
+     }
+     memset(mapped, 0, sizeof(MappedFile));
+ }
+ 
+ /**
+  * Load a record table from a record file
+  * 
+  * Maps the file and adopts every full chunk's worth of records in place, so
+  * loading costs no per-record reads or copies (pages are faulted in on first
+  * use and copied only when a row is modified). The final partial chunk is
+  * copied into a heap chunk so the table can keep growing.
+  * 
+  * @param table - Table to load (any previous contents are released)
+  * @param row_size - Size of each row
+  * @param filename - Record file to load
+  */
+ void tableLoad(RecordTable *table, size_t row_size, const char *filename) {
+     tableInit(table, row_size);
+     
+     if (!mapRecordFile(filename, row_size, &table->source) || table->source.count == 0) {
+         return;
+     }
+     
+     int full_chunks = (int)(table->source.count >> TABLE_CHUNK_SHIFT);
+     table->chunk_capacity = full_chunks + 16;
+     table->chunks = malloc(sizeof(unsigned char *) * table->chunk_capacity);
+     if (table->chunks == NULL) {
+         printf("Error: Out of memory while loading %s.\n", filename);
+         exit(1);
+     }
+     
+     unsigned char *data = table->source.data;
+     for (int i = 0; i < full_chunks; i++) {
+         table->chunks[i] = data + (size_t)i * TABLE_CHUNK_ROWS * row_size;
+     }
+     table->chunk_count = full_chunks;
+     table->borrowed_chunks = full_chunks;
+     table->count = full_chunks * TABLE_CHUNK_ROWS;
+     
+     for (long i = table->count; i < table->source.count; i++) {
+         memcpy(tableAppend(table), data + (size_t)i * row_size, row_size);
+     }
+ }
+
+ // Get a user row
+ User *userAt(int index) {
+     return (User *)tableRow(&user_table, index);
+ }
+ 
+ /**
+  * Build the lookup indexes
+  * 
+  * Indexes every loaded user by email, every customer by its user account
+  * and number, and every premises by number. Premises are also linked into
+  * a list per customer, so signing in and finding a customer's premises
+  * cost hash lookups instead of scans of the record files. The number
+  * allocators and the next user ID are rebuilt from the same rows, so
+  * customers.txt, premises.txt and users.txt stay their only record.
+  */
+ void buildLookupIndexes() {
+     hashIndexFree(&users_by_email);
+     hashIndexFree(&customers_by_user_id);
+     hashIndexFree(&customers_by_number);
+     hashIndexFree(&premises_by_number);
+     hashIndexInit(&users_by_email, user_table.count);
+     hashIndexInit(&customers_by_user_id, customer_table.count);
+     hashIndexInit(&customers_by_number, customer_table.count);
+     hashIndexInit(&premises_by_number, premises_table.count);
+     tableInit(&customer_keys, sizeof(CustomerKey));
+     tableInit(&premises_keys, sizeof(PremisesKey));
+     numbersInit(&customer_numbers);
+     numbersInit(&premises_numbers);
+     next_user_id = 1;
+     
+     for (int i = 0; i < user_table.count; i++) {
+         hashIndexInsert(&users_by_email, hashString(userAt(i)->email), i);
+         if (userAt(i)->id >= next_user_id) {
+             next_user_id = userAt(i)->id + 1;
+         }
+     }
+     
+     for (int i = 0; i < customer_table.count; i++) {
+         indexCustomerRow(i);
+     }
+     
+     for (int i = 0; i < premises_table.count; i++) {
+         indexPremisesRow(i);
+     }
+ }
+ 
+ // Add a customer row to the lookup indexes
+ void indexCustomerRow(int row) {
+     Customer *customer = customerAt(row);
+     CustomerKey *key = tableAppend(&customer_keys);
+     
+     key->number_key = packNumber(customer->customer_number);
+     key->first_premises = -1;
+     key->last_premises = -1;
+     hashIndexInsert(&customers_by_number, key->number_key, row);
+     markNumber(&customer_numbers, key->number_key);
+     
+     if (customer->user_id != 0) {
+         hashIndexInsert(&customers_by_user_id, (uint64_t)(uint32_t)customer->user_id, row);
+     }
+ }
+ 
+ // Add a premises row to the lookup indexes and link it to its customer
+ void indexPremisesRow(int row) {
+     Premises *premises = premisesAt(row);
+     PremisesKey *key = tableAppend(&premises_keys);
+     int customer_row = findCustomerRow(premises->customer_number, true);
+     
+     if (customer_row < 0) {
+         customer_row = findCustomerRow(premises->customer_number, false);
+     }
+     
+     key->number_key = packNumber(premises->premises_number);
+     key->customer_row = customer_row;
+     key->next_premises = -1;
+     hashIndexInsert(&premises_by_number, key->number_key, row);
+     markNumber(&premises_numbers, key->number_key);
+     
+     if (customer_row >= 0) {
+         CustomerKey *owner = tableRow(&customer_keys, customer_row);
+         if (owner->last_premises >= 0) {
+             ((PremisesKey *)tableRow(&premises_keys, owner->last_premises))->next_premises = row;
+         } else {
+             owner->first_premises = row;
+         }
+         owner->last_premises = row;
+     }
+ }
+ 
+ /**
+  * Pack a customer or premises number
+  * 
+  * Numbers are exactly 7 digits, so they fit an integer key in the range
+  * 0..9999999. Leading zeros are significant in the text form but cannot
+  * collide once packed, because every number has the same length.
+  * 
+  * @param number - 7-digit number
+  * @return uint32_t - Packed key, or NUMBER_NONE if the number is malformed
+  */
+ uint32_t packNumber(const char *number) {
+     uint32_t key = 0;
+     
+     for (int i = 0; i < 7; i++) {
+         if (!isdigit((unsigned char)number[i])) {
+             return NUMBER_NONE;
+         }
+         key = key * 10 + (uint32_t)(number[i] - '0');
+     }
+     
+     return number[7] == '\0' ? key : NUMBER_NONE;
+ }
+ 
+ // Clear a number allocator (allocating its bitmap on first use)
+ void numbersInit(NumberAllocator *numbers) {
+     size_t size = sizeof(uint64_t) * (NUMBER_LIMIT / 64);
+     
+     if (numbers->words == NULL) {
+         numbers->words = malloc(size);
+         if (numbers->words == NULL) {
+             printf("Error: Out of memory while indexing customer numbers.\n");
+             exit(1);
+         }
+     }
+     memset(numbers->words, 0, size);
+     numbers->cursor = NUMBER_FIRST / 64;
+ }
+ 
+ // Check if a packed number is in use (malformed numbers never are)
+ bool numberInUse(const NumberAllocator *numbers, uint32_t key) {
+     return key < NUMBER_LIMIT && (numbers->words[key / 64] >> (key % 64) & 1) != 0;
+ }
+ 
+ // Mark a packed number as in use
+ void markNumber(NumberAllocator *numbers, uint32_t key) {
+     if (key < NUMBER_LIMIT) {
+         numbers->words[key / 64] |= (uint64_t)1 << (key % 64);
+     }
+ }
+ 
+ /**
+  * Take the lowest free number
+  * 
+  * Skips whole words of used numbers from the cursor, which only moves
+  * back when a number whose record was never committed is released, so
+  * allocating is O(1) amortized and checking a number is one bit test.
+  * The number is marked in use at once, so numbers handed out before
+  * their records are committed are not handed out twice.
+  * 
+  * @param numbers - Number allocator
+  * @param number - Buffer for the 7-digit number (at least 8 chars)
+  * @return bool - True if a number was free
+  */
+ bool allocateNumber(NumberAllocator *numbers, char *number) {
+     while (numbers->cursor < NUMBER_LIMIT / 64 && numbers->words[numbers->cursor] == UINT64_MAX) {
+         numbers->cursor++;
+     }
+     if (numbers->cursor == NUMBER_LIMIT / 64) {
+         return false;
+     }
+     
+     uint64_t word = numbers->words[numbers->cursor];
+     uint32_t bit = 0;
+     while ((word >> bit & 1) != 0) {
+         bit++;
+     }
+     
+     uint32_t key = (uint32_t)numbers->cursor * 64 + bit;
+     markNumber(numbers, key);
+     sprintf(number, "%07u", (unsigned int)key);
+     return true;
+ }
+ 
+ // Give back an allocated number whose record was never committed (the caller checks no record has it)
+ void releaseNumber(NumberAllocator *numbers, const char *number) {
+     uint32_t key = packNumber(number);
+     if (key < NUMBER_LIMIT) {
+         numbers->words[key / 64] &= ~((uint64_t)1 << (key % 64));
+         if ((int32_t)(key / 64) < numbers->cursor) {
+             numbers->cursor = (int32_t)(key / 64);
+         }
+     }
+ }
+ 
+ // Take the next sequential user ID
+ int allocateUserId() {
+     return next_user_id++;
+ }
+ 
+ // Look up a customer row by number (-1 if not found)
+ int findCustomerRow(const char *customer_number, bool active_only) {
+     uint32_t key = packNumber(customer_number);
+     int cursor = -1;
+     int32_t row;
+     
+     if (key == NUMBER_NONE) {
+         return -1;
+     }
+     
+     while ((row = hashIndexFind(&customers_by_number, key, &cursor)) >= 0) {
+         if (!active_only || customerAt(row)->is_active) {
+             return row;
+         }
+     }
+     
+     return -1;
+ }
+ 
+ // Look up a premises row by number (-1 if not found)
+ int findPremisesRow(const char *premises_number, bool active_only) {
+     uint32_t key = packNumber(premises_number);
+     int cursor = -1;
+     int32_t row;
+     
+     if (key == NUMBER_NONE) {
+         return -1;
+     }
+     
+     while ((row = hashIndexFind(&premises_by_number, key, &cursor)) >= 0) {
+         if (!active_only || premisesAt(row)->is_active) {
+             return row;
+         }
+     }
+     
+     return -1;
+ }
+ 
+ // Look up a premises row of a customer by number (-1 if the customer has no such premises)
+ int findCustomerPremisesRow(int customer_row, const char *premises_number, bool active_only) {
+     uint32_t key = packNumber(premises_number);
+     
+     if (key == NUMBER_NONE) {
+         return -1;
+     }
+     
+     for (int i = firstCustomerPremises(customer_row); i >= 0; i = nextCustomerPremises(i)) {
+         PremisesKey *premises_key = tableRow(&premises_keys, i);
+         if (premises_key->number_key == key && (!active_only || premisesAt(i)->is_active)) {
+             return i;
+         }
+     }
+     
+     return -1;
+ }
+ 
+ // Get the first premises row of a customer (-1 if none)
+ int firstCustomerPremises(int customer_row) {
+     if (customer_row < 0 || customer_row >= customer_keys.count) {
+         return -1;
+     }
+     return ((CustomerKey *)tableRow(&customer_keys, customer_row))->first_premises;
+ }
+ 
+ // Get the next premises row of the same customer (-1 if it was the last)
+ int nextCustomerPremises(int premises_row) {
+     return ((PremisesKey *)tableRow(&premises_keys, premises_row))->next_premises;
+ }
+
+ // Get the customer row a premises belongs to (-1 if its customer is unknown)
+ int premisesCustomerRow(int premises_row) {
+     return ((PremisesKey *)tableRow(&premises_keys, premises_row))->customer_row;
+ }
+ 
+ // Get the ledger row of a premises
+ PremisesLedger *ledgerAt(int premises_row) {
+     return (PremisesLedger *)tableRow(&ledger_table, premises_row);
+ }
+ 
+ /**
+  * Load the premises ledger
+  * 
+  * Reads ledger.txt, which holds one row per premises row. The ledger is
+  * rebuilt from bills.txt if it is missing, has a different number of rows
+  * than premises.txt, or any row belongs to a different premises.
+  */
+ void loadLedger() {
+     tableLoad(&ledger_table, sizeof(PremisesLedger), FILE_LEDGER);
+     
+     bool valid = ledger_table.count == premises_table.count;
+     for (int i = 0; i < ledger_table.count && valid; i++) {
+         valid = strncmp(ledgerAt(i)->premises_number, premisesAt(i)->premises_number, sizeof(ledgerAt(i)->premises_number)) == 0;
+     }
+     
+     if (!valid) {
+         rebuildLedger();
+     }
+ }
+ 
+ /**
+  * Rebuild the premises ledger
+  * 
+  * Replays bills.txt once in record order and rewrites ledger.txt. The
+  * unpaid count, outstanding balance and last month are exact. Credit is
+  * not recorded on the bills, so it is recovered only where a premises'
+  * latest bill was overpaid (credit from an older bill has normally been
+  * used by the bill after it).
+  */
+ void rebuildLedger() {
+     tableInit(&ledger_table, sizeof(PremisesLedger));
+     for (int i = 0; i < premises_table.count; i++) {
+         PremisesLedger *ledger = tableAppend(&ledger_table);
+         memcpy(ledger->premises_number, premisesAt(i)->premises_number, sizeof(ledger->premises_number));
+     }
+     
+     MappedFile bills;
+     if (mapRecordFile(FILE_BILLS, sizeof(Bill), &bills)) {
+         const Bill *bill = bills.data;
+         for (long k = 0; k < bills.count; k++) {
+             int premises_row = findPremisesRow(bill[k].premises_number, false);
+             if (premises_row < 0) {
+                 continue;
+             }
+     
+             PremisesLedger *ledger = ledgerAt(premises_row);
+             Money balance = billBalance(&bill[k]);
+             if (!bill[k].is_paid) {
+                 ledger->unpaid_count++;
+                 ledger->outstanding += balance;
+             }
+             ledger->last_month = bill[k].month_number;
+             ledger->last_year = bill[k].year;
+             ledger->credit = bill[k].is_paid && balance < 0 ? -balance : 0;
+         }
+         unmapRecordFile(&bills);
+     }
      
-     strftime(date, 11, "%Y-%m-%d", tm_info);
- }
- 
- // Generate a random number between min and max (inclusive)
- int generateRandomNumber(int min, int max) {
-     return min + rand() % (max - min + 1);
+     if (!writeTableFile(FILE_LEDGER, &ledger_table)) {
+         printf("Warning: Could not write premises ledger file.\n");
+     }
  }
  
  /**
-  * Calculate water charge based on consumption
+  * Account for a bill in a premises ledger
   * 
-  * Applies tiered rating system based on water consumption brackets:
-  * - 0-14,000 litres: $149.55 per cubic meter
-  * - 14,001-27,000 litres: $266.15 per cubic meter
-  * - 27,001-41,000 litres: $290.10 per cubic meter
-  * - Over 41,000 litres: $494.87 per cubic meter
+  * Removes what the bill contributed before the change and adds what it
+  * contributes after it. A new bill (before is NULL) also becomes the last
+  * month and year billed and uses up any credit, which prepareBill has already
+  * deducted from its overdue amount. A bill settled with money to spare,
+  * by a payment or by credit larger than the bill, adds the excess to the
+  * credit.
   * 
-  * @param consumption - Water consumption in litres
-  * @return float - Calculated water charge
-  */
- float calculateWaterCharge(int consumption) {
-     float charge = 0.0;
-     
-     if (consumption <= 14000) {
-         charge = consumption * 149.55 / 1000; // Convert to cubic meters rate
-     } else if (consumption <= 27000) {
-         charge = 14000 * 149.55 / 1000;
-         charge += (consumption - 14000) * 266.15 / 1000;
-     } else if (consumption <= 41000) {
-         charge = 14000 * 149.55 / 1000;
-         charge += 13000 * 266.15 / 1000;
-         charge += (consumption - 27000) * 290.10 / 1000;
-     } else {
-         charge = 14000 * 149.55 / 1000;
-         charge += 13000 * 266.15 / 1000;
-         charge += 14000 * 290.10 / 1000;
-         charge += (consumption - 41000) * 494.87 / 1000;
+  * @param ledger - Ledger row to update
+  * @param before - Bill as it was (NULL for a new bill)
+  * @param after - Bill as it is now
+  */
+ void ledgerRecordBill(PremisesLedger *ledger, const Bill *before, const Bill *after) {
+     if (before == NULL) {
+         ledger->last_month = after->month_number;
+         ledger->last_year = after->year;
+         ledger->credit = 0;
+     } else if (!before->is_paid) {
+         ledger->unpaid_count--;
+         ledger->outstanding -= billBalance(before);
      }
      
-     return charge;
+     Money balance = billBalance(after);
+     if (!after->is_paid) {
+         ledger->unpaid_count++;
+         ledger->outstanding += balance;
+     } else if ((before == NULL || !before->is_paid) && balance < 0) {
+         ledger->credit += -balance;
+     }
  }
  
  /**
-  * Calculate sewerage charge based on consumption
+  * Load the report views
   * 
-  * Applies tiered rating system based on consumption brackets:
-  * - 0-14,000 litres: $172.72 per cubic meter
-  * - 14,001-27,000 litres: $307.42 per cubic meter
-  * - 27,001-41,000 litres: $335.06 per cubic meter
-  * - Over 41,000 litres: $571.56 per cubic meter
+  * Reads the paid, owing and archived views as they were last
+  * checkpointed. Whether they are in step with bills.txt can only be told
+  * once the journal has been replayed over them (see checkReportViews).
+  */
+ void loadReportViews() {
+     tableLoad(&report_views.paid, sizeof(BillViewRow), FILE_PAID_VIEW);
+     tableLoad(&report_views.owing, sizeof(BillViewRow), FILE_OWING_VIEW);
+     tableLoad(&report_views.archived, sizeof(ArchivedViewRow), FILE_ARCHIVED_VIEW);
+     indexReportViews();
+ }
+ 
+ /**
+  * Check the report views against bills.txt
   * 
-  * @param consumption - Water consumption in litres
-  * @return float - Calculated sewerage charge
-  */
- float calculateSewerageCharge(int consumption) {
-     float charge = 0.0;
-     
-     if (consumption <= 14000) {
-         charge = consumption * 172.72 / 1000; // Convert to cubic meters rate
-     } else if (consumption <= 27000) {
-         charge = 14000 * 172.72 / 1000;
-         charge += (consumption - 14000) * 307.42 / 1000;
-     } else if (consumption <= 41000) {
-         charge = 14000 * 172.72 / 1000;
-         charge += 13000 * 307.42 / 1000;
-         charge += (consumption - 27000) * 335.06 / 1000;
-     } else {
-         charge = 14000 * 172.72 / 1000;
-         charge += 13000 * 307.42 / 1000;
-         charge += 14000 * 335.06 / 1000;
-         charge += (consumption - 41000) * 571.56 / 1000;
+  * Every bill must be listed exactly once across the paid and owing views,
+  * and the archived view must hold one row per archived customer. Views
+  * that are missing or out of step are rebuilt, but only by a process that
+  * is alone with an empty journal: journaled view rows are positions in the
+  * views as they were, and would land on the wrong rows of rebuilt files.
+  * Otherwise the views are left until a later start. The caller holds
+  * LOCK_JOURNAL and has caught up with the journal.
+  */
+ void checkReportViews() {
+     long bills = countRecords(FILE_BILLS, sizeof(Bill));
+     long listed = report_views.paid.count;
+     bool valid = true;
+     for (int i = 0; i < report_views.paid.count && valid; i++) {
+         int32_t record = ((BillViewRow *)tableRow(&report_views.paid, i))->record;
+         valid = record >= 0 && record < bills;
      }
+     for (int i = 0; i < report_views.owing.count && valid; i++) {
+         int32_t record = ((BillViewRow *)tableRow(&report_views.owing, i))->record;
+         if (record >= 0) {
+             valid = record < bills;
+             listed++;
+         }
+     }
+     valid = valid && listed == bills;
      
-     return charge;
+     int archived = 0;
+     for (int i = 0; i < customer_table.count; i++) {
+         archived += !customerAt(i)->is_active;
+     }
+     valid = valid && archived == report_views.archived.count;
+     for (int i = 0; i < report_views.archived.count && valid; i++) {
+         int customer_row = findCustomerRow(((ArchivedViewRow *)tableRow(&report_views.archived, i))->customer_number, false);
+         valid = customer_row >= 0 && !customerAt(customer_row)->is_active;
+     }
+     
+     if (valid) {
+         return;
+     }
+     
+     if (journal.applied == 0 && holdDataDirectory(true)) {
+         rebuildReportViews();
+         holdDataDirectory(false);
+     } else {
+         printf("Warning: The report views are out of step; they will be rebuilt when no other session is running.\n");
+     }
  }
  
- // Calculate service charge based on meter size
- float calculateServiceCharge(MeterSize meter_size) {
-     switch (meter_size) {
-         case METER_15MM:
-             return 1155.92;
-         case METER_30MM:
-             return 6217.03;
-         case METER_150MM:
-             return 39354.59;
-         default:
-             return 0.0;
+ /**
+  * Rebuild the report views
+  * 
+  * Lists every bill in the paid or owing view from one report pass over
+  * bills.txt and every archived customer, with the balance of their unpaid
+  * bills, in the archived view, then rewrites the view files. Archive dates
+  * are not recorded elsewhere, so rebuilt archived rows have none.
+  */
+ void rebuildReportViews() {
+     ReportPass pass;
+     bool scanned = runReportPass(&pass);
+     
+     tableInit(&report_views.paid, sizeof(BillViewRow));
+     tableInit(&report_views.owing, sizeof(BillViewRow));
+     tableInit(&report_views.archived, sizeof(ArchivedViewRow));
+     
+     if (scanned) {
+         const Bill *bills = pass.bills.data;
+         for (int i = 0; i < pass.paid.count; i++) {
+             int32_t record = ((ReportLine *)tableRow(&pass.paid, i))->record;
+             fillBillViewRow(tableAppend(&report_views.paid), record, &bills[record]);
+         }
+         for (int i = 0; i < pass.owing.count; i++) {
+             int32_t record = ((ReportLine *)tableRow(&pass.owing, i))->record;
+             fillBillViewRow(tableAppend(&report_views.owing), record, &bills[record]);
+         }
+     }
+     
+     for (int i = 0; i < customer_table.count; i++) {
+         if (customerAt(i)->is_active) {
+             continue;
+         }
+         ArchivedViewRow *row = tableAppend(&report_views.archived);
+         memcpy(row->customer_number, customerAt(i)->customer_number, sizeof(row->customer_number));
+         
+         int cursor = -1;
+         int32_t position = hashIndexFind(&pass.by_customer, packNumber(row->customer_number), &cursor);
+         if (position >= 0) {
+             row->balance = ((CustomerTotals *)tableRow(&pass.customers, position))->owing_balance;
+         }
+     }
+     releaseReportPass(&pass);
+     indexReportViews();
+     
+     bool written = writeTableFile(FILE_PAID_VIEW, &report_views.paid);
+     written = writeTableFile(FILE_OWING_VIEW, &report_views.owing) && written;
+     written = writeTableFile(FILE_ARCHIVED_VIEW, &report_views.archived) && written;
+     if (!written) {
+         printf("Warning: Could not write report view files.\n");
      }
  }
  
- // Check if customer number already exists
- bool isCustomerNumberExists(const char *customer_number) {
-     for (int i = 0; i < customer_count; i++) {
-         if (strcmp(customers[i].customer_number, customer_number) == 0) {
-             return true;
+ // Rebuild the owing and archived lookups and the owing free list from the view tables
+ void indexReportViews() {
+     hashIndexFree(&report_views.owing_by_record);
+     hashIndexFree(&report_views.archived_by_customer);
+     hashIndexInit(&report_views.owing_by_record, report_views.owing.count);
+     hashIndexInit(&report_views.archived_by_customer, report_views.archived.count);
+     report_views.free_count = 0;
+     
+     for (int i = 0; i < report_views.owing.count; i++) {
+         int32_t record = ((BillViewRow *)tableRow(&report_views.owing, i))->record;
+         if (record >= 0) {
+             hashIndexInsert(&report_views.owing_by_record, (uint64_t)record, i);
+         } else {
+             releaseOwingViewRow(i);
          }
      }
-     return false;
+     for (int i = 0; i < report_views.archived.count; i++) {
+         const ArchivedViewRow *row = tableRow(&report_views.archived, i);
+         hashIndexInsert(&report_views.archived_by_customer, packNumber(row->customer_number), i);
+     }
  }
  
- // Check if premises number already exists (for active premises)
- bool isPremisesNumberExists(const char *premises_number) {
-     for (int i = 0; i < premises_count; i++) {
-         if (strcmp(premises[i].premises_number, premises_number) == 0 && premises[i].is_active) {
-             return true;
+ // Build the paid or owing view row of a bill (amount paid if settled, balance otherwise)
+ void fillBillViewRow(BillViewRow *row, int32_t record, const Bill *bill) {
+     memset(row, 0, sizeof(BillViewRow));
+     row->record = record;
+     row->month_number = bill->month_number;
+     memcpy(row->customer_number, bill->customer_number, sizeof(row->customer_number));
+     memcpy(row->premises_number, bill->premises_number, sizeof(row->premises_number));
+     row->amount = bill->is_paid ? moneyFromDouble(bill->amount_paid) : billBalance(bill);
+ }
+ 
+ // Look up the owing view row of an unpaid bill (-1 if the bill is not listed)
+ int32_t findOwingViewRow(int32_t record) {
+     int cursor = -1;
+     int32_t row;
+     
+     while ((row = hashIndexFind(&report_views.owing_by_record, (uint64_t)record, &cursor)) >= 0) {
+         if (row < report_views.owing.count && ((BillViewRow *)tableRow(&report_views.owing, row))->record == record) {
+             return row;
          }
      }
-     return false;
+     
+     return -1;
  }
  
- // Check if email already exists
- bool isEmailExists(const char *email) {
-     FILE *file = fopen(FILE_USERS, "rb");
-     if (file != NULL) {
-         User user;
-         while (fread(&user, sizeof(User), 1, file) == 1) {
-             if (strcmp(user.email, email) == 0) {
-                 fclose(file);
-                 return true;
-             }
+ // Add a settled owing view row to the free list
+ void releaseOwingViewRow(int32_t row) {
+     if (report_views.free_count == report_views.free_capacity) {
+         int new_capacity = report_views.free_capacity == 0 ? 64 : report_views.free_capacity * 2;
+         int32_t *grown = realloc(report_views.free_owing, sizeof(int32_t) * new_capacity);
+         if (grown == NULL) {
+             printf("Error: Out of memory while indexing the report views.\n");
+             exit(1);
          }
-         fclose(file);
+         report_views.free_owing = grown;
+         report_views.free_capacity = new_capacity;
      }
-     return false;
+     report_views.free_owing[report_views.free_count++] = row;
  }
  
- // Mask password input
- void maskPassword(char *password) {
-     char ch;
-     int i = 0;
-     
-     while (1) {
-         ch = getchar();
-         
-         if (ch == '\n' || ch == '\r') {
-             password[i] = '\0';
-             break;
-         } else if (ch == '\b' && i > 0) { // Backspace
-             i--;
-             printf("\b \b");
-         } else if (ch != '\b') {
-             password[i++] = ch;
-             printf("*");
+ // Take an owing view row that is in use again off the free list (rows are reused from the top, so it is normally found at once)
+ void claimOwingViewRow(int32_t row) {
+     for (int i = report_views.free_count - 1; i >= 0; i--) {
+         if (report_views.free_owing[i] == row) {
+             memmove(&report_views.free_owing[i], &report_views.free_owing[i + 1], sizeof(int32_t) * (report_views.free_count - i - 1));
+             report_views.free_count--;
+             return;
          }
      }
-     printf("\n");
  }
  
  /**
-  * Get daily usage limit based on income class
-  * 
-  * Returns the maximum daily water usage limit in litres according to
-  * the customer's assigned income class.
+  * Give the rows of the staged group that have no row number their row numbers
   * 
-  * @param income_class - Customer's income class
-  * @return int - Daily usage limit in litres
+  * stageReportViews stages the owing row of a new unpaid bill and the paid
+  * row of a settled one as row -1, and payments are staged as record -1.
+  * Each owing row is given a free row, newest first, or else a row after
+  * the end of the view, and each paid row and payment the next row after
+  * the end of the paid view or payments.txt. Called by
+  * journalCommit holding LOCK_JOURNAL after catching up, so no other
+  * process can take the same rows; the free list and row counts change
+  * only when the group is applied, which leaves them intact if the commit
+  * fails.
   */
- int getDailyUsageLimit(IncomeClass income_class) {
-     switch (income_class) {
-         case LOW:
-             return 125;
-         case LOW_MEDIUM:
-             return 175;
-         case MEDIUM:
-             return 220;
-         case MEDIUM_HIGH:
-             return 250;
-         case HIGH:
-             return 300;
-         default:
-             return 150; // Default value
+ void placeStagedRows() {
+     int reused = 0;
+     int appended = 0;
+     int paid = 0;
+     int payments = 0;
+     size_t offset = 0;
+     
+     while (offset + sizeof(JournalRecordHeader) <= journal.size) {
+         JournalRecordHeader header;
+         memcpy(&header, journal.data + offset, sizeof(JournalRecordHeader));
+         if (header.target == JOURNAL_OWING_VIEW && header.record < 0) {
+             header.record = reused < report_views.free_count ? report_views.free_owing[report_views.free_count - 1 - reused++]
+                                                              : report_views.owing.count + appended++;
+             memcpy(journal.data + offset, &header, sizeof(JournalRecordHeader));
+         } else if (header.target == JOURNAL_PAID_VIEW && header.record < 0) {
+             header.record = report_views.paid.count + paid++;
+             memcpy(journal.data + offset, &header, sizeof(JournalRecordHeader));
+         } else if (header.target == JOURNAL_PAYMENTS && header.record < 0) {
+             header.record = payment_count + payments++;
+             memcpy(journal.data + offset, &header, sizeof(JournalRecordHeader));
+         }
+         offset += sizeof(JournalRecordHeader) + header.size;
      }
  }
  
  /**
-  * Log system activity
+  * Stage the report view changes of a new or updated bill
   * 
-  * Records customer activities including payments and meter surrenders.
-  * Updates existing logs or creates new log entries as needed.
+  * A new unpaid bill takes an owing row (a settled one if any is free,
+  * chosen when the group commits by placeStagedRows), a part payment
+  * rewrites the bill's owing row with its new balance, and a bill that
+  * becomes paid frees its owing row and is appended to the paid view. If
+  * the bill belongs to an archived customer, the customer's archived view
+  * row is restaged with the change in balance, so each journal group may
+  * update the bills of an archived customer only once.
   * 
-  * @param customer_number - Customer number
-  * @param payment_amount - Amount paid (0 if not a payment activity)
-  * @param surrender_meter - True if this is a meter surrender activity
+  * @param record - Record number of the bill in bills.txt
+  * @param before - Bill as it was before the update (NULL for a new bill)
+  * @param after - Bill as it is staged
   */
- void logActivity(const char *customer_number, double payment_amount, bool surrender_meter) {
-     SystemLog log;
-     generateID(log.log_id, "LOG");
-     strcpy(log.customer_number, customer_number);
-     getCurrentDate(log.log_date);
+ void stageReportViews(int32_t record, const Bill *before, const Bill *after) {
+     bool was_owing = before != NULL && !before->is_paid;
+     if (before != NULL && !was_owing) {
+         return;
+     }
      
-     // Read existing log for this customer if any
-     FILE *file = fopen(FILE_LOGS, "rb");
-     if (file != NULL) {
-         SystemLog existing_log;
-         while (fread(&existing_log, sizeof(SystemLog), 1, file) == 1) {
-             if (strcmp(existing_log.customer_number, customer_number) == 0) {
-                 log.payments_count = existing_log.payments_count;
-                 log.last_payment_amount = existing_log.last_payment_amount;
-                 log.meters_surrendered = existing_log.meters_surrendered;
-                 break;
-             }
+     BillViewRow row;
+     int32_t owing_row = was_owing ? findOwingViewRow(record) : -1;
+     if (after->is_paid) {
+         if (owing_row >= 0) {
+             memset(&row, 0, sizeof(BillViewRow));
+             row.record = -1;
+             journalStage(JOURNAL_OWING_VIEW, owing_row, &row, sizeof(BillViewRow));
          }
-         fclose(file);
+         fillBillViewRow(&row, record, after);
+         journalStage(JOURNAL_PAID_VIEW, -1, &row, sizeof(BillViewRow));
+     } else {
+         fillBillViewRow(&row, record, after);
+         journalStage(JOURNAL_OWING_VIEW, owing_row, &row, sizeof(BillViewRow));
      }
      
-     // Update log data
-     if (payment_amount > 0) {
-         log.payments_count++;
-         log.last_payment_amount = payment_amount;
+     // Carry the change in balance to the archived view
+     Money change = (after->is_paid ? 0 : billBalance(after)) - (was_owing ? billBalance(before) : 0);
+     int customer_row = change != 0 ? findCustomerRow(after->customer_number, false) : -1;
+     if (customer_row >= 0 && !customerAt(customer_row)->is_active) {
+         int cursor = -1;
+         int32_t archived_row = hashIndexFind(&report_views.archived_by_customer, packNumber(after->customer_number), &cursor);
+         if (archived_row >= 0) {
+             ArchivedViewRow updated = *(ArchivedViewRow *)tableRow(&report_views.archived, archived_row);
+             updated.balance += change;
+             journalStage(JOURNAL_ARCHIVED_VIEW, archived_row, &updated, sizeof(ArchivedViewRow));
+         }
      }
-     
-     if (surrender_meter) {
-         log.meters_surrendered++;
+ }
+ 
+ // Stage the archived view row of a customer being archived, with today's date and their balance
+ void stageArchivedView(int customer_row) {
+     ArchivedViewRow row;
+     memset(&row, 0, sizeof(ArchivedViewRow));
+     memcpy(row.customer_number, customerAt(customer_row)->customer_number, sizeof(row.customer_number));
+     getCurrentDate(row.archive_date);
+     for (int i = firstCustomerPremises(customer_row); i >= 0; i = nextCustomerPremises(i)) {
+         row.balance += ledgerAt(i)->outstanding;
      }
      
-     // Save to file (append)
-     file = fopen(FILE_LOGS, "ab");
-     if (file != NULL) {
-         fwrite(&log, sizeof(SystemLog), 1, file);
-         fclose(file);
+     int cursor = -1;
+     int32_t archived_row = hashIndexFind(&report_views.archived_by_customer, packNumber(row.customer_number), &cursor);
+     if (archived_row < 0) {
+         archived_row = report_views.archived.count + report_views.staged_archived++;
      }
+     journalStage(JOURNAL_ARCHIVED_VIEW, archived_row, &row, sizeof(ArchivedViewRow));
  }
  
- // Display customer details
- void displayCustomerDetails(const char *customer_number) {
-     bool customer_found = false;
-     int customer_index = -1;
-     
-     // Find customer in array
-     for (int i = 0; i < customer_count; i++) {
-         if (strcmp(customers[i].customer_number, customer_number) == 0) {
-             customer_found = true;
-             customer_index = i;
-             break;
-         }
+ // Open a buffered output file for writing ("-" for standard output)
+ bool writerOpen(BufferedWriter *writer, const char *filename) {
+     if (strcmp(filename, "-") == 0) {
+         return writerAttach(writer, stdout);
      }
      
-     if (!customer_found) {
-         printf("Customer not found.\n");
-         return;
+     FILE *file = fopen(filename, "wb");
+     if (file == NULL || !writerAttach(writer, file)) {
+         if (file != NULL) {
+             fclose(file);
+         }
+         return false;
      }
-     
-     // Display customer details
-     printf("\nCustomer Details:\n");
-     printf("Customer Number: %s\n", customers[customer_index].customer_number);
-     printf("Name: %s %s\n", customers[customer_index].first_name, customers[customer_index].last_name);
-     printf("Status: %s\n", customers[customer_index].is_active ? "Active" : "Archived");
-     printf("Income Class: ");
-     
-     switch (customers[customer_index].income_class) {
-         case LOW:
-             printf("Low (up to 125 L/day)\n");
-             break;
-         case LOW_MEDIUM:
-             printf("Low/Medium (up to 175 L/day)\n");
-             break;
-         case MEDIUM:
-             printf("Medium (up to 220 L/day)\n");
-             break;
-         case MEDIUM_HIGH:
-             printf("Medium/High (up to 250 L/day)\n");
-             break;
-         case HIGH:
-             printf("High (up to 300 L/day)\n");
-             break;
+     writer->borrowed = false;
+     return true;
+ }
+ 
+ // Buffer writes to an open stream that stays open when the writer is closed
+ bool writerAttach(BufferedWriter *writer, FILE *file) {
+     memset(writer, 0, sizeof(BufferedWriter));
+     writer->data = malloc(EXPORT_BUFFER_SIZE);
+     if (writer->data == NULL) {
+         return false;
      }
-     
-     // Display associated premises
-     printf("\nAssociated Premises:\n");
-     bool has_premises = false;
-     
-     for (int i = 0; i < premises_count; i++) {
-         if (strcmp(premises[i].customer_number, customer_number) == 0) {
-             has_premises = true;
-             printf("Premises Number: %s\n", premises[i].premises_number);
-             printf("Status: %s\n", premises[i].is_active ? "Active" : "Inactive");
-             printf("Meter Size: ");
-             
-             switch (premises[i].meter_size) {
-                 case METER_15MM:
-                     printf("15mm\n");
-                     break;
-                 case METER_30MM:
-                     printf("30mm\n");
-                     break;
-                 case METER_150MM:
-                     printf("150mm\n");
-                     break;
+     writer->file = file;
+     writer->borrowed = true;
+     return true;
+ }
+ 
+ // Write out the buffered bytes (later writes are dropped once one fails)
+ void writerFlush(BufferedWriter *writer) {
+     if (writer->size > 0 && !writer->failed) {
+         writer->failed = fwrite(writer->data, 1, writer->size, writer->file) != writer->size;
+     }
+     writer->size = 0;
+ }
+ 
+ // Flush and close a buffered output file, reporting whether every byte was written
+ bool writerClose(BufferedWriter *writer) {
+     writerFlush(writer);
+     if (writer->borrowed) {
+         writer->failed = fflush(writer->file) != 0 || writer->failed;
+     } else if (writer->file != NULL) {
+         writer->failed = fclose(writer->file) != 0 || writer->failed;
+     }
+     free(writer->data);
+     writer->file = NULL;
+     writer->data = NULL;
+     return !writer->failed;
+ }
+ 
+ // Buffer bytes, writing blocks larger than the buffer straight through
+ void writerBytes(BufferedWriter *writer, const char *bytes, size_t length) {
+     if (writer->size + length > EXPORT_BUFFER_SIZE) {
+         writerFlush(writer);
+         if (length > EXPORT_BUFFER_SIZE) {
+             if (!writer->failed) {
+                 writer->failed = fwrite(bytes, 1, length, writer->file) != length;
              }
-             
-             printf("Initial Reading: %d\n", premises[i].initial_reading);
-             printf("Previous Reading: %d\n", premises[i].previous_reading);
-             printf("Current Reading: %d\n", premises[i].current_reading);
-             printf("---------------------------\n");
+             return;
          }
      }
+     memcpy(writer->data + writer->size, bytes, length);
+     writer->size += length;
+ }
+ 
+ // Buffer one character
+ void writerChar(BufferedWriter *writer, char c) {
+     if (writer->size == EXPORT_BUFFER_SIZE) {
+         writerFlush(writer);
+     }
+     writer->data[writer->size++] = c;
+ }
+ 
+ // Buffer a decimal integer (formatted by hand rather than through printf)
+ void writerInt(BufferedWriter *writer, int64_t value) {
+     char digits[24];
+     int start = sizeof(digits);
+     uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+     
+     do {
+         digits[--start] = (char)('0' + magnitude % 10);
+         magnitude /= 10;
+     } while (magnitude > 0);
+     if (value < 0) {
+         digits[--start] = '-';
+     }
      
-     if (!has_premises) {
-         printf("No premises associated with this customer.\n");
+     writerBytes(writer, digits + start, sizeof(digits) - start);
+ }
+ 
+ // Buffer a cents amount as a dollar amount with two decimal places
+ void writerMoney(BufferedWriter *writer, Money amount) {
+     uint64_t magnitude = amount < 0 ? 0 - (uint64_t)amount : (uint64_t)amount;
+     if (amount < 0) {
+         writerChar(writer, '-');
      }
+     writerInt(writer, (int64_t)(magnitude / CENTS_PER_DOLLAR));
      
-     // Display billing history
-     printf("\nBilling History:\n");
-     bool has_bills = false;
+     char cents[3] = { '.', (char)('0' + magnitude % CENTS_PER_DOLLAR / 10), (char)('0' + magnitude % 10) };
+     writerBytes(writer, cents, sizeof(cents));
+ }
+ 
+ /**
+  * Buffer a string field
+  * 
+  * JSON strings are always quoted, with quotes, backslashes and control
+  * characters escaped. CSV fields are quoted (with quotes doubled) only when
+  * they contain a comma, quote or line break.
+  * 
+  * @param writer - Output file
+  * @param text - Text of the field
+  * @param format - CSV or JSON
+  */
+ void writerQuoted(BufferedWriter *writer, const char *text, ExportFormat format) {
+     size_t length = strlen(text);
      
-     FILE *file = fopen(FILE_BILLS, "rb");
-     if (file != NULL) {
-         Bill bill;
-         while (fread(&bill, sizeof(Bill), 1, file) == 1) {
-             if (strcmp(bill.customer_number, customer_number) == 0) {
-                 has_bills = true;
-                 printf("Bill ID: %s\n", bill.bill_id);
-                 printf("Premises Number: %s\n", bill.premises_number);
-                 printf("Month: %d\n", bill.month_number);
-                 printf("Consumption: %d litres\n", bill.consumption);
-                 printf("Total Amount Due: $%.2f\n", bill.total_amount_due);
-                 printf("Amount Paid: $%.2f\n", bill.amount_paid);
-                 printf("Status: %s\n", bill.is_paid ? "PAID" : "UNPAID");
-                 printf("---------------------------\n");
+     if (format == EXPORT_CSV) {
+         if (strpbrk(text, ",\"\r\n") == NULL) {
+             writerBytes(writer, text, length);
+             return;
+         }
+         writerChar(writer, '"');
+         for (size_t i = 0; i < length; i++) {
+             if (text[i] == '"') {
+                 writerChar(writer, '"');
              }
+             writerChar(writer, text[i]);
          }
-         fclose(file);
+         writerChar(writer, '"');
+         return;
      }
      
-     if (!has_bills) {
-         printf("No bills found for this customer.\n");
+     writerChar(writer, '"');
+     for (size_t i = 0; i < length; i++) {
+         unsigned char c = (unsigned char)text[i];
+         if (c == '"' || c == '\\') {
+             writerChar(writer, '\\');
+             writerChar(writer, (char)c);
+         } else if (c < 0x20) {
+             char escaped[6] = { '\\', 'u', '0', '0', "0123456789abcdef"[c >> 4], "0123456789abcdef"[c & 15] };
+             writerBytes(writer, escaped, sizeof(escaped));
+         } else {
+             writerChar(writer, (char)c);
+         }
      }
+     writerChar(writer, '"');
  }
  
- // Clear the screen
- void clearScreen() {
-     #ifdef _WIN32
-         system("cls");
-     #else
-         system("clear");
-     #endif
+ // Stage new users as the next records of users.txt (added to the user table and email index when the journal commits)
+ void stageUsers(const User *users, int count) {
+     for (int i = 0; i < count; i++) {
+         journalStage(JOURNAL_USERS, user_table.count + journal.staged_users, &users[i], sizeof(User));
+         journal.staged_users++;
+     }
  }
  
- // Pause the screen
- void pauseScreen() {
-     printf("\nPress Enter to continue...");
-     getchar();
- }
\ No newline at end of file
+ // Look up a user by email (NULL if no user has that email)
+ User *findUserByEmail(const char *email) {
+     int cursor = -1;
+     int32_t row;
+     
+     while ((row = hashIndexFind(&users_by_email, hashString(email), &cursor)) >= 0) {
+         if (strcmp(userAt(row)->email, email) == 0) {
+             return userAt(row);
+         }
+     }
+     
+     return NULL;
+ }
+ 
+ // Look up the active customer record of a user account (NULL if none)
+ Customer *findCustomerByUserId(int user_id) {
+     int cursor = -1;
+     int32_t row;
+     
+     while ((row = hashIndexFind(&customers_by_user_id, (uint64_t)(uint32_t)user_id, &cursor)) >= 0) {
+         if (customerAt(row)->user_id == user_id && customerAt(row)->is_active) {
+             return customerAt(row);
+         }
+     }
+     
+     return NULL;
+ }